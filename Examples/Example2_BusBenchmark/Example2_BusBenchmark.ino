@@ -0,0 +1,114 @@
+#include <Wire.h>
+#include "asm_sensors_w_mux_library.h"
+
+// Measure the I2C traffic and time used by begin(), pollButtons() and readSensor()
+// so changes to the library can be compared against a baseline.
+// The counts are only the transactions the library makes itself, not the ones of the
+// SparkFun drivers (most of begin()), test/bus_benchmark.cpp counts all of the traffic
+// on a simulated bus without hardware.
+// Run with 1 to 8 sensors attached to the mux, the report lists the cost of
+// reading 1 up to all of the populated ports, then the time (and CPU cycles) of
+// reading the data of each sensor type and the flash the sketch uses.
+// Auto clock is turned on, so each port is read at the fastest I2C clock begin() found it
+// works at (saved with the ports for the next begin()), which is printed first.
+// readSensor() only queues its output, the time it takes does not include sending
+// it, the serial queue high water mark and stall time show if the queue is big enough.
+
+SpectroDesktop spectro;
+const int POLL_REPEATS = 10;
+const int READ_REPEATS = 20;
+#if defined(__AVR__)
+extern char __data_load_end;  // end of the program and its initialized data in flash
+#endif
+
+void printStats(const char* name, BusStats stats, unsigned long elapsed) {
+    Serial.print(name);
+    Serial.print(" | transactions: "); Serial.print(stats.transactions);
+    Serial.print(" | bytes written: "); Serial.print(stats.bytesWritten);
+    Serial.print(" | bytes read: "); Serial.print(stats.bytesRead);
+    Serial.print(" | errors: "); Serial.print(stats.errors);
+    Serial.print(" | retries: "); Serial.print(stats.retries);
+    Serial.print(" | bus clears: "); Serial.print(stats.busClears);
+    Serial.print(" | time (us): "); Serial.println(elapsed);
+}
+
+void setup() {
+    Serial.begin(115200);
+    Wire.begin();
+    Serial.println("ASM spectral sensor Desktop Example 2: Bus Benchmark");
+
+    spectro.setAutoClock(true);
+    unsigned long start = micros();
+    spectro.begin();
+    printStats("begin()", spectro.getBusStats(), micros() - start);
+    for (byte port = 0; port < spectro.getPortCount(); port++) {
+        if (spectro.getPortSensorType(port) != NO_SENSOR) {
+            Serial.print("port: "); Serial.print(port);
+            Serial.print(" I2C clock (kHz): "); Serial.println(spectro.getPortClockHz(port) / 1000);
+        }
+    }
+
+    spectro.resetBusStats();
+    start = micros();
+    for (int i = 0; i < POLL_REPEATS; i++) {
+        spectro.pollButtons();
+    }
+    BusStats pollStats = spectro.getBusStats();
+    unsigned long pollTime = (micros() - start) / POLL_REPEATS;
+    pollStats.transactions /= POLL_REPEATS;
+    pollStats.bytesWritten /= POLL_REPEATS;
+    pollStats.bytesRead /= POLL_REPEATS;
+    printStats("pollButtons() idle, per call", pollStats, pollTime);
+
+    byte portsRead = 0;
+    unsigned long readTime = 0;
+    spectro.resetBusStats();
+    spectro.resetTxStats();
+    for (byte port = 0; port < spectro.getPortCount(); port++) {
+        if (spectro.getPortSensorType(port) == NO_SENSOR) {
+            continue;
+        }
+        start = micros();
+        spectro.readSensor(port);  // queues the reading, it is sent in the background
+        readTime += micros() - start;
+        portsRead += 1;
+        spectro.flushOutput();  // so the lines below come after the reading
+        Serial.print("readSensor() ports populated: "); Serial.println(portsRead);
+        printStats("readSensor() cumulative", spectro.getBusStats(), readTime);
+    }
+    TxQueueStats txStats = spectro.getTxStats();
+    Serial.print("serial queue high water (bytes): "); Serial.print(txStats.highWater);
+    Serial.print(" of "); Serial.print(SPECTRO_TX_QUEUE_SIZE);
+    Serial.print(" | stalls: "); Serial.print(txStats.stalls);
+    Serial.print(" | stall time (us): "); Serial.println(txStats.stallUs);
+
+    // time of reading the last measurement of each port, with the traffic per read
+    for (byte port = 0; port < spectro.getPortCount(); port++) {
+        if (spectro.getPortSensorType(port) == NO_SENSOR) {
+            continue;
+        }
+        float values[AS7265X_CHANNELS];
+        spectro.resetBusStats();
+        start = micros();
+        for (int i = 0; i < READ_REPEATS; i++) {
+            spectro.readCalibratedData(port, values);
+        }
+        unsigned long readTime = (micros() - start) / READ_REPEATS;
+        BusStats readStats = spectro.getBusStats();
+        readStats.transactions /= READ_REPEATS;
+        readStats.bytesWritten /= READ_REPEATS;
+        readStats.bytesRead /= READ_REPEATS;
+        Serial.print("readCalibratedData() port: "); Serial.print(port);
+        Serial.print(" channels: "); Serial.println(spectro.getChannelCount(port));
+        printStats("readCalibratedData() per read", readStats, readTime);
+        Serial.print("cycles per read: "); Serial.println(readTime * (F_CPU / 1000000UL));
+    }
+    #if defined(__AVR__)
+        Serial.print("flash used (bytes): "); Serial.println((unsigned int)&__data_load_end);
+    #else
+        Serial.println("flash used: see the sketch size the compiler reports");
+    #endif
+}
+
+void loop() {
+}
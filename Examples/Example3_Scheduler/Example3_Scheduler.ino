@@ -0,0 +1,49 @@
+#include <Wire.h>
+#include "asm_sensors_w_mux_library.h"
+
+// Sample every sensor found on a fixed period with the scheduler, the buttons still
+// take a reading when clicked.  Every STATS_PERIOD_MS the deadline misses and jitter
+// of each port are printed.
+
+SpectroDesktop spectro;
+const unsigned long SAMPLE_PERIOD_MS = 2000;
+const unsigned long STATS_PERIOD_MS = 60000;
+unsigned long lastStats = 0;
+
+void printScheduleStats() {
+    spectro.flushOutput();  // send the queued readings before the stats
+    for (byte port = 0; port < spectro.getPortCount(); port++) {
+        if (spectro.getPortSensorType(port) == NO_SENSOR) {
+            continue;
+        }
+        ScheduleStats stats = spectro.getScheduleStats(port);
+        Serial.print("Port: "); Serial.print(port);
+        Serial.print(" | samples: "); Serial.print(stats.samples);
+        Serial.print(" | deadline misses: "); Serial.print(stats.deadlineMisses);
+        Serial.print(" | mean jitter (ms): ");
+        Serial.print(stats.samples ? stats.totalJitterMs / stats.samples : 0);
+        Serial.print(" | max jitter (ms): "); Serial.print(stats.maxJitterMs);
+        Serial.print(" | max lateness (ms): "); Serial.println(stats.maxLatenessMs);
+    }
+}
+
+void setup() {
+    Serial.begin(115200);
+    Wire.begin();
+    Serial.println("ASM spectral sensor Desktop Example 3: Scheduled Sampling");
+    spectro.begin();
+    for (byte port = 0; port < spectro.getPortCount(); port++) {
+        if (spectro.getPortSensorType(port) != NO_SENSOR) {
+            spectro.setSamplePeriod(port, SAMPLE_PERIOD_MS);
+        }
+    }
+    spectro.startScheduler();
+}
+
+void loop() {
+    spectro.serviceScheduler();
+    if (millis() - lastStats >= STATS_PERIOD_MS) {
+        lastStats = millis();
+        printScheduleStats();
+    }
+}
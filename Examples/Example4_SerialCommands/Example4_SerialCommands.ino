@@ -0,0 +1,25 @@
+#include <Wire.h>
+#include "asm_sensors_w_mux_library.h"
+
+// Change the port settings and take readings from the host over the serial port,
+// without recompiling.  Send commands like these (see spectro_command.h for all of them),
+// several can go on 1 line separated by ';' and each is answered with ACK or NAK and its number:
+//   1 INT * 100; 2 LED 3 2; 3 BULB 3 0x05
+//   4 READ 3
+//   5 PERIOD * 1000; 6 START
+//   7 STATS
+//   8 CAPTURE 3
+
+SpectroDesktop spectro;
+
+void setup() {
+    Serial.begin(115200);
+    Wire.begin();
+    Serial.println("ASM spectral sensor Desktop Example 4: Serial Commands");
+    spectro.begin();
+}
+
+void loop() {
+    spectro.serviceCommands();
+    spectro.serviceScheduler();  // buttons, scheduled samples and sending the readings
+}
@@ -0,0 +1,30 @@
+#include <Wire.h>
+#include "asm_sensors_w_mux_library.h"
+
+// Take a dark frame and then 1 frame with each bulb on by itself, with the dark frame
+// taken off the lit ones, on every sensor in turn.  Each bulb is only on while its
+// frame integrates, and each frame is sent while the next one integrates.
+
+SpectroDesktop spectro;
+const unsigned long CAPTURE_PERIOD_MS = 10000;
+
+void setup() {
+    Serial.begin(115200);
+    Wire.begin();
+    Serial.println("ASM spectral sensor Desktop Example 5: Capture Sequence");
+    spectro.begin();
+}
+
+void loop() {
+    for (byte port = 0; port < spectro.getPortCount(); port++) {
+        if (spectro.getPortSensorType(port) == NO_SENSOR) {
+            continue;
+        }
+        if (!spectro.captureSequence(port)) {
+            spectro.flushOutput();  // the frames that were sent come first
+            Serial.print("Capture did not finish on port: "); Serial.println(port);
+        }
+    }
+    spectro.flushOutput();  // nothing sends the queued output during the delay
+    delay(CAPTURE_PERIOD_MS);
+}
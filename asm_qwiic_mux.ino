@@ -19,4 +19,5 @@ void setup() {
 void loop() {
     Serial.println("Loop");
     spectro.pollButtons();
+    spectro.serviceCommands();  // settings and readings sent from the host
 }
@@ -24,45 +24,253 @@
 
 #include "asm_sensors_w_mux_library.h"
 #include "Arduino.h"
+#if defined(__has_include)
+#if __has_include(<EEPROM.h>)
+#include <EEPROM.h>
+#define HAS_EEPROM (1)
+#endif
+#endif
+#ifndef HAS_EEPROM
+#define HAS_EEPROM (0)
+#endif
 
 #define DEBUG_FLAG (0)
 
+// Time an operation or count an event for the port's profile, nothing when PROFILE_FLAG is 0
+#if(PROFILE_FLAG)
+#define PROFILE_START(name)	unsigned long name = micros()
+#define PROFILE_TIME(port, event, name)	profileTime(port, event, name)
+#define PROFILE_COUNT(port, counter)	profileCount(port, counter)
+#else
+#define PROFILE_START(name)
+#define PROFILE_TIME(port, event, name)
+#define PROFILE_COUNT(port, counter)
+#endif
+
+// Driver table entry for a traits struct from sensor_traits.h
+#define SENSOR_DRIVER(Traits) { Traits::hardwareCode, Traits::channels, Traits::bulbs, Traits::decimals, \
+    Traits::defaultIntegration, Traits::name(), &Traits::wavelength, \
+    &SpectroDesktop::readCalibratedChannels<Traits>, &SpectroDesktop::readRawChannels<Traits>, \
+    &SpectroDesktop::driveBulbs<Traits>, &SpectroDesktop::updateDevices<Traits> }
+
+// Frequency of each I2cClock
+static const unsigned long CLOCK_HZ[I2C_CLOCK_COUNT] = { 400000, 200000, 100000, 50000 };
+
+static uint16_t peakCount(const uint16_t *counts, byte channels) {
+    /* Get the brightest of the raw channel counts */
+    uint16_t peak = 0;
+    for (byte i = 0; i < channels; i++) {
+        peak = max(peak, counts[i]);
+    }
+    return peak;
+}
+
 //Constructor
 SpectroDesktop::SpectroDesktop()
 {
+    for (byte i = 0; i < MAX_PORTS; i++) {
+        enableBulbsArray[i] = DEFAULT_BULB_ENABLE;
+        gains[i] = DEFAULT_GAIN;
+        portClocks[i] = CLOCK_100KHZ;  // what the ports ran at before they are tuned
+    }
+    for (byte i = 0; i < MAX_I2C_BUSES; i++) {
+        sdaPins[i] = NO_BUS_PIN;
+        sclPins[i] = NO_BUS_PIN;
+        busClocks[i] = NO_CLOCK;
+    }
+    resetDeltaStates();
+    txQueue.begin(Serial);
 }
 
 // Initialize the device by:
 // 1) checking for the qwiic mux
-// 2) look for any and all as7262/as7263/as7265x sensor over qwiic
+// 2) checking the ports saved in EEPROM are still there, or if not
+// 3) look for any and all as7262/as7263/as7265x sensor over qwiic
 // Returns false if no sensor
 bool SpectroDesktop::begin(TwoWire &wirePort) {
-    /* Start the I2C and button, then check for a mux.  If there is a mux, each port
-    of the mux will be enabled (and the other ports disabled) and checked for the AS726x / AS7265x 
-    and the Qwicc button I2C address
+    /* Start the I2C and button, then check for a mux.  If the ports saved by the last
+    begin() all still answer they are used as is, otherwise each port of the mux will be
+    enabled (and the other ports disabled) and checked for the AS726x / AS7265x 
+    and the Qwicc button I2C address, and the result is saved.  Muxes at all 8 mux
+    addresses on wirePort and any buses given to addBus() are used, their ports are
+    numbered in the order the muxes are found, 8 per mux.  With auto clock (see setAutoClock())
+    a full scan then moves each port with a sensor to the fastest I2C clock it works at and
+    saves the clocks with the ports, the saved ports start at their saved clocks
     
     Returns true if a color sensor I2C address is found*/
     _i2cPort = &wirePort;
+    buses[0] = &wirePort;
+    busCount = max(busCount, (byte)1);
+    #if defined(PIN_WIRE_SDA) && defined(PIN_WIRE_SCL)
+        if (&wirePort == &Wire && sdaPins[0] == NO_BUS_PIN) {  // the board's own I2C pins
+            setBusPins(0, PIN_WIRE_SDA, PIN_WIRE_SCL);
+        }
+    #endif
+    for (byte i = 0; i < busCount; i++) {
+        setBusTimeout(buses[i]);
+    }
 
-    button.begin();  // use this to represent every button
+    button.begin(BUTTON_ADDR, wirePort);  // use this to represent every button
+    buttonBus = &wirePort;
     #if(DEBUG_FLAG)
-        Serial.println("Checking for a mux");
+        txQueue.println("Checking for a mux");
     #endif
-    bool foundDevice = false;  // initialize to false, then set to true if a sensor is found
+    TopologyCache cache;
+    bool haveCache = loadTopology(cache);
+    // a saved setup without a mux only needs 1 check, a mux that is there answers quickly
+    useMux = checkForMux((haveCache && !cache.useMux) ? 1 : MAX_TIMES_CHECK_FOR_MUX);
+    if (haveCache && cache.useMux == useMux && restoreTopology(cache)) {
+        txQueue.println("Using saved port setup");
+        lastClockRetest = millis();
+        txQueue.flush();  // begin() waits anyway, so its messages come before the sketch's
+        for (byte i = 0; i < portCount(); i++) {
+            if (sensorTypeArray[i] != NO_SENSOR) {
+                return true;
+            }
+        }
+        return false;
+    }
+    findMuxes();
+    bool foundDevice = scanPorts();
+    tuneClocks();
+    saveTopology();
+    #if(DEBUG_FLAG)
+        txQueue.println("End Setup");
+    #endif
+    txQueue.flush();
+    return (foundDevice);
+}
+
+bool SpectroDesktop::checkForMux(byte maxTimes) {
+    /* Check for the mux up to maxTimes, waiting longer after each miss.
+    Return true if the mux answered */
+    transferPort = NO_PORT;  // looking for the mux is not traffic for any port
+    int wait = MUX_CHECK_FIRST_DELAY_MS;
     byte muxCheckTimes = 0;
-    do {
-        useMux = checkI2cAddress(MUX_ADDR);  // set boolean if the device has a i2c mux or not
+    bool found = false;
+    while (true) {
+        found = checkI2cAddress(MUX_ADDR);
         muxCheckTimes += 1;
-        Serial.print("Checking for mux times: "); Serial.println(muxCheckTimes);
-    } while (!useMux && muxCheckTimes <= MAX_TIMES_CHECK_FOR_MUX);
-    
+        if (found || muxCheckTimes >= maxTimes) {
+            break;
+        }
+        delay(wait);
+        wait = min(wait * 2, MUX_CHECK_MAX_DELAY_MS);
+    }
+    txQueue.print("Checking for mux times: "); txQueue.println(muxCheckTimes);
+    return found;
+}
+
+bool SpectroDesktop::addBus(TwoWire &wirePort, byte sdaPin, byte sclPin) {
+    /* Add another I2C bus to look for muxes on, call before begin().
+    Bus 0 is always the one given to begin().  The pins are used to clear the bus
+    if it gets stuck.  Return false if MAX_I2C_BUSES are in use */
+    if (busCount == 0) {
+        busCount = 1;  // keep bus 0 for begin()
+    }
+    if (busCount >= MAX_I2C_BUSES) {
+        return false;
+    }
+    buses[busCount] = &wirePort;
+    setBusPins(busCount, sdaPin, sclPin);
+    busCount += 1;
+    return true;
+}
+
+void SpectroDesktop::setBusPins(byte bus, byte sdaPin, byte sclPin) {
+    /* Set the SDA and SCL pins of a bus (0 is the one given to begin()), used to clock
+    out a device that holds the bus.  begin() knows the pins of Wire on most boards */
+    if (bus >= MAX_I2C_BUSES) {
+        return;
+    }
+    sdaPins[bus] = sdaPin;
+    sclPins[bus] = sclPin;
+}
+
+void SpectroDesktop::findMuxes() {
+    /* Look for a mux at every mux address on every bus, up to MAX_MUXES.  Each mux found
+    has all its ports closed so it does not hide the ones after it */
+    transferPort = NO_PORT;
+    muxCount = 0;
+    for (byte bus = 0; bus < busCount; bus++) {
+        _i2cPort = buses[bus];
+        for (byte address = MUX_ADDR; address <= LAST_MUX_ADDR && muxCount < MAX_MUXES; address++) {
+            // the first mux was already checked a few times by checkForMux()
+            bool found = (bus == 0 && address == MUX_ADDR) ? useMux : checkI2cAddress(address);
+            if (!found) {
+                continue;
+            }
+            muxes[muxCount] = MuxInfo{ bus, address, 0, false };
+            sendMuxSettings(muxCount, 0);
+            muxCount += 1;
+        }
+    }
+    _i2cPort = buses[0];
+    useMux = (muxCount > 0);
+}
+
+byte SpectroDesktop::portCount() {
+    /* Number of ports, 8 for each mux or 1 if there is no mux */
+    return useMux ? muxCount * 8 : 1;
+}
+
+byte SpectroDesktop::getPortCount() {
+    return portCount();
+}
+
+bool SpectroDesktop::checkPort(byte portNumber, const char *caller) {
+    /* Check portNumber is one of the ports begin() found, if not say so in TEXT_OUTPUT,
+    with the name of the function that was called */
+    if (portNumber < portCount()) {
+        return true;
+    }
+    if (outputMode == TEXT_OUTPUT) {
+        txQueue.print(caller); txQueue.print(": port Number has to be ");
+        txQueue.print(portCount() - 1); txQueue.println(" or less");
+    }
+    return false;
+}
+
+bool SpectroDesktop::getPortLocation(byte portNumber, byte &bus, byte &muxAddress, byte &channel) {
+    /* Get which bus, mux and mux channel a port number is.
+    Return false if there is no such port */
+    if (portNumber >= portCount()) {
+        return false;
+    }
+    if (!useMux) {
+        bus = 0;
+        muxAddress = 0;
+        channel = 0;
+        return true;
+    }
+    bus = muxes[portNumber / 8].bus;
+    muxAddress = muxes[portNumber / 8].address;
+    channel = portNumber % 8;
+    return true;
+}
+
+QwiicButton &SpectroDesktop::portButton() {
+    /* Get the button object talking to the bus of the selected port */
+    if (buttonBus != _i2cPort) {
+        button.begin(BUTTON_ADDR, *_i2cPort);
+        buttonBus = _i2cPort;
+    }
+    return button;
+}
+
+bool SpectroDesktop::scanPorts() {
+    /* Look on every mux port, or just the board's Qwiic connection if there is no mux,
+    for a sensor and set it up.  Return true if a sensor is found */
+    bool foundDevice = false;  // initialize to false, then set to true if a sensor is found
+    buttonPorts = 0;
     if (useMux) {
-        Serial.println("Have mux");
-        for (byte i = 0; i <= 7; i++) {  // go thru each port on the i2c mux
+        txQueue.println("Have mux");
+        for (byte i = 0; i < portCount(); i++) {  // go thru each port on the i2c mux
+            sensorTypeArray[i] = NO_SENSOR;
             enableMuxPort(i);
             int avail = checkI2cAddress(AS726X_ADDR);  // check if sensor i2c address is on the port
-            Serial.print("Port: "); Serial.print(i);
-            Serial.print(" available: "); Serial.println(avail);
+            txQueue.print("Port: "); txQueue.print(i);
+            txQueue.print(" available: "); txQueue.println(avail);
             if (avail) {  // get what type of sensor is on the port AS7262 / AS7263 / or AS7265X
                 sensorTypeArray[i] = getSensorType(i);
                 foundDevice = true;
@@ -70,204 +278,1769 @@ bool SpectroDesktop::begin(TwoWire &wirePort) {
         }
     }
     else {  // if no mux just check if a sensor is attached to the board's Qwiic connection
-        Serial.println("No mux");
+        txQueue.println("No mux");
         int avail = checkI2cAddress(AS726X_ADDR);
         if (avail) {
             sensorTypeArray[0] = getSensorType(0);  // just put in a place holder for the channel
             foundDevice = true;
         }
     }
+    return foundDevice;
+}
+
+bool SpectroDesktop::loadTopology(TopologyCache &cache) {
+    /* Read the saved setup from EEPROM, return false if there is none or it is corrupt */
+    #if(HAS_EEPROM)
+        byte *bytes = (byte *)&cache;
+        for (unsigned int i = 0; i < sizeof(TopologyCache); i++) {
+            bytes[i] = EEPROM.read(TOPOLOGY_EEPROM_ADDRESS + i);
+        }
+        return (cache.magic == TOPOLOGY_MAGIC && cache.version == TOPOLOGY_VERSION &&
+                cache.crc == spectroCrc16(bytes, sizeof(TopologyCache) - sizeof(cache.crc)));
+    #else
+        (void)cache;
+        return false;
+    #endif
+}
+
+bool SpectroDesktop::saveTopology() {
+    /* Save the ports found and their integration time, LED current and bulb settings
+    to EEPROM so the next begin() can skip the full scan.  Only bytes that changed are
+    written.  Return false if the board has no EEPROM */
+    topologyUnsaved = false;
+    #if(HAS_EEPROM)
+        TopologyCache cache;
+        fillTopology(cache);
+        const byte *bytes = (const byte *)&cache;
+        #if defined(ESP8266) || defined(ESP32)
+            EEPROM.begin(TOPOLOGY_EEPROM_ADDRESS + sizeof(TopologyCache));
+        #endif
+        for (unsigned int i = 0; i < sizeof(TopologyCache); i++) {
+            if (EEPROM.read(TOPOLOGY_EEPROM_ADDRESS + i) != bytes[i]) {
+                EEPROM.write(TOPOLOGY_EEPROM_ADDRESS + i, bytes[i]);
+            }
+        }
+        #if defined(ESP8266) || defined(ESP32)
+            EEPROM.commit();
+        #endif
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+void SpectroDesktop::clearTopology() {
+    /* Erase the saved setup so the next begin() does a full scan */
+    #if(HAS_EEPROM)
+        #if defined(ESP8266) || defined(ESP32)
+            EEPROM.begin(TOPOLOGY_EEPROM_ADDRESS + sizeof(TopologyCache));
+        #endif
+        EEPROM.write(TOPOLOGY_EEPROM_ADDRESS, 0xFF);  // breaks the magic number
+        #if defined(ESP8266) || defined(ESP32)
+            EEPROM.commit();
+        #endif
+    #endif
+}
+
+void SpectroDesktop::fillTopology(TopologyCache &cache) {
+    /* Copy the current setup into cache and set its CRC */
+    memset(&cache, 0, sizeof(TopologyCache));  // so padding bytes do not change the CRC
+    cache.magic = TOPOLOGY_MAGIC;
+    cache.version = TOPOLOGY_VERSION;
+    cache.useMux = useMux;
+    cache.muxCount = muxCount;
+    for (byte i = 0; i < muxCount; i++) {
+        cache.muxBuses[i] = muxes[i].bus;
+        cache.muxAddresses[i] = muxes[i].address;
+    }
+    cache.buttonPorts = buttonPorts;
+    for (byte i = 0; i < MAX_PORTS; i++) {
+        cache.sensorTypes[i] = sensorTypeArray[i];
+        cache.integrationTimes[i] = integrationTimes[i];
+        cache.ledCurrents[i] = ledCurrents[i];
+        cache.gains[i] = gains[i];
+        cache.enableBulbs[i] = enableBulbsArray[i];
+        cache.portClocks[i] = portClocks[i];
+    }
+    cache.crc = spectroCrc16((const byte *)&cache, sizeof(TopologyCache) - sizeof(cache.crc));
+}
+
+bool SpectroDesktop::restoreTopology(const TopologyCache &cache) {
+    /* Check every saved mux, sensor and button still answers, with 1 address check
+    each, and set the sensors up with the saved settings.
+    Return false if any of them is missing, begin() then finds the muxes again */
+    if (cache.muxCount > MAX_MUXES) {
+        return false;
+    }
+    for (byte i = 0; i < cache.muxCount; i++) {
+        if (cache.muxBuses[i] >= busCount) {
+            return false;
+        }
+        _i2cPort = buses[cache.muxBuses[i]];
+        if (!checkI2cAddress(cache.muxAddresses[i])) {
+            return false;
+        }
+        muxes[i] = MuxInfo{ cache.muxBuses[i], cache.muxAddresses[i], 0, false };
+    }
+    muxCount = cache.muxCount;
+    useMux = (muxCount > 0);
+    for (byte i = 0; i < portCount(); i++) {
+        if (cache.sensorTypes[i] == NO_SENSOR) {
+            continue;
+        }
+        if (!enableMuxPort(i) || !checkI2cAddress(AS726X_ADDR) ||
+            checkI2cAddress(BUTTON_ADDR) != (bool)(cache.buttonPorts & PORT_BIT(i))) {
+            #if(DEBUG_FLAG)
+                txQueue.print("Saved setup does not match port: "); txQueue.println(i);
+            #endif
+            return false;
+        }
+    }
+    buttonPorts = cache.buttonPorts;
+    for (byte i = 0; i < MAX_PORTS; i++) {
+        sensorTypeArray[i] = cache.sensorTypes[i];
+        integrationTimes[i] = cache.integrationTimes[i];
+        ledCurrents[i] = cache.ledCurrents[i];
+        gains[i] = cache.gains[i];
+        enableBulbsArray[i] = cache.enableBulbs[i];
+        if (autoClock && cache.portClocks[i] < I2C_CLOCK_COUNT) {  // what tuneClocks() found
+            portClocks[i] = cache.portClocks[i];
+        }
+        if (sensorTypeArray[i] != NO_SENSOR && i < portCount()) {
+            enableMuxPort(i);
+            configureSensor(i);
+            if (buttonPorts & PORT_BIT(i)) {
+                clearButtonEvents();  // Clear any clicks before being setup
+            }
+        }
+    }
+    return true;
+}
+
+void SpectroDesktop::setHotPlug(bool enable, byte missLimit) {
+    /* Turn on checking for sensors being plugged in or unplugged.  Each pollButtons()
+    checks 1 port, so the extra bus traffic per poll is a few address checks at most.
+    A sensor is treated as unplugged after missLimit checks in a row do not find it.
+    The new setup is saved once it has not changed for TOPOLOGY_SAVE_DELAY_MS, call
+    saveTopology() to save it straight away */
+    hotPlug = enable;
+    hotPlugMissLimit = max(missLimit, (byte)1);
+}
+
+void SpectroDesktop::setPortEventCallback(PortEventCallback callback) {
+    /* Set a function to call when hot plug finds a sensor plugged in or unplugged */
+    portEventCallback = callback;
+}
+
+void SpectroDesktop::rescanStep() {
+    /* Check the next port for a sensor and button being plugged in or unplugged.
+    A new sensor is set up right away from its hardware type, without the driver begin().
+    The changes are saved to EEPROM once no port has changed for TOPOLOGY_SAVE_DELAY_MS */
+    if (topologyUnsaved && millis() - topologyChangedAt >= TOPOLOGY_SAVE_DELAY_MS) {
+        saveTopology();
+    }
+    byte port = rescanPort;
+    rescanPort = (rescanPort + 1) % portCount();  // without a mux there is only port 0
+    if ((pendingPorts & PORT_BIT(port)) || !enableMuxPort(port)) {
+        return;
+    }
+    bool sensorThere = checkI2cAddress(AS726X_ADDR);
+    if (sensorTypeArray[port] == NO_SENSOR) {
+        if (sensorThere) {
+            attachPort(port);
+        }
+        return;
+    }
+    if (!sensorThere) {
+        missCounts[port] += 1;
+        if (missCounts[port] >= hotPlugMissLimit) {
+            detachPort(port);
+        }
+        return;
+    }
+    missCounts[port] = 0;
+    bool buttonThere = checkI2cAddress(BUTTON_ADDR);
+    if (buttonThere != (bool)(buttonPorts & PORT_BIT(port))) {
+        if (buttonThere) {
+            buttonPorts |= PORT_BIT(port);
+            if (buttonInterruptPin != NO_INTERRUPT_PIN) {
+                portButton().enableClickedInterrupt();
+            }
+            clearButtonEvents();
+        }
+        else {
+            buttonPorts &= ~PORT_BIT(port);
+        }
+        topologyChanged();
+    }
+}
+
+void SpectroDesktop::topologyChanged() {
+    /* Note hot plug changed the ports, rescanStep() saves them once they settle */
+    topologyUnsaved = true;
+    topologyChangedAt = millis();
+}
+
+void SpectroDesktop::attachPort(byte portNumber) {
+    /* Set up a sensor hot plug found on an empty port */
+    byte hw_type = 0;
+    if (!readVirtualRegister(HW_VERSION_REGISTER, hw_type)) {
+        return;  // try again next time around
+    }
+    SensorType type = typeFromHardwareCode(hw_type);
+    if (type == NO_SENSOR) {
+        return;
+    }
+    sensorTypeArray[portNumber] = type;
+    integrationTimes[portNumber] = driverFor(type)->defaultIntegration;
+    ledCurrents[portNumber] = 0;
+    gains[portNumber] = DEFAULT_GAIN;
+    missCounts[portNumber] = 0;
+    exposedPorts &= ~PORT_BIT(portNumber);
+    configureSensor(portNumber);
+    if (checkI2cAddress(BUTTON_ADDR)) {
+        buttonPorts |= PORT_BIT(portNumber);
+        if (buttonInterruptPin != NO_INTERRUPT_PIN) {
+            portButton().enableClickedInterrupt();
+        }
+        clearButtonEvents();
+    }
     #if(DEBUG_FLAG)
-        Serial.println("End Setup");
+        txQueue.print("Sensor plugged into port: "); txQueue.println(portNumber);
     #endif
-    return (foundDevice);
+    topologyChanged();
+    if (portEventCallback != nullptr) {
+        portEventCallback(portNumber, type, true);
+    }
+}
+
+void SpectroDesktop::detachPort(byte portNumber) {
+    /* Forget a sensor hot plug has not found for too long */
+    SensorType type = sensorTypeArray[portNumber];
+    sensorTypeArray[portNumber] = NO_SENSOR;
+    buttonPorts &= ~PORT_BIT(portNumber);
+    pendingPorts &= ~PORT_BIT(portNumber);
+    scheduledPorts &= ~PORT_BIT(portNumber);
+    if (portNumber == capturePort) {
+        endCapture();
+    }
+    missCounts[portNumber] = 0;
+    #if(DEBUG_FLAG)
+        txQueue.print("Sensor unplugged from port: "); txQueue.println(portNumber);
+    #endif
+    topologyChanged();
+    if (portEventCallback != nullptr) {
+        portEventCallback(portNumber, type, false);
+    }
+}
+
+bool SpectroDesktop::configureSensor(byte portNumber) {
+    /* Set up a sensor whose type is already known, without the full driver begin():
+    bulbs and indicator off, then every shadow setting is written
+    (the mux must be connected correctly before calling this) */
+    const SensorDriver *driver = driverFor(sensorTypeArray[portNumber]);
+    byte ledOff = LED_DRIVE_ENABLE_BIT | INDICATOR_ENABLE_BIT;
+    configDirty[portNumber] = CONFIG_ALL;  // what the sensor has is not known
+    configSuspect &= ~PORT_BIT(portNumber);
+    if (driver == nullptr || !(this->*driver->updateDevices)(LED_CONTROL_REGISTER, ledOff, 0)) {
+        return false;
+    }
+    return applyConfig(portNumber);
 }
 
 void SpectroDesktop::pollButtons() {
-    // go thru each port on the i2c mux, if no mux, sensor_type will be NO_SENSOR for 1-7 anyways
-    // Serial.println("Polling Buttons");
-    for (byte i = 0; i <= 7; i++) {  
-        //Serial.print("i: "); Serial.println(i);
-        //Serial.print("Sensor type: "); Serial.println(sensorTypeArray[i]);
-        enableMuxPort(i);
-        if (sensorTypeArray[i] != NO_SENSOR) {  // check if a sensor was initialized there
-            byte settings = getMuxSettings();
-            //Serial.print("Mux settings: "); Serial.println(settings);
-            //Serial.print("sensor on port "); Serial.println(button.isConnected());
-            if (button.isConnected() == true) {
-                // Serial.println("Has button");
-                if (button.hasBeenClicked()) {
-                    //button.LEDon(BUTTON_LED_LIGHT_LEVEL);
-                    button.clearEventBits();
-                    #if(DEBUG_FLAG==2)
-                        Serial.print("Button clicked on port: "); Serial.println(i);
-                    #endif
-
-                    readSensor(i);
-
-                    //button.LEDoff();
-                    //Serial.println("End Data Read");
-                }
-            }
+    /* Go thru each port that has a button and read a sensor if its button was clicked,
+    then send any queued reading.  Call this every loop() when not using the scheduler */
+    serviceButtons();
+    if (hotPlug) {
+        rescanStep();
+    }
+    retestClockStep();
+    drainRecords();  // send a reading queued by readAllSensors() if there is one
+}
+
+byte SpectroDesktop::serviceButtons() {
+    /* Read the sensor of every port whose button was clicked.
+    Only the ports begin() found a button on are checked, with 1 read of the button
+    status register each.  If the button interrupts are wired to a pin (setButtonInterruptPin)
+    nothing is put on the bus until a button pulls the pin low.
+    Every button is checked before any sensor is read, the button latency is from the
+    status read that saw a click to its measurement starting.
+    
+    Returns the number of clicks handled */
+    byte clicks = 0;
+    if (buttonInterruptPin != NO_INTERRUPT_PIN && digitalRead(buttonInterruptPin) == HIGH) {
+        return clicks;
+    }
+    PortMask clicked = 0;
+    unsigned long clickSeenAt[MAX_PORTS];
+    for (byte i = 0; i < portCount(); i++) {  
+        // check if a sensor and button were found there, and only talk to the button if the port is selected
+        if (sensorTypeArray[i] == NO_SENSOR || !(buttonPorts & PORT_BIT(i)) || !enableMuxPort(i)) {
+            continue;
+        }
+        byte status;
+        if (readButtonStatus(status) && (status & BUTTON_CLICKED)) {
+            clickSeenAt[i] = micros();
+            clicked |= PORT_BIT(i);
+            clearButtonEvents();
+            #if(DEBUG_FLAG==2)
+                txQueue.print("Button clicked on port: "); txQueue.println(i);
+            #endif
+        }
+    }
+    for (byte i = 0; i < portCount(); i++) {
+        if (!(clicked & PORT_BIT(i))) {
+            continue;
+        }
+        lastButtonLatency = micros() - clickSeenAt[i];
+        if (lastButtonLatency > maxButtonLatency) {
+            maxButtonLatency = lastButtonLatency;
+        }
+        readSensor(i);
+        clicks++;
+    }
+    return clicks;
+}
+
+void SpectroDesktop::setButtonInterruptPin(byte pin) {
+    /* Use the interrupt output of the Qwiic buttons, all wired to pin, so pollButtons()
+    only checks the buttons after one was clicked.  The button interrupt is active low
+    and open drain so the pin uses the pull up.  NO_INTERRUPT_PIN goes back to polling */
+    buttonInterruptPin = pin;
+    if (pin == NO_INTERRUPT_PIN) {
+        return;
+    }
+    pinMode(pin, INPUT_PULLUP);
+    for (byte i = 0; i < portCount(); i++) {
+        if ((buttonPorts & PORT_BIT(i)) && enableMuxPort(i)) {
+            portButton().enableClickedInterrupt();
+            clearButtonEvents();
         }
     }
 }
 
+PortMask SpectroDesktop::getButtonPorts() {
+    /* Get the ports a button was found on, bit 0 is port 0 */
+    return buttonPorts;
+}
+
+unsigned long SpectroDesktop::getLastButtonLatency() {
+    /* Microseconds from the button status read that saw the last click to its measurement
+    starting.  The click itself happened up to 1 pollButtons() period before that read,
+    the sketch bounds that part by how often it calls pollButtons() */
+    return lastButtonLatency;
+}
+
+unsigned long SpectroDesktop::getMaxButtonLatency() {
+    return maxButtonLatency;
+}
+
+bool SpectroDesktop::readButtonStatus(byte &status) {
+    /* Read the status register of the button on the selected port.
+    Return false if there is no button */
+    byte reg = BUTTON_STATUS_REGISTER;
+    return (transfer(_i2cPort, BUTTON_ADDR, &reg, 1, &status, 1) == I2C_OK);
+}
+
+bool SpectroDesktop::clearButtonEvents() {
+    /* Clear the clicked and event available bits of the button on the selected port,
+    this also releases the button's interrupt pin */
+    byte data[2] = { BUTTON_STATUS_REGISTER, 0 };
+    return (transfer(_i2cPort, BUTTON_ADDR, data, sizeof(data)) == I2C_OK);
+}
+
 void SpectroDesktop::readSensor(byte portNumber) {
     /* Read the sensor on portNumber, check if there is a sensor on portNumber,
     get what type of sensor there is and then read it*/
-    if (portNumber > 8) {  // Check for a correct port number
-        Serial.println("enableMuxPort: port Number has to be 7 or less");
+    if (!checkPort(portNumber, "readSensor")) {
         return;
     }
 
     if (sensorTypeArray[portNumber] == NO_SENSOR) {
-        Serial.print("No sensor on port: ");Serial.println(portNumber);
+        txQueue.print("No sensor on port: ");txQueue.println(portNumber);
+        return;
+    }
+
+    enableMuxPort(portNumber);
+    bool hasButton = buttonPorts & PORT_BIT(portNumber);
+    if (hasButton == true) {
+        portButton().LEDon(BUTTON_LED_LIGHT_LEVEL);
+    }
+
+    if ((autoExposurePorts & PORT_BIT(portNumber)) && !(exposedPorts & PORT_BIT(portNumber))) {
+        autoExpose(portNumber);
+    }
+    if (oversampleCounts[portNumber] > 1) {
+        oversample(portNumber);
+    }
+    else {
+        readAllSensors(PORT_BIT(portNumber));
+    }
+
+    if (hasButton == true) {
+        enableMuxPort(portNumber);
+        portButton().LEDoff();
+    }
+    drainRecords(SPECTRAL_RECORD_QUEUE_SIZE);
+}
+
+PortMask SpectroDesktop::readAllSensors(PortMask portMask) {
+    /* Start a measurement on every port in portMask that has a sensor so they all
+    integrate at the same time, then collect the data from each sensor as it finishes.
+    A full sweep takes about 1 integration period instead of 1 per port.
+    The readings are put in the record queue, call drainRecords() to send them.
+    
+    Returns the ports that reported data */
+    reportedPorts = 0;
+    startAcquisition(portMask);
+    while (serviceAcquisition() & portMask) {
+        // keep going around the ports until every measurement is collected or timed out,
+        // other ports (e.g. scheduled samples) are collected on the way but not waited for
+    }
+    return reportedPorts;
+}
+
+PortMask SpectroDesktop::startAcquisition(PortMask portMask) {
+    /* Start a one shot measurement on every port in portMask with a sensor and
+    return without waiting for them.  Call serviceAcquisition() to collect the data.
+    
+    Returns the ports a measurement was started on */
+    PortMask started = 0;
+    for (byte i = 0; i < portCount(); i++) {
+        PortMask portBit = PORT_BIT(i);
+        if (!(portMask & portBit) || (pendingPorts & portBit) || sensorTypeArray[i] == NO_SENSOR) {
+            continue;
+        }
+        if ((autoExposurePorts & portBit) && !(exposedPorts & portBit)) {
+            autoExpose(i);
+        }
+        if (startMeasurement(i)) {
+            pendingPorts |= portBit;
+            started |= portBit;
+        }
+        else if (outputMode == TEXT_OUTPUT) {
+            txQueue.print("Could not start measurement on port: "); txQueue.println(i);
+        }
+    }
+    return started;
+}
+
+PortMask SpectroDesktop::serviceAcquisition() {
+    /* Go once around the ports with a measurement running, any port whose
+    data is ready is read out.  Ports are only
+    checked after their integration time is up, to keep the bus quiet while waiting.
+    Finished readings go in the record queue, queued serial output is moved on.
+    
+    Returns the ports that still have a measurement running */
+    unsigned long now = millis();
+    for (byte i = 0; i < portCount(); i++) {
+        if (!(pendingPorts & PORT_BIT(i)) || (long)(now - readyAt[i]) < 0) {
+            continue;
+        }
+        servicePort(i, now);
+        txQueue.service();
+    }
+    txQueue.service();  // the serial port sends queued output while the sensors integrate
+    return pendingPorts;
+}
+
+bool SpectroDesktop::servicePort(byte portNumber, unsigned long now) {
+    /* Read out the measurement running on a port if its data is ready, or give up on it
+    if it is past its timeout.  Return true if the port is done (read out or timed out) */
+    PortMask portBit = PORT_BIT(portNumber);
+    unsigned long readStart = micros();
+    byte control = 0;
+    if (enableMuxPort(portNumber) && readVirtualRegister(CONTROL_SETUP_REGISTER, control) &&
+        (control & DATA_READY_BIT)) {
+        PROFILE_TIME(portNumber, PROFILE_INTEGRATION_WAIT, oneShotStartUs[portNumber]);
+        pendingPorts &= ~portBit;
+        finishMeasurement(portNumber);
+        reportedPorts |= portBit;
+        // keep a running average of the bus time a readout takes, for the scheduler
+        unsigned long elapsed = micros() - readStart;
+        readoutUs[portNumber] = (readoutUs[portNumber] == 0) ? elapsed :
+                                readoutUs[portNumber] - readoutUs[portNumber] / 4 + elapsed / 4;
+        finishSample(portNumber, millis(), true);
+        return true;
+    }
+    if ((long)(now - deadlineAt[portNumber]) >= 0) {
+        pendingPorts &= ~portBit;
+        setBulbs(portNumber, false);
+        if (portNumber == capturePort) {
+            endCapture();
+        }
+        if (outputMode == TEXT_OUTPUT) {
+            txQueue.print("Measurement timed out on port: "); txQueue.println(portNumber);
+        }
+        finishSample(portNumber, now, false);
+        return true;
+    }
+    return false;
+}
+
+bool SpectroDesktop::setSamplePeriod(byte portNumber, unsigned long periodMs, byte priority) {
+    /* Have the scheduler read a port every periodMs, 0 takes the port off the schedule.
+    Each sample is due by the time the next one is released, priority (higher first)
+    decides between ports whose samples are equally urgent */
+    if (portNumber >= portCount()) {
+        return false;
+    }
+    samplePeriods[portNumber] = periodMs;
+    samplePriorities[portNumber] = priority;
+    nextRelease[portNumber] = millis();
+    return true;
+}
+
+void SpectroDesktop::startScheduler() {
+    /* Release the first sample of every scheduled port now, then call serviceScheduler()
+    every loop() */
+    unsigned long now = millis();
+    for (byte i = 0; i < portCount(); i++) {
+        nextRelease[i] = now;
+    }
+    schedulerRunning = true;
+}
+
+void SpectroDesktop::stopScheduler() {
+    /* Stop releasing samples, the ones running are still collected by serviceScheduler() */
+    schedulerRunning = false;
+}
+
+void SpectroDesktop::serviceScheduler() {
+    /* Run the scheduled sampling, call this every loop() instead of pollButtons().
+    Released samples are started and finished integrations are read out 1 job at a time,
+    the most urgent first, so sensors integrate at the same time while the bus serves the
+    other ports.  Button clicks are handled before the scheduled jobs, and between them
+    when the button interrupt pin is used (checking it does not use the bus) */
+    serviceButtons();
+    PortMask tried = 0;  // each port gets 1 job per call, so a readout that is not ready is not polled again
+    for (byte jobs = 0; jobs < SCHEDULER_MAX_JOBS; jobs++) {
+        if (jobs > 0 && buttonInterruptPin != NO_INTERRUPT_PIN) {
+            serviceButtons();
+        }
+        unsigned long now = millis();
+        byte port;
+        bool readout;
+        if (!nextJob(now, tried, port, readout)) {
+            break;
+        }
+        tried |= PORT_BIT(port);
+        if (port != selectedPort) {
+            // keep a running average of what a mux switch costs, for ordering the jobs
+            unsigned long switchStart = micros();
+            if (enableMuxPort(port)) {
+                unsigned long elapsed = micros() - switchStart;
+                muxSwitchUs = (muxSwitchUs == 0) ? elapsed : muxSwitchUs - muxSwitchUs / 4 + elapsed / 4;
+            }
+        }
+        if (readout) {
+            servicePort(port, now);
+        }
+        else {
+            releaseSample(port, now);
+        }
+    }
+    if (hotPlug) {
+        rescanStep();
+    }
+    retestClockStep();
+    drainRecords();
+}
+
+bool SpectroDesktop::nextJob(unsigned long now, PortMask skip, byte &portNumber, bool &readout) {
+    /* Pick the most urgent job: reading out a port whose integration time is up, or
+    starting a released sample.  Jobs are ordered by their latest start time, the deadline
+    less the integration, readout and mux switch time they still need (earliest deadline
+    first), and jobs within SCHEDULER_TIE_US of each other by priority.
+    Return false if there is no job to do now */
+    bool found = false;
+    long bestKey = 0;
+    byte bestPriority = 0;
+    for (byte i = 0; i < portCount(); i++) {
+        PortMask portBit = PORT_BIT(i);
+        if (skip & portBit) {
+            continue;
+        }
+        bool isReadout;
+        unsigned long deadline;
+        unsigned long workUs;
+        if (pendingPorts & portBit) {
+            if ((long)(now - readyAt[i]) < 0) {
+                continue;  // still integrating
+            }
+            isReadout = true;
+            deadline = (scheduledPorts & portBit) ? sampleDeadline[i] : deadlineAt[i];
+            workUs = readoutUs[i];
+        }
+        else if (schedulerRunning && samplePeriods[i] != 0 && sensorTypeArray[i] != NO_SENSOR &&
+                 (long)(now - nextRelease[i]) >= 0) {
+            isReadout = false;
+            deadline = nextRelease[i] + samplePeriods[i];
+            workUs = measurementTime(i) * 1000 + readoutUs[i];
+        }
+        else {
+            continue;
+        }
+        if (i != selectedPort) {
+            workUs += muxSwitchUs;
+        }
+        // limit the time to the deadline so it fits in microseconds
+        long msLeft = constrain((long)(deadline - now), -2000000L, 2000000L);
+        long key = msLeft * 1000 - (long)workUs;
+        if (!found || key < bestKey - SCHEDULER_TIE_US ||
+            (key < bestKey + SCHEDULER_TIE_US && samplePriorities[i] > bestPriority)) {
+            found = true;
+            bestKey = key;
+            bestPriority = samplePriorities[i];
+            portNumber = i;
+            readout = isReadout;
+        }
+    }
+    return found;
+}
+
+void SpectroDesktop::releaseSample(byte portNumber, unsigned long now) {
+    /* Start the released sample of a scheduled port and move its next release on 1 period.
+    Releases that passed while the port was still busy are skipped, and counted as misses */
+    ScheduleStats &stats = scheduleStats[portNumber];
+    unsigned long period = samplePeriods[portNumber];
+    unsigned long late = now - nextRelease[portNumber];
+    if (late >= period) {
+        unsigned long skipped = late / period;
+        stats.deadlineMisses += skipped;
+        nextRelease[portNumber] += skipped * period;
+        late -= skipped * period;
+    }
+    sampleDeadline[portNumber] = nextRelease[portNumber] + period;
+    nextRelease[portNumber] += period;
+    if (startAcquisition(PORT_BIT(portNumber)) == 0) {
+        stats.deadlineMisses++;
+        return;
+    }
+    scheduledPorts |= PORT_BIT(portNumber);
+    stats.totalJitterMs += late;
+    if (late > stats.maxJitterMs) {
+        stats.maxJitterMs = late;
+    }
+}
+
+void SpectroDesktop::finishSample(byte portNumber, unsigned long now, bool readOut) {
+    /* Update the statistics of a port whose measurement is done, if it was a scheduled sample */
+    PortMask portBit = PORT_BIT(portNumber);
+    if (!(scheduledPorts & portBit)) {
+        return;
+    }
+    scheduledPorts &= ~portBit;
+    ScheduleStats &stats = scheduleStats[portNumber];
+    if (!readOut) {
+        stats.deadlineMisses++;
         return;
     }
+    stats.samples++;
+    long lateness = (long)(now - sampleDeadline[portNumber]);
+    if (lateness > 0) {
+        stats.deadlineMisses++;
+        if ((unsigned long)lateness > stats.maxLatenessMs) {
+            stats.maxLatenessMs = lateness;
+        }
+    }
+}
+
+ScheduleStats SpectroDesktop::getScheduleStats(byte portNumber) {
+    /* Get the deadline and jitter statistics of the scheduled samples of a port */
+    if (portNumber >= portCount()) {
+        ScheduleStats none{ 0, 0, 0, 0, 0 };
+        return none;
+    }
+    return scheduleStats[portNumber];
+}
+
+void SpectroDesktop::resetScheduleStats() {
+    memset(scheduleStats, 0, sizeof(scheduleStats));
+}
+
+bool SpectroDesktop::startMeasurement(byte portNumber) {
+    /* Turn on the bulbs for a port and start a one shot measurement of all channels
+    without waiting for it.  Return false if the sensor did not take the command */
+    if (!enableMuxPort(portNumber)) {
+        return false;
+    }
+    setBulbs(portNumber, true);
+    if (!startOneShot(portNumber)) {
+        setBulbs(portNumber, false);
+        return false;
+    }
+    return true;
+}
+
+bool SpectroDesktop::startOneShot(byte portNumber) {
+    /* Start a one shot measurement on the selected port, the bulbs are left as they are.
+    Any settings changed since the last measurement are written first */
+    if (!applyConfig(portNumber, CONFIG_INT_TIME | CONFIG_LED_CURRENT)) {
+        return false;
+    }
+    // clear the data ready bit and set the gain and one shot mode in the same write
+    if (!updateVirtualRegister(CONTROL_SETUP_REGISTER, DATA_READY_BIT | GAIN_MASK | MEASUREMENT_MODE_MASK,
+                               (gains[portNumber] << GAIN_SHIFT) | MEASUREMENT_MODE_ONE_SHOT)) {
+        return false;
+    }
+    configDirty[portNumber] &= ~(CONFIG_GAIN | CONFIG_MODE);
+    unsigned long now = millis();
+    #if(PROFILE_FLAG)
+        oneShotStartUs[portNumber] = micros();
+    #endif
+    readyAt[portNumber] = now + measurementTime(portNumber);
+    deadlineAt[portNumber] = readyAt[portNumber] + MEASUREMENT_TIMEOUT_MARGIN_MS;
+    return true;
+}
+
+void SpectroDesktop::finishMeasurement(byte portNumber) {
+    /* Turn off the bulbs of a port whose data is ready and put the data in the
+    record queue (the mux must be connected correctly before calling this) */
+    if (portNumber == capturePort) {
+        finishCaptureFrame(portNumber);
+        return;
+    }
+    setBulbs(portNumber, false);
+    if (!(autoExposurePorts & PORT_BIT(portNumber))) {
+        queueReading(portNumber);
+        return;
+    }
+    // use this reading to correct the exposure of the next one, without extra measurements,
+    // its raw counts are read with it and the new setting is written when the next measurement starts
+    uint16_t counts[AS7265X_CHANNELS];
+    if (queueReading(portNumber, counts)) {
+        byte channels = driverFor(sensorTypeArray[portNumber])->channels;
+        adjustExposure(portNumber, peakCount(counts, channels));
+    }
+}
+
+bool SpectroDesktop::startCapture(byte portNumber, bool subtractDark) {
+    /* Start a capture sequence on a port without waiting for it: a dark frame with the bulbs
+    off, then 1 frame with each bulb enabled on the port (see setEnableBulb()) on by itself.
+    A bulb is only on while its frame integrates.  When a frame is ready its bulb is turned
+    off, the frame is read out and the next bulb turned on for the next frame.  With
+    subtractDark the dark frame is taken off the lit frames.  All the frames are queued with
+    the same sequence number, call serviceAcquisition() to run the capture.
+    Return false if a capture is already running, or the port has no sensor or a measurement running */
+    const SensorDriver *driver = driverFor(getPortSensorType(portNumber));
+    if (driver == nullptr || capturePort != NO_PORT || (pendingPorts & PORT_BIT(portNumber)) ||
+        !enableMuxPort(portNumber)) {
+        return false;
+    }
+    capturePort = portNumber;
+    captureRemaining = enableBulbsArray[portNumber] & driver->bulbs;
+    captureSubtractDark = subtractDark;
+    captureComplete = false;
+    captureSequenceNumber = frameSequence++;
+    if (!startCaptureFrame(portNumber, 0)) {
+        endCapture();
+        return false;
+    }
+    return true;
+}
+
+bool SpectroDesktop::captureSequence(byte portNumber, bool subtractDark) {
+    /* Run a capture sequence on a port (see startCapture()) and wait for it, each frame is
+    sent while the next one integrates.  Return false if the capture did not finish */
+    if (!startCapture(portNumber, subtractDark)) {
+        return false;
+    }
+    while (capturePort == portNumber) {
+        serviceAcquisition();
+        drainRecords();
+    }
+    drainRecords(SPECTRAL_RECORD_QUEUE_SIZE);
+    return captureComplete;
+}
+
+bool SpectroDesktop::startCaptureFrame(byte portNumber, byte bulbs) {
+    /* Turn on the bulbs of the next frame of the capture and start its measurement
+    (the mux must be connected correctly before calling this) */
+    captureBulbs = bulbs;
+    captureRemaining &= ~bulbs;
+    if (!switchBulbs(portNumber, bulbs, true) || !startOneShot(portNumber)) {
+        switchBulbs(portNumber, bulbs, false);
+        return false;
+    }
+    pendingPorts |= PORT_BIT(portNumber);
+    return true;
+}
+
+void SpectroDesktop::finishCaptureFrame(byte portNumber) {
+    /* Turn off the bulbs of the capture frame that is ready, read it out and start the next
+    frame.  The next one shot is only started once this frame is read, starting it first
+    would leave the frame in the data registers only until the next one is done */
+    byte bulbs = captureBulbs;
+    byte next = captureRemaining & -captureRemaining;  // the lowest bulb left
+    bool ok = switchBulbs(portNumber, bulbs, false) && queueCaptureFrame(portNumber, bulbs);
+    if (ok && next != 0) {
+        ok = startCaptureFrame(portNumber, next);
+    }
+    if (!ok) {
+        pendingPorts &= ~PORT_BIT(portNumber);
+        switchBulbs(portNumber, captureBulbs, false);
+        if (outputMode == TEXT_OUTPUT) {
+            txQueue.print("Capture failed on port: "); txQueue.println(portNumber);
+        }
+        endCapture();
+    }
+    else if (next == 0) {
+        captureComplete = true;
+        endCapture();
+    }
+}
+
+bool SpectroDesktop::queueCaptureFrame(byte portNumber, byte bulbs) {
+    /* Read out a capture frame and queue it, the dark frame is also kept to take off the lit
+    frames.  Return false if the data could not be read, a frame dropped because the record
+    queue is full does not stop the capture but uses up a sequence number, as a dropped
+    reading does, so the host can see a frame is missing */
+    SensorType type = sensorTypeArray[portNumber];
+    byte channels = driverFor(type)->channels;
+    float values[AS7265X_CHANNELS];
+    if (!readCalibratedBlock(type, values)) {
+        return false;
+    }
+    byte kind = RECORD_LIT;
+    if (bulbs == 0) {
+        kind = RECORD_DARK;
+        memcpy(captureDark, values, channels * sizeof(float));
+    }
+    else if (captureSubtractDark) {
+        kind = RECORD_DARK_SUBTRACTED;
+        for (byte i = 0; i < channels; i++) {
+            values[i] -= captureDark[i];
+        }
+    }
+    SpectralRecord *record = records.beginWrite();
+    while (record == nullptr && records.policy == BLOCK_WHEN_FULL) {
+        drainRecords(1);
+        record = records.beginWrite();
+    }
+    if (record == nullptr) {
+        frameSequence++;
+        return true;
+    }
+    fillRecord(*record, portNumber);
+    record->kind = kind;
+    record->bulbMask = bulbs;
+    memcpy(record->channels, values, channels * sizeof(float));
+    record->timestamp = millis();
+    record->sequence = captureSequenceNumber;
+    records.commitWrite();
+    return true;
+}
+
+void SpectroDesktop::endCapture() {
+    capturePort = NO_PORT;
+    captureBulbs = 0;
+    captureRemaining = 0;
+}
+
+bool SpectroDesktop::queueReading(byte portNumber, uint16_t *counts) {
+    /* Read the calibrated data of the selected port into the next record of the queue,
+    and its raw counts into counts if that is not nullptr.
+    If the queue is full the overflow policy decides if the oldest or this reading is
+    dropped, or if queued readings are sent to make room.
+    Return false if the reading was dropped or could not be read */
+    SpectralRecord *record = records.beginWrite();
+    while (record == nullptr && records.policy == BLOCK_WHEN_FULL) {
+        drainRecords(1);
+        record = records.beginWrite();
+    }
+    if (record == nullptr) {
+        frameSequence++;  // so the host can see a reading is missing
+        return false;
+    }
+    fillRecord(*record, portNumber);
+    if (!readCalibratedBlock(sensorTypeArray[portNumber], record->channels, counts)) {
+        if (outputMode == TEXT_OUTPUT) {
+            txQueue.print("Data read failed on port: "); txQueue.println(portNumber);
+        }
+        return false;  // the slot is not committed and gets used by the next reading
+    }
+    record->timestamp = millis();
+    record->sequence = frameSequence++;
+    records.commitWrite();
+    return true;
+}
+
+void SpectroDesktop::fillRecord(SpectralRecord &record, byte portNumber) {
+    /* Fill in everything about a port's reading except the channels, timestamp and sequence */
+    SensorType type = sensorTypeArray[portNumber];
+    record.port = portNumber;
+    record.sensorType = type;
+    record.integrationTime = integrationTimes[portNumber];
+    record.ledCurrent = ledCurrents[portNumber];
+    record.bulbMask = enableBulbsArray[portNumber];
+    record.channelCount = driverFor(type)->channels;
+    record.kind = RECORD_READING;
+    record.sampleCount = 1;
+    record.rejectedCount = 0;
+}
+
+byte SpectroDesktop::drainRecords(byte maxRecords) {
+    /* Send up to maxRecords of the queued readings over the serial port, oldest first.
+    Call this when there is time to send data, e.g. once every loop().
+    
+    Returns the number of readings sent */
+    byte sent = 0;
+    while (sent < maxRecords && records.peek() != nullptr) {
+        emitRecord(*records.peek());
+        records.pop();
+        sent += 1;
+    }
+    #if(PROFILE_FLAG)
+        serviceProfile();
+    #endif
+    txQueue.service();
+    return sent;
+}
+
+byte SpectroDesktop::recordsWaiting() {
+    return records.size();
+}
+
+unsigned long SpectroDesktop::droppedRecords() {
+    /* Number of readings lost because the record queue was full */
+    return records.droppedRecords;
+}
+
+void SpectroDesktop::serviceOutput() {
+    /* Move queued output on to the serial port without waiting for it.  The library does
+    this in its own service functions, call it from a sketch that spends long in other code */
+    txQueue.service();
+}
+
+void SpectroDesktop::flushOutput() {
+    /* Hand all the queued output to the serial port, call before the sketch prints
+    so its lines come after the library's */
+    txQueue.flush();
+}
+
+TxQueueStats SpectroDesktop::getTxStats() {
+    /* Get the serial output queue statistics since begin() or the last resetTxStats(),
+    a high water mark near SPECTRO_TX_QUEUE_SIZE or any stall time means the queue is too
+    small for the output rate (or the baud rate too low) */
+    return txQueue.stats;
+}
+
+void SpectroDesktop::resetTxStats() {
+    txQueue.resetStats();
+}
+
+void SpectroDesktop::setOverflowPolicy(OverflowPolicy policy) {
+    /* Set what happens to a new reading when the record queue is full */
+    records.policy = policy;
+}
+
+void SpectroDesktop::emitRecord(const SpectralRecord &record) {
+    /* Send 1 reading in the selected output mode */
+    PROFILE_START(emitStart);
+    if (outputMode != TEXT_OUTPUT) {
+        sendRecordFrame(record);
+    }
+    else {
+        printRecord(record);
+    }
+    PROFILE_TIME(record.port, PROFILE_SERIAL_EMIT, emitStart);
+}
+
+void SpectroDesktop::printRecord(const SpectralRecord &record) {
+    /* Print a reading as text, the AS7262 / AS7263 channels with 4 decimal places */
+    const SensorDriver *driver = driverFor((SensorType)record.sensorType);
+    if (driver == nullptr) {
+        return;
+    }
+    byte decimals = driver->decimals;
+    // the 4 records of an oversampled reading are printed as 1 block, mean first and max last,
+    // each frame of a capture as a block of its own
+    bool capture = (record.kind >= RECORD_DARK);
+    if (record.kind == RECORD_READING || record.kind == RECORD_MEAN || capture) {
+        txQueue.println("Starting Data Read");
+        txQueue.print("Reading port: "); txQueue.println(record.port);
+        txQueue.print("Integration time: "); txQueue.println(record.integrationTime);
+        txQueue.print("LED current: "); txQueue.println(record.ledCurrent);
+        txQueue.print("running "); txQueue.print(driver->name); txQueue.println(" Sensor");
+    }
+    if (record.kind == RECORD_MEAN) {
+        txQueue.print("Samples: "); txQueue.print(record.sampleCount);
+        txQueue.print(" | outliers rejected: "); txQueue.println(record.rejectedCount);
+    }
+    if (capture) {
+        txQueue.print("Capture bulbs: 0x"); txQueue.println(record.bulbMask, HEX);
+    }
+    const char *labels[8] = { "Data", "Mean", "Variance", "Min", "Max", "Dark", "Lit", "Lit - dark" };  // by SpectroRecordKind
+    txQueue.print(driver->name); txQueue.print(" "); txQueue.print(labels[record.kind]); txQueue.print(": ");
+    for (byte i = 0; i < record.channelCount - 1; i++) {
+        txQueue.print(record.channels[i], decimals); txQueue.print(", ");
+    }
+    txQueue.println(record.channels[record.channelCount - 1], decimals);
+    if (record.kind == RECORD_READING || record.kind == RECORD_MAX || capture) {
+        txQueue.println("End Data Read");
+    }
+}
+
+void SpectroDesktop::sendRecordFrame(const SpectralRecord &record) {
+    /* Send a reading as 1 binary frame */
+    SpectroFrame frame;
+    frame.port = record.port;
+    frame.sensorType = record.sensorType;
+    frame.timestamp = record.timestamp;
+    frame.sequence = record.sequence;
+    frame.channelCount = record.channelCount;
+    memcpy(frame.channels, record.channels, record.channelCount * sizeof(float));
+    frame.kind = record.kind;
+    frame.sampleCount = record.sampleCount;
+    frame.rejectedCount = record.rejectedCount;
+    frame.bulbMask = record.bulbMask;
+    // the largest frame is a keyframe with every channel taking the longest varint
+    byte buffer[SPECTRO_FRAME_OVERHEAD + SPECTRO_KEY_HEADER_SIZE +
+                SPECTRO_MAX_VARINT_SIZE * SPECTRO_FRAME_MAX_CHANNELS];
+    size_t length = 0;
+    #if(DELTA_FLAG)
+        if (outputMode == DELTA_OUTPUT && record.kind == RECORD_READING) {
+            length = encodeDeltaFrame(frame, deltaStates[record.port], keyframeInterval, deltaDecimals,
+                                      buffer, sizeof(buffer));
+        }
+    #endif
+    if (length == 0) {  // the statistics of an oversampled reading and capture frames are always sent whole
+        length = encodeDataFrame(frame, buffer, sizeof(buffer));
+    }
+    txQueue.write(buffer, length);
+}
+
+void SpectroDesktop::setOutputMode(OutputMode mode) {
+    /* Pick text lines (for debugging), binary frames or delta compressed frames for the readings.
+    Without DELTA_FLAG DELTA_OUTPUT is sent as binary frames */
+    #if(DELTA_FLAG)
+        if (mode == DELTA_OUTPUT && outputMode != DELTA_OUTPUT) {
+            resetDeltaStates();  // start every port with a keyframe
+        }
+    #else
+        if (mode == DELTA_OUTPUT) {
+            mode = BINARY_OUTPUT;
+        }
+    #endif
+    outputMode = mode;
+}
+
+void SpectroDesktop::setDeltaEncoding(byte interval, byte decimals) {
+    /* Set how often DELTA_OUTPUT sends a whole reading of a port (1 for every reading) and how many
+    decimal places the channels are kept to, the host gets the channels exactly to these decimals */
+    keyframeInterval = interval;
+    deltaDecimals = min(decimals, SPECTRO_MAX_DECIMALS);
+    resetDeltaStates();
+}
+
+void SpectroDesktop::resetDeltaStates() {
+    #if(DELTA_FLAG)
+        for (byte i = 0; i < MAX_PORTS; i++) {
+            resetDeltaState(deltaStates[i]);
+        }
+    #endif
+}
+
+void SpectroDesktop::serviceCommands(Stream &stream) {
+    /* Run the commands the host sent (see spectro_command.h), call this every loop().
+    Only the characters already received are read, at most COMMAND_BYTES_PER_CALL,
+    so a command split over several calls never makes this wait.
+    Readings started by a command are collected here when the scheduler is not running */
+    for (byte i = 0; i < COMMAND_BYTES_PER_CALL && stream.available() > 0; i++) {
+        SpectroCommand command;
+        SpectroCommandStatus status;
+        if (feedCommandParser(commandParser, stream.read(), command, status)) {
+            if (status == COMMAND_OK) {
+                status = runCommand(command);
+            }
+            sendAck(command.sequence, status);
+        }
+    }
+    if (!schedulerRunning && pendingPorts != 0) {
+        serviceAcquisition();
+    }
+    txQueue.service();
+}
+
+SpectroCommandStatus SpectroDesktop::runCommand(const SpectroCommand &command) {
+    /* Run 1 command, a port of SPECTRO_COMMAND_ALL_PORTS is every port with a sensor */
+    PortMask ports = 0;
+    if (command.port == SPECTRO_COMMAND_ALL_PORTS) {
+        for (byte i = 0; i < portCount(); i++) {
+            if (sensorTypeArray[i] != NO_SENSOR) {
+                ports |= PORT_BIT(i);
+            }
+        }
+    }
+    else {
+        if (command.port >= portCount()) {
+            return COMMAND_BAD_PORT;
+        }
+        ports = PORT_BIT(command.port);
+    }
+    uint32_t value = command.args[0];
+    switch (command.opcode) {
+        case COMMAND_INT:
+            if (value < 1 || value > 255) {
+                return COMMAND_BAD_ARGUMENTS;
+            }
+            break;
+        case COMMAND_LED:
+            if (value > MAX_LED_CURRENT) {
+                return COMMAND_BAD_ARGUMENTS;
+            }
+            break;
+        case COMMAND_GAIN:
+            if (value > MAX_GAIN) {
+                return COMMAND_BAD_ARGUMENTS;
+            }
+            break;
+        case COMMAND_BULB:
+            if (value > DEFAULT_BULB_ENABLE) {
+                return COMMAND_BAD_ARGUMENTS;
+            }
+            break;
+        case COMMAND_PERIOD:
+            if (command.argCount > 1 && command.args[1] > 255) {
+                return COMMAND_BAD_ARGUMENTS;
+            }
+            break;
+        case COMMAND_READ:
+        case COMMAND_SWEEP:
+            // ports already being read are left to finish
+            return (startAcquisition(ports) != 0) ? COMMAND_OK : COMMAND_FAILED;
+        case COMMAND_CAPTURE:
+            if (command.port == SPECTRO_COMMAND_ALL_PORTS) {
+                return COMMAND_BAD_PORT;  // 1 capture runs at a time
+            }
+            return startCapture(command.port, command.argCount == 0 || value != 0) ? COMMAND_OK : COMMAND_FAILED;
+        case COMMAND_START:
+            startScheduler();
+            return COMMAND_OK;
+        case COMMAND_STOP:
+            stopScheduler();
+            return COMMAND_OK;
+        case COMMAND_STATS:
+            printStats();
+            return COMMAND_OK;
+        default:
+            return COMMAND_UNKNOWN;
+    }
+    // the settings, which are kept in the shadow until each port's next measurement
+    for (byte i = 0; i < portCount(); i++) {
+        if (!(ports & PORT_BIT(i))) {
+            continue;
+        }
+        switch (command.opcode) {
+            case COMMAND_INT: setIntTime(i, value); break;
+            case COMMAND_LED: setBulbCurrent(i, value); break;
+            case COMMAND_GAIN: setGain(i, value); break;
+            case COMMAND_BULB: setEnableBulb(i, value); break;
+            default: setSamplePeriod(i, value, (command.argCount > 1) ? command.args[1] : 0); break;
+        }
+    }
+    return COMMAND_OK;
+}
+
+void SpectroDesktop::sendAck(uint16_t sequence, SpectroCommandStatus status) {
+    /* Answer a command with its sequence number, as text or an ack frame */
+    if (outputMode != TEXT_OUTPUT) {
+        byte buffer[SPECTRO_FRAME_OVERHEAD + SPECTRO_ACK_PAYLOAD_SIZE];
+        size_t length = encodeAckFrame(sequence, status, buffer, sizeof(buffer));
+        txQueue.write(buffer, length);
+        return;
+    }
+    txQueue.print((status == COMMAND_OK) ? "ACK " : "NAK ");
+    txQueue.print(sequence);
+    if (status != COMMAND_OK) {
+        txQueue.print(" "); txQueue.print(commandStatusName(status));
+    }
+    txQueue.println();
+}
+
+void SpectroDesktop::printStats() {
+    /* Send the bus and schedule statistics as text, and the profiles if they are kept.
+    With binary output only the profile frames are sent */
+    if (outputMode == TEXT_OUTPUT) {
+        txQueue.print("Bus transactions: "); txQueue.print(busStats.transactions);
+        txQueue.print(", written: "); txQueue.print(busStats.bytesWritten);
+        txQueue.print(", read: "); txQueue.print(busStats.bytesRead);
+        txQueue.print(", errors: "); txQueue.print(busStats.errors);
+        txQueue.print(", retries: "); txQueue.print(busStats.retries);
+        txQueue.print(", bus clears: "); txQueue.println(busStats.busClears);
+        txQueue.print("Records dropped: "); txQueue.println(droppedRecords());
+        txQueue.print("Serial queue high water: "); txQueue.print(txQueue.stats.highWater);
+        txQueue.print(" of "); txQueue.print(SPECTRO_TX_QUEUE_SIZE);
+        txQueue.print(", stalls: "); txQueue.print(txQueue.stats.stalls);
+        txQueue.print(", stall time (us): "); txQueue.println(txQueue.stats.stallUs);
+        for (byte i = 0; i < portCount(); i++) {
+            if (samplePeriods[i] == 0) {
+                continue;
+            }
+            const ScheduleStats &stats = scheduleStats[i];
+            txQueue.print("Port "); txQueue.print(i);
+            txQueue.print(" samples: "); txQueue.print(stats.samples);
+            txQueue.print(", deadline misses: "); txQueue.print(stats.deadlineMisses);
+            txQueue.print(", mean jitter: "); txQueue.print(stats.samples ? stats.totalJitterMs / stats.samples : 0);
+            txQueue.print(" ms, max jitter: "); txQueue.print(stats.maxJitterMs);
+            txQueue.print(" ms, max lateness: "); txQueue.print(stats.maxLatenessMs);
+            txQueue.println(" ms");
+        }
+        for (byte i = 0; i < portCount(); i++) {
+            const PortErrorStats &errors = portErrors[i];
+            if (errors.errors == 0) {
+                continue;
+            }
+            txQueue.print("Port "); txQueue.print(i);
+            txQueue.print(" I2C errors: "); txQueue.print(errors.errors);
+            txQueue.print(" of "); txQueue.print(errors.transactions);
+            txQueue.print(", retries: "); txQueue.print(errors.retries);
+            txQueue.print(", bus clears: "); txQueue.print(errors.busClears);
+            txQueue.print(", clock step downs: "); txQueue.print(errors.clockStepDowns);
+            txQueue.print(", last error: "); txQueue.println(errors.lastError);
+        }
+        txQueue.print("I2C clocks (kHz):");
+        for (byte i = 0; i < portCount(); i++) {
+            if (sensorTypeArray[i] != NO_SENSOR) {
+                txQueue.print(" "); txQueue.print(i); txQueue.print(":"); txQueue.print(getPortClockHz(i) / 1000);
+            }
+        }
+        txQueue.println();
+    }
+    #if(PROFILE_FLAG)
+        dumpProfile();
+    #endif
+}
+
+void SpectroDesktop::setAutoExposure(byte portNumber, bool enable) {
+    /* Turn auto exposure on or off for a port.  The first reading after turning it on
+    runs autoExpose(), after that each reading corrects the setting for the next one */
+    if (portNumber >= portCount()) {
+        return;
+    }
+    if (enable) {
+        autoExposurePorts |= PORT_BIT(portNumber);
+    }
+    else {
+        autoExposurePorts &= ~PORT_BIT(portNumber);
+    }
+    exposedPorts &= ~PORT_BIT(portNumber);
+}
+
+bool SpectroDesktop::autoExpose(byte portNumber) {
+    /* Take trial measurements to find the shortest integration time, with the highest
+    LED current that allows it when the bulbs are on, that puts the brightest raw channel
+    between AUTO_EXPOSURE_LOW and MAX_CHANNEL_VALUE.  Stops after AUTO_EXPOSURE_MAX_TRIALS.
+    The setting is kept in integrationTimes[] and ledCurrents[].
+    
+    Return true if a setting inside the window was found */
+    if (portNumber >= portCount() || sensorTypeArray[portNumber] == NO_SENSOR) {
+        return false;
+    }
+    byte channels = driverFor(sensorTypeArray[portNumber])->channels;
+    for (byte trial = 0; trial < AUTO_EXPOSURE_MAX_TRIALS; trial++) {
+        uint16_t counts[AS7265X_CHANNELS];
+        if (!measureRaw(portNumber, counts)) {
+            return false;
+        }
+        uint16_t peak = peakCount(counts, channels);
+        #if(DEBUG_FLAG)
+            txQueue.print("Auto exposure peak: "); txQueue.print(peak);
+            txQueue.print(" integration: "); txQueue.println(integrationTimes[portNumber]);
+        #endif
+        if (adjustExposure(portNumber, peak)) {
+            return true;
+        }
+    }
+    return false;  // the last correction is written with the next measurement
+}
+
+bool SpectroDesktop::adjustExposure(byte portNumber, uint16_t peak) {
+    /* Work out the next integration time and LED current of a port from the brightest
+    raw channel of a measurement.  Return true if peak was inside the target window */
+    PortMask portBit = PORT_BIT(portNumber);
+    if (peak >= AUTO_EXPOSURE_LOW && peak < MAX_CHANNEL_VALUE) {
+        exposedPorts |= portBit;
+        return true;
+    }
+    exposedPorts &= ~portBit;
+    // with the bulbs on each LED current step doubles the light, so the exposure is counted
+    // in integration cycles at the lowest current.  Enable bits for bulbs the part does not
+    // have light nothing
+    bool bulbsOn = (enableBulbsArray[portNumber] & driverFor(sensorTypeArray[portNumber])->bulbs) != 0;
+    byte current = ledCurrents[portNumber];
+    long exposure = bulbsOn ? ((long)integrationTimes[portNumber] << current) : integrationTimes[portNumber];
+    if (peak >= MAX_CHANNEL_VALUE) {  // saturated, how bright it really is is unknown so halve it
+        exposure /= 2;
+    }
+    else {  // counts scale with the exposure so aim straight at the target
+        exposure = (peak == 0) ? (255L << MAX_LED_CURRENT) : (exposure * AUTO_EXPOSURE_TARGET) / peak;
+    }
+    if (bulbsOn) {
+        // pick the current first, the highest that leaves at least AUTO_EXPOSURE_MIN_TIME to
+        // integrate, so a saturated port at the shortest time steps the current back down
+        current = MAX_LED_CURRENT;
+        while (current > 0 && (exposure >> current) < AUTO_EXPOSURE_MIN_TIME) {
+            current -= 1;
+        }
+        exposure >>= current;
+    }
+    setConfig(portNumber, ledCurrents, current, CONFIG_LED_CURRENT);
+    setConfig(portNumber, integrationTimes, constrain(exposure, 1L, 255L), CONFIG_INT_TIME);
+    return false;
+}
+
+void SpectroDesktop::setConfig(byte portNumber, byte *settings, byte value, byte dirtyBit) {
+    /* Change 1 shadow setting of a port (settings is its array), it is only marked
+    to be written if it is different */
+    if (settings[portNumber] != value) {
+        settings[portNumber] = value;
+        configDirty[portNumber] |= dirtyBit;
+    }
+}
+
+bool SpectroDesktop::applyConfig(byte portNumber, byte fields) {
+    /* Write the shadow settings in fields that changed since they were last written
+    to the sensor of a port, after reading them back if its bus was reset
+    (the mux must be connected correctly before calling this).
+    Return false if a write failed, what was not written is tried again next time */
+    if ((configSuspect & PORT_BIT(portNumber)) && !verifyConfig(portNumber)) {
+        return false;
+    }
+    const SensorDriver *driver = driverFor(sensorTypeArray[portNumber]);
+    if (driver == nullptr) {
+        return false;
+    }
+    byte dirty = configDirty[portNumber] & fields;
+    if (dirty & CONFIG_INT_TIME) {
+        if (!writeVirtualRegister(INT_TIME_REGISTER, integrationTimes[portNumber])) {
+            return false;
+        }
+        configDirty[portNumber] &= ~CONFIG_INT_TIME;
+    }
+    if (dirty & CONFIG_LED_CURRENT) {
+        byte currentBits = ledCurrents[portNumber] << LED_CURRENT_SHIFT;
+        if (!(this->*driver->updateDevices)(LED_CONTROL_REGISTER, LED_CURRENT_MASK, currentBits)) {
+            return false;
+        }
+        configDirty[portNumber] &= ~CONFIG_LED_CURRENT;
+    }
+    if (dirty & (CONFIG_GAIN | CONFIG_MODE)) {  // both are in the control setup register
+        if (!updateVirtualRegister(CONTROL_SETUP_REGISTER, GAIN_MASK | MEASUREMENT_MODE_MASK,
+                                   (gains[portNumber] << GAIN_SHIFT) | MEASUREMENT_MODE_ONE_SHOT)) {
+            return false;
+        }
+        configDirty[portNumber] &= ~(CONFIG_GAIN | CONFIG_MODE);
+    }
+    return true;
+}
+
+bool SpectroDesktop::verifyConfig(byte portNumber) {
+    /* Read back the settings of a sensor whose bus was reset (it may have been reset too)
+    and mark the ones that do not match the shadow to be written again.  The devices of an
+    AS7265x are reset together so the LED current of the selected one is enough
+    (the mux must be connected correctly before calling this) */
+    byte intTime;
+    byte control;
+    byte ledControl;
+    if (!readVirtualRegister(INT_TIME_REGISTER, intTime) ||
+        !readVirtualRegister(CONTROL_SETUP_REGISTER, control) ||
+        !readVirtualRegister(LED_CONTROL_REGISTER, ledControl)) {
+        return false;
+    }
+    if (intTime != integrationTimes[portNumber]) {
+        configDirty[portNumber] |= CONFIG_INT_TIME;
+    }
+    if (((ledControl & LED_CURRENT_MASK) >> LED_CURRENT_SHIFT) != ledCurrents[portNumber]) {
+        configDirty[portNumber] |= CONFIG_LED_CURRENT;
+    }
+    if (((control & GAIN_MASK) >> GAIN_SHIFT) != gains[portNumber]) {
+        configDirty[portNumber] |= CONFIG_GAIN;
+    }
+    if ((control & MEASUREMENT_MODE_MASK) != MEASUREMENT_MODE_ONE_SHOT) {
+        configDirty[portNumber] |= CONFIG_MODE;
+    }
+    #if(DEBUG_FLAG)
+        txQueue.print("Settings to write again after bus reset: 0x"); txQueue.println(configDirty[portNumber], HEX);
+    #endif
+    configSuspect &= ~PORT_BIT(portNumber);
+    return true;
+}
+
+bool SpectroDesktop::measureRaw(byte portNumber, uint16_t *counts) {
+    /* Take 1 measurement on a port and wait for it, then read the raw counts.
+    Used for trial measurements that are not sent to the serial port */
+    if (!startMeasurement(portNumber)) {
+        return false;
+    }
+    bool ready = waitForData(portNumber);
+    setBulbs(portNumber, false);
+    return ready && readRawBlock(sensorTypeArray[portNumber], counts);
+}
+
+bool SpectroDesktop::waitForData(byte portNumber) {
+    /* Wait for the measurement started on the selected port to finish.
+    The queued output is sent while waiting.
+    Return false if it did not finish before its deadline */
+    unsigned long waitStart = millis();
+    unsigned long integration = measurementTime(portNumber);
+    while (millis() - waitStart < integration) {
+        txQueue.service();
+    }
+    byte control = 0;
+    while (!(control & DATA_READY_BIT)) {
+        txQueue.service();
+        if (!readVirtualRegister(CONTROL_SETUP_REGISTER, control) ||
+            (long)(millis() - deadlineAt[portNumber]) >= 0) {
+            return false;
+        }
+    }
+    PROFILE_TIME(portNumber, PROFILE_INTEGRATION_WAIT, oneShotStartUs[portNumber]);
+    return true;
+}
+
+void SpectroDesktop::setOversampling(byte portNumber, byte samples, float rejectSigma) {
+    /* Have readSensor() take samples measurements back to back on a port and send their
+    mean, variance, min and max instead of every reading.  With rejectSigma above 0 a channel
+    value further than rejectSigma standard deviations from that channel's running mean
+    is left out.  samples of 0 or 1 goes back to single readings */
+    if (portNumber >= portCount()) {
+        return;
+    }
+    oversampleCounts[portNumber] = samples;
+    rejectSigmas[portNumber] = rejectSigma;
+}
+
+bool SpectroDesktop::oversample(byte portNumber) {
+    /* Take the oversampling count of measurements on a port, keeping the mux on the port
+    and the bulbs on the whole time, and keep a running (Welford) mean, variance, min and max
+    of each channel.  The 4 statistics are queued as 4 records with the same sequence number.
+    Return false if a measurement failed, then nothing is queued */
+    SensorType type = sensorTypeArray[portNumber];
+    const SensorDriver *driver = driverFor(type);
+    if (driver == nullptr || !enableMuxPort(portNumber)) {
+        return false;
+    }
+    byte channels = driver->channels;
+    float rejectSigma = rejectSigmas[portNumber];
+    float mean[AS7265X_CHANNELS];
+    float m2[AS7265X_CHANNELS];  // sum of squared differences from the mean
+    float minimum[AS7265X_CHANNELS];
+    float maximum[AS7265X_CHANNELS];
+    byte counts[AS7265X_CHANNELS];
+    byte rejected = 0;
+    for (byte i = 0; i < channels; i++) {
+        mean[i] = 0;
+        m2[i] = 0;
+        counts[i] = 0;
+    }
+    setBulbs(portNumber, true);
+    bool ok = true;
+    for (byte sample = 0; sample < oversampleCounts[portNumber] && ok; sample++) {
+        float values[AS7265X_CHANNELS];
+        ok = startOneShot(portNumber) && waitForData(portNumber) && readCalibratedBlock(type, values);
+        for (byte i = 0; ok && i < channels; i++) {
+            float value = values[i];
+            if (rejectSigma > 0 && counts[i] >= OUTLIER_MIN_SAMPLES) {
+                float deviation = sqrt(m2[i] / (counts[i] - 1));
+                if (deviation > 0 && fabs(value - mean[i]) > rejectSigma * deviation) {
+                    rejected = min(rejected + 1, 255);
+                    continue;
+                }
+            }
+            if (counts[i] == 0 || value < minimum[i]) {
+                minimum[i] = value;
+            }
+            if (counts[i] == 0 || value > maximum[i]) {
+                maximum[i] = value;
+            }
+            counts[i]++;
+            float delta = value - mean[i];
+            mean[i] += delta / counts[i];
+            m2[i] += delta * (value - mean[i]);
+        }
+    }
+    setBulbs(portNumber, false);
+    if (!ok) {
+        if (outputMode == TEXT_OUTPUT) {
+            txQueue.print("Oversampling failed on port: "); txQueue.println(portNumber);
+        }
+        return false;
+    }
+    for (byte i = 0; i < channels; i++) {
+        m2[i] = (counts[i] > 1) ? m2[i] / (counts[i] - 1) : 0;  // now the sample variance
+    }
+    const byte kinds[4] = { RECORD_MEAN, RECORD_VARIANCE, RECORD_MIN, RECORD_MAX };
+    const float *statistics[4] = { mean, m2, minimum, maximum };
+    unsigned long now = millis();
+    for (byte k = 0; k < 4; k++) {
+        while (records.full()) {
+            drainRecords(1);  // make room so the 4 records of the reading stay together
+        }
+        SpectralRecord *record = records.beginWrite();
+        fillRecord(*record, portNumber);
+        record->kind = kinds[k];
+        record->sampleCount = oversampleCounts[portNumber];
+        record->rejectedCount = rejected;
+        memcpy(record->channels, statistics[k], channels * sizeof(float));
+        record->timestamp = now;
+        record->sequence = frameSequence;
+        records.commitWrite();
+    }
+    frameSequence++;
+    reportedPorts |= PORT_BIT(portNumber);
+    return true;
+}
+
+unsigned long SpectroDesktop::measurementTime(byte portNumber) {
+    /* Time in milliseconds a one shot measurement of all 6 channels takes on a port */
+    return (2UL * integrationTimes[portNumber] * INTEGRATION_CYCLE_US) / 1000;
+}
+
+bool SpectroDesktop::setBulbs(byte portNumber, bool turnOn) {
+    /* Turn the bulbs enabled in enableBulbsArray for a port on or off
+    (the mux must be connected correctly before calling this).
+    The AS7265x bulbs are each driven by a different device of the sensor */
+    return switchBulbs(portNumber, enableBulbsArray[portNumber], turnOn);
+}
+
+bool SpectroDesktop::switchBulbs(byte portNumber, byte bulbs, bool turnOn) {
+    /* Turn some of the bulbs of a port on or off (the mux must be connected correctly
+    before calling this), no bulbs does nothing */
+    const SensorDriver *driver = driverFor(sensorTypeArray[portNumber]);
+    if (driver == nullptr) {
+        return false;
+    }
+    PROFILE_START(ledStart);
+    bool ok = (this->*driver->driveBulbs)(bulbs, turnOn);
+    PROFILE_TIME(portNumber, PROFILE_LED, ledStart);
+    return ok;
+}
+
+void SpectroDesktop::readAS7262(byte portNumber) {
+    /* Read an AS7262 (the mux must be connected correctly before calling this)
+    no return, the data will be print to the serial port.  All the sensor types are
+    read the same way now, this is kept so older sketches still work */
+    readAllSensors(PORT_BIT(portNumber));
+    drainRecords(SPECTRAL_RECORD_QUEUE_SIZE);
+}
+
+void SpectroDesktop::readAS7263(byte portNumber) {
+    /* Read an AS7263, see readAS7262() */
+    readAllSensors(PORT_BIT(portNumber));
+    drainRecords(SPECTRAL_RECORD_QUEUE_SIZE);
+}
+
+void SpectroDesktop::readAS7265x(byte portNumber) {
+    /* Read an AS7265x, see readAS7262() */
+    readAllSensors(PORT_BIT(portNumber));
+    drainRecords(SPECTRAL_RECORD_QUEUE_SIZE);
+}
+
+bool SpectroDesktop::readCalibratedData(byte portNumber, float *values) {
+    /* Read the calibrated channels of the sensor on a port into values, which has to
+    hold 6 floats for an AS7262 / AS7263 or 18 floats for an AS7265x (in wavelength order).
+    Does not start a measurement, the last finished one is read.
+    Return false if there is no sensor or it did not respond */
+    if (portNumber >= portCount() || sensorTypeArray[portNumber] == NO_SENSOR || !enableMuxPort(portNumber)) {
+        return false;
+    }
+    return readCalibratedBlock(sensorTypeArray[portNumber], values);
+}
 
-    enableMuxPort(portNumber);
-    bool hasButton = button.isConnected();
-    if (hasButton == true) {
-        button.LEDon(BUTTON_LED_LIGHT_LEVEL);
+bool SpectroDesktop::readRawData(byte portNumber, uint16_t *counts) {
+    /* Same as readCalibratedData() but gets the raw 16 bit counts of each channel */
+    if (portNumber >= portCount() || sensorTypeArray[portNumber] == NO_SENSOR || !enableMuxPort(portNumber)) {
+        return false;
     }
+    return readRawBlock(sensorTypeArray[portNumber], counts);
+}
+
+bool SpectroDesktop::readCalibratedBlock(SensorType type, float *values, uint16_t *counts) {
+    /* Read all the calibrated channels of the sensor on the selected port, in wavelength order,
+    and the raw counts of the same measurement into counts if it is not nullptr */
+    const SensorDriver *driver = driverFor(type);
+    PROFILE_START(readStart);
+    bool ok = (driver != nullptr && (this->*driver->readCalibrated)(values, counts));
+    PROFILE_TIME(selectedPort, PROFILE_READOUT, readStart);
+    return ok;
+}
+
+bool SpectroDesktop::readRawBlock(SensorType type, uint16_t *counts) {
+    /* Read all the raw channel counts of the sensor on the selected port, no float conversion is done */
+    const SensorDriver *driver = driverFor(type);
+    PROFILE_START(readStart);
+    bool ok = (driver != nullptr && (this->*driver->readRaw)(counts));
+    PROFILE_TIME(selectedPort, PROFILE_READOUT, readStart);
+    return ok;
+}
 
-    // Print out the setup data
-    Serial.println("Starting Data Read");
-    Serial.print("Reading port: "); Serial.println(portNumber);
-    Serial.print("Integration time: "); Serial.println(integrationTimes[portNumber]);
-    Serial.print("LED current: "); Serial.println(ledCurrents[portNumber]);
+const SpectroDesktop::SensorDriver SpectroDesktop::drivers[SENSOR_TYPE_COUNT] = {
+    { 0, 0, 0, 0, 0, "", nullptr, nullptr, nullptr, nullptr, nullptr },  // NO_SENSOR
+    SENSOR_DRIVER(AS7262Traits),
+    SENSOR_DRIVER(AS7263Traits),
+    SENSOR_DRIVER(AS7265XTraits)
+};
 
-    if (sensorTypeArray[portNumber] == AS7262_SENSOR) {
-        Serial.println("running AS7262 Sensor");
-        readAS7262(portNumber);
+const SpectroDesktop::SensorDriver *SpectroDesktop::driverFor(SensorType type) {
+    /* Get the driver of a sensor type, nullptr for NO_SENSOR or an unknown type */
+    if (type == NO_SENSOR || type >= SENSOR_TYPE_COUNT) {
+        return nullptr;
     }
-    else if (sensorTypeArray[portNumber] == AS7263_SENSOR) {
-        Serial.println("running AS7263 Sensor");
-        readAS7263(portNumber);
+    return &drivers[type];
+}
+
+SensorType SpectroDesktop::typeFromHardwareCode(byte hardwareCode) {
+    /* Get the sensor type with the code read from the HW_VERSION_REGISTER */
+    for (byte type = NO_SENSOR + 1; type < SENSOR_TYPE_COUNT; type++) {
+        if (drivers[type].hardwareCode == hardwareCode) {
+            return (SensorType)type;
+        }
     }
-    else if (sensorTypeArray[portNumber] == AS7265X_SENSOR) {
-        Serial.println("running AS7265x Sensor");
-        readAS7265x(portNumber);
+    return NO_SENSOR;
+}
+
+template <class Traits>
+bool SpectroDesktop::readCalibratedChannels(float *values, uint16_t *counts) {
+    /* Read all the calibrated registers (4 byte floats, MSB first) of a Traits sensor on
+    the selected port, selecting each device only once.  If counts is not nullptr the raw
+    registers are read too, in the same block as they come right before the calibrated ones */
+    float deviceValues[Traits::devices > 1 ? Traits::channels : 1];
+    float *read = (Traits::devices > 1) ? deviceValues : values;
+    uint16_t deviceCounts[Traits::devices > 1 ? Traits::channels : 1];
+    uint16_t *readCounts = (Traits::devices > 1) ? deviceCounts : counts;
+    byte block[2 * CHANNELS_PER_DEVICE + 4 * CHANNELS_PER_DEVICE];
+    byte *calibrated = (counts != nullptr) ? &block[2 * CHANNELS_PER_DEVICE] : block;
+    for (byte device = 0; device < Traits::devices; device++) {
+        if (Traits::devices > 1 && !writeVirtualRegister(DEV_SELECT_REGISTER, Traits::deviceId(device))) {
+            return false;
+        }
+        bool ok = (counts != nullptr) ? readVirtualBlock(FIRST_RAW_REGISTER, block, sizeof(block)) :
+                                        readVirtualBlock(FIRST_CAL_REGISTER, block, 4 * CHANNELS_PER_DEVICE);
+        if (!ok) {
+            return false;
+        }
+        for (byte i = 0; i < CHANNELS_PER_DEVICE; i++) {
+            uint32_t bits = ((uint32_t)calibrated[4 * i] << 24) | ((uint32_t)calibrated[4 * i + 1] << 16) |
+                            ((uint32_t)calibrated[4 * i + 2] << 8) | calibrated[4 * i + 3];
+            memcpy(&read[device * CHANNELS_PER_DEVICE + i], &bits, sizeof(float));
+            if (counts != nullptr) {
+                readCounts[device * CHANNELS_PER_DEVICE + i] = ((uint16_t)block[2 * i] << 8) | block[2 * i + 1];
+            }
+        }
     }
-    if (hasButton == true) {
-        button.LEDoff();
+    if (Traits::devices > 1) {  // put the devices' channels in wavelength order
+        for (byte i = 0; i < Traits::channels; i++) {
+            values[i] = deviceValues[Traits::channelSource(i)];
+            if (counts != nullptr) {
+                counts[i] = deviceCounts[Traits::channelSource(i)];
+            }
+        }
     }
-    Serial.println("End Data Read");
-
+    return true;
 }
 
-void SpectroDesktop::readAS7262(byte portNumber) {
-    /* Read an AS7262 (the mux must be connected correctly before calling this)
-    no return, the data will be print to the serial port.  Different than AS7263 because
-    the AS726x public methods will now allow it, ie AS7262 uses getCalibratedViolet(), 
-    while the AS7263 uses getCalibratedR() */
-    bool useBulb = enableBulbsArray[portNumber] & 0x01;
-    if (useBulb) {
-        as726x.enableBulb();
+template <class Traits>
+bool SpectroDesktop::readRawChannels(uint16_t *counts) {
+    /* Same as readCalibratedChannels() for the raw registers (2 bytes, MSB first) */
+    uint16_t deviceCounts[Traits::devices > 1 ? Traits::channels : 1];
+    uint16_t *read = (Traits::devices > 1) ? deviceCounts : counts;
+    byte block[2 * CHANNELS_PER_DEVICE];
+    for (byte device = 0; device < Traits::devices; device++) {
+        if (Traits::devices > 1 && !writeVirtualRegister(DEV_SELECT_REGISTER, Traits::deviceId(device))) {
+            return false;
+        }
+        if (!readVirtualBlock(FIRST_RAW_REGISTER, block, sizeof(block))) {
+            return false;
+        }
+        for (byte i = 0; i < CHANNELS_PER_DEVICE; i++) {
+            read[device * CHANNELS_PER_DEVICE + i] = ((uint16_t)block[2 * i] << 8) | block[2 * i + 1];
+        }
     }
-    as726x.takeMeasurements();
-    if (useBulb) {
-        as726x.disableBulb();
+    if (Traits::devices > 1) {
+        for (byte i = 0; i < Traits::channels; i++) {
+            counts[i] = deviceCounts[Traits::channelSource(i)];
+        }
     }
-    getAS7262Data();
+    return true;
 }
 
-void SpectroDesktop::getAS7262Data() {
-    /* Get the AS7262 data (public names of as726x library is different between as7262 and as7263
-    prints the data to the serial port*/
-    Serial.print("AS7262 Data: ");
-    Serial.print(as726x.getCalibratedViolet(), 4); Serial.print(", ");
-    Serial.print(as726x.getCalibratedBlue(), 4); Serial.print(", ");
-    Serial.print(as726x.getCalibratedGreen(), 4); Serial.print(", ");
-    Serial.print(as726x.getCalibratedYellow(), 4); Serial.print(", ");
-    Serial.print(as726x.getCalibratedOrange(), 4); Serial.print(", ");
-    Serial.println(as726x.getCalibratedRed(), 4);
+template <class Traits>
+bool SpectroDesktop::driveBulbs(byte bulbs, bool turnOn) {
+    /* Turn the bulbs set in bulbs on or off, each bulb of a multi device part
+    is driven by a different device (the mux must be connected correctly before calling this) */
+    byte ledBits = turnOn ? LED_DRIVE_ENABLE_BIT : 0;
+    bool ok = true;
+    for (byte i = 0; (Traits::bulbs >> i) != 0; i++) {
+        if (!(bulbs & Traits::bulbs & (1 << i))) {
+            continue;
+        }
+        ok = (Traits::devices == 1 || writeVirtualRegister(DEV_SELECT_REGISTER, Traits::bulbDevice(i))) &&
+             updateVirtualRegister(LED_CONTROL_REGISTER, LED_DRIVE_ENABLE_BIT, ledBits) && ok;
+    }
+    return ok;
 }
 
-void SpectroDesktop::readAS7263(byte portNumber) {
-    /* Read an AS7263 (the mux must be connected correctly before calling this)
-    no return, the data will be print to the serial port.  Different than AS7262 because
-    the AS726x public methods will now allow it */
-    bool useBulb = enableBulbsArray[portNumber] & 0x01;
-    if (useBulb) {
-        as726x.enableBulb();
-    }
-    as726x.takeMeasurements();  // AS7262 and AS7263 have same method here
-    getAS7263Data();
-    if (useBulb) {
-        as726x.disableBulb();
+template <class Traits>
+bool SpectroDesktop::updateDevices(byte virtualAddr, byte mask, byte bits) {
+    /* Change the bits in mask of a virtual register on every device of a Traits sensor */
+    for (byte device = 0; device < Traits::devices; device++) {
+        if (Traits::devices > 1 && !writeVirtualRegister(DEV_SELECT_REGISTER, Traits::deviceId(device))) {
+            return false;
+        }
+        if (!updateVirtualRegister(virtualAddr, mask, bits)) {
+            return false;
+        }
     }
+    return true;
 }
 
-void SpectroDesktop::getAS7263Data() {
-    /* Get the AS7262 data (public names of as726x library is different between as7262 and as7263
-    prints the data to the serial port*/
-    Serial.print("AS7263 Data: ");
-    Serial.print(as726x.getCalibratedR(), 4); Serial.print(", ");
-    Serial.print(as726x.getCalibratedS(), 4); Serial.print(", ");
-    Serial.print(as726x.getCalibratedT(), 4); Serial.print(", ");
-    Serial.print(as726x.getCalibratedU(), 4); Serial.print(", ");
-    Serial.print(as726x.getCalibratedV(), 4); Serial.print(", ");
-    Serial.println(as726x.getCalibratedW(), 4);
+void SpectroDesktop::setEnableBulb(byte portNumber, byte newSetting) {
+    if (!checkPort(portNumber, "setEnableBulb")) {
+        return;
+    }
+    enableBulbsArray[portNumber] = newSetting;
 }
 
-void SpectroDesktop::readAS7265x(byte portNumber) {
-    /* Read an AS7265x (the mux must be connected correctly before calling this)
-    no return, the data will be print to the serial port.*/
-    if (enableBulbsArray[portNumber] & 0x01) {
-        as7265x.enableBulb(AS7265x_LED_WHITE);
-    }
-    if (enableBulbsArray[portNumber] & 0x02) {
-        as7265x.enableBulb(AS7265x_LED_UV);
-    }
-    if (enableBulbsArray[portNumber] & 0x04) {
-        as7265x.enableBulb(AS7265x_LED_IR);
-    }
-    as7265x.takeMeasurements();  
-    if (enableBulbsArray[portNumber] & 0x01) {
-        as7265x.disableBulb(AS7265x_LED_WHITE);
-    }
-    if (enableBulbsArray[portNumber] & 0x02) {
-        as7265x.disableBulb(AS7265x_LED_UV);
-    }
-    if (enableBulbsArray[portNumber] & 0x04) {
-        as7265x.disableBulb(AS7265x_LED_IR);
+void SpectroDesktop::setBulbCurrent(byte portNumber, byte newSetting) {
+    /* Set the LED current of a port, 0b00 12.5 mA up to MAX_LED_CURRENT (100 mA).
+    It is written to the sensor when the port's next measurement starts */
+    if (!checkPort(portNumber, "setBulbCurrent")) {
+        return;
     }
-    getAS7265xData();
+    setConfig(portNumber, ledCurrents, min(newSetting, MAX_LED_CURRENT), CONFIG_LED_CURRENT);
 }
 
-void SpectroDesktop::getAS7265xData() {
-    Serial.print("AS7265x Data: ");
+void SpectroDesktop::setIntTime(byte portNumber, byte newSetting) {
+    /* Set the integration time of a port in 2.8 ms cycles (1 to 255), a one shot of
+    all channels takes 2 of these.  Written when the port's next measurement starts */
+    if (!checkPort(portNumber, "setIntTime")) {
+        return;
+    }
+    setConfig(portNumber, integrationTimes, max(newSetting, (byte)1), CONFIG_INT_TIME);
+}
 
-    Serial.print(as7265x.getCalibratedA()); Serial.print(", ");  // 410 nm 
-    Serial.print(as7265x.getCalibratedB()); Serial.print(", ");  // 435 nm
-    Serial.print(as7265x.getCalibratedC()); Serial.print(", ");  // 460 nm
-    Serial.print(as7265x.getCalibratedD()); Serial.print(", ");  // 485 nm
-    Serial.print(as7265x.getCalibratedE()); Serial.print(", ");  // 510 nm
-    Serial.print(as7265x.getCalibratedF()); Serial.print(", ");  // 535 nm
+void SpectroDesktop::setGain(byte portNumber, byte newSetting) {
+    /* Set the gain of a port, 0b00 1x up to MAX_GAIN (64x).
+    Written with the start of the port's next measurement */
+    if (!checkPort(portNumber, "setGain")) {
+        return;
+    }
+    setConfig(portNumber, gains, min(newSetting, MAX_GAIN), CONFIG_GAIN);
+}
 
-    Serial.print(as7265x.getCalibratedG()); Serial.print(", ");  // 565 nm
-    Serial.print(as7265x.getCalibratedH()); Serial.print(", ");  // 585 nm
-    Serial.print(as7265x.getCalibratedR()); Serial.print(", ");  // 610 nm
-    Serial.print(as7265x.getCalibratedI()); Serial.print(", ");  // 645 nm
-    Serial.print(as7265x.getCalibratedS()); Serial.print(", ");  // 680 nm
-    Serial.print(as7265x.getCalibratedJ()); Serial.print(", ");  // 705 nm
+byte SpectroDesktop::getIntTime(byte portNumber) {
+    return (portNumber < MAX_PORTS) ? integrationTimes[portNumber] : 0;
+}
 
-    Serial.print(as7265x.getCalibratedT()); Serial.print(", ");  // 730 nm
-    Serial.print(as7265x.getCalibratedU()); Serial.print(", ");  // 760 nm
-    Serial.print(as7265x.getCalibratedV()); Serial.print(", ");  // 810 nm
-    Serial.print(as7265x.getCalibratedW()); Serial.print(", ");  // 860 nm
-    Serial.print(as7265x.getCalibratedK()); Serial.print(", ");  // 900 nm
-    Serial.println(as7265x.getCalibratedL());  // 940 nm
+byte SpectroDesktop::getBulbCurrent(byte portNumber) {
+    return (portNumber < MAX_PORTS) ? ledCurrents[portNumber] : 0;
 }
 
-void SpectroDesktop::setEnableBulb(byte portNumber, byte newSetting) {
-    if (portNumber > 8) {  // Check for a correct port number
-        Serial.println("setEnableBulb: port Number has to be 7 or less");
-        return;
-    }
-    enableBulbsArray[portNumber] = newSetting;
+byte SpectroDesktop::getGain(byte portNumber) {
+    return (portNumber < MAX_PORTS) ? gains[portNumber] : 0;
 }
 
 SensorType SpectroDesktop::getSensorType(byte channel) {
@@ -276,195 +2049,804 @@ SensorType SpectroDesktop::getSensorType(byte channel) {
     
     Return sensor type*/
     #if(DEBUG_FLAG)
-        Serial.println("Get sensor type");
+        txQueue.println("Get sensor type");
     #endif
-    SensorType _sensor_type = NO_SENSOR;  // Initialize to no sensor and fill in if one is found
-    //bool sensor_begins = as726x.begin(*_i2cPort);
-    bool sensor_begins = as726x.begin();  // will be 0 for no sensor AND for AS7265x so have to check this later
+    // begin() will be 0 for no sensor AND for AS7265x so have to check this later
     #if(DEBUG_FLAG)
-        Serial.print("sensor begins: "); Serial.println(sensor_begins);
+        bool sensor_begins = as726x.begin(*_i2cPort);
+        txQueue.print("sensor begins: "); txQueue.println(sensor_begins);
+    #else
+        as726x.begin(*_i2cPort);
     #endif
     uint8_t hw_type = as726x.getVersion();
     #if(DEBUG_FLAG)
-        Serial.print("Hardware type: 0x"); Serial.println(hw_type, HEX);
+        txQueue.print("Hardware type: 0x"); txQueue.println(hw_type, HEX);
     #endif
-    integrationTimes[channel] = 200;
-    if (hw_type == AS7262_CODE) {
-        _sensor_type = AS7262_SENSOR;
-        as726x.setIntegrationTime(200);
-        as726x.setMeasurementMode(0b11);  // read all channels
-        Serial.print("AS7262 device attached to port: ");
-        Serial.print(channel); Serial.print("|  ");
-    }
-    else if (hw_type == AS7263_CODE) {
-        _sensor_type = AS7263_SENSOR;
-        as726x.setIntegrationTime(200);
-        as726x.setMeasurementMode(0b11);  // read all channels
-        Serial.print("AS7263 device attached to port: ");
-        Serial.print(channel); Serial.print("|  ");
+    SensorType _sensor_type = typeFromHardwareCode(hw_type);  // NO_SENSOR if the code is not known
+    const SensorDriver *driver = driverFor(_sensor_type);
+    if (driver != nullptr) {  // the shadow settings are what the driver begin() below writes
+        integrationTimes[channel] = driver->defaultIntegration;
+        ledCurrents[channel] = 0;
+        gains[channel] = DEFAULT_GAIN;
+        configDirty[channel] = 0;
+        configSuspect &= ~PORT_BIT(channel);
     }
-    else if (hw_type == AS7265X_CODE) {
-        _sensor_type = AS7265X_SENSOR;
-        as7265x.begin();
+    if (_sensor_type == AS7265X_SENSOR) {
+        as7265x.begin(*_i2cPort);
         as7265x.setBulbCurrent(AS7265X_LED_CURRENT_LIMIT_12_5MA, AS7265x_LED_WHITE);
         as7265x.setBulbCurrent(AS7265X_LED_CURRENT_LIMIT_12_5MA, AS7265x_LED_IR);
         as7265x.setBulbCurrent(AS7265X_LED_CURRENT_LIMIT_12_5MA, AS7265x_LED_UV);
         as7265x.disableIndicator();
-        as7265x.setIntegrationCycles(200);
+        as7265x.setIntegrationCycles(driver->defaultIntegration);
         as7265x.setMeasurementMode(0b11);  // read all channels
-        Serial.print("AS7265x device attached to port: ");
-        Serial.print(channel); Serial.print("|  ");
-    }  // else SensorType is already set to no sensor
+    }
+    else if (driver != nullptr) {
+        as726x.setIntegrationTime(driver->defaultIntegration);
+        as726x.setMeasurementMode(0b11);  // read all channels
+    }
+    if (driver != nullptr) {
+        txQueue.print(driver->name); txQueue.print(" device attached to port: ");
+        txQueue.print(channel); txQueue.print("|  ");
+    }
     //  Now check if a button is also attached
-    Serial.println(button.isConnected());
-    if (button.isConnected() == false) {
-        Serial.println("No button attached to device.");
+    txQueue.println(portButton().isConnected());
+    if (portButton().isConnected() == false) {
+        txQueue.println("No button attached to device.");
+        buttonPorts &= ~PORT_BIT(channel);
     }
     else {
-        Serial.println("Button attached to device.");
+        txQueue.println("Button attached to device.");
+        buttonPorts |= PORT_BIT(channel);
         button.clearEventBits();  // Clear any clicks before being setup
-        button.LEDoff();
+        portButton().LEDoff();
         button.setDebounceTime(20);  // Sometime this can get messed up for some reason
         #if(DEBUG_FLAG)
-            Serial.print("Button debounce time: "); Serial.println(button.getDebounceTime());
+            txQueue.print("Button debounce time: "); txQueue.println(button.getDebounceTime());
         #endif
     }
     return _sensor_type;
 }
 
 void SpectroDesktop::turnButtonOn(byte portNumber) {
-    if (portNumber > 8) {  // Check for a correct port number
-        Serial.println("enableMuxPort: port Number has to be 7 or less");
+    if (!checkPort(portNumber, "turnButtonOn")) {
         return;
     }
     enableMuxPort(portNumber);
-    if (button.isConnected()) {
-        button.LEDon(BUTTON_LED_LIGHT_LEVEL);
+    if (buttonPorts & PORT_BIT(portNumber)) {
+        portButton().LEDon(BUTTON_LED_LIGHT_LEVEL);
     }
 }
 
 void SpectroDesktop::turnButtonOff(byte portNumber) {
-    if (portNumber > 8) {  // Check for a correct port number
-        Serial.println("enableMuxPort: port Number has to be 7 or less");
+    if (!checkPort(portNumber, "turnButtonOff")) {
         return;
     }
     enableMuxPort(portNumber);
-    if (button.isConnected()) {
-        button.LEDoff();
+    if (buttonPorts & PORT_BIT(portNumber)) {
+        portButton().LEDoff();
     }
 }
 
 void SpectroDesktop::turnIndicatorOn(byte portNumber) {
-    if (portNumber > 8) {  // Check for a correct port number
-        Serial.println("enableMuxPort: port Number has to be 7 or less");
+    if (!checkPort(portNumber, "turnIndicatorOn")) {
         return;
     }
     enableMuxPort(portNumber);
-    if (sensorTypeArray[portNumber] == AS7265X_SENSOR) {
-        as7265x.enableIndicator();
+    if (sensorTypeArray[portNumber] == AS7265X_SENSOR) {  // the indicator is on the master device
+        writeVirtualRegister(DEV_SELECT_REGISTER, AS7265X_NIR_DEVICE);
     }
-    else if (sensorTypeArray[portNumber] == AS7262_SENSOR ||
-        sensorTypeArray[portNumber] == AS7263_SENSOR) {
-        as726x.enableIndicator();
+    if (sensorTypeArray[portNumber] != NO_SENSOR) {
+        updateVirtualRegister(LED_CONTROL_REGISTER, INDICATOR_ENABLE_BIT, INDICATOR_ENABLE_BIT);
     }
-    Serial.print("Indicator turned on:"); Serial.println(portNumber);
+    txQueue.print("Indicator turned on:"); txQueue.println(portNumber);
 }
 
 void SpectroDesktop::turnIndicatorOff(byte portNumber) {
-    if (portNumber > 8) {  // Check for a correct port number
-        Serial.println("enableMuxPort: port Number has to be 7 or less");
+    if (!checkPort(portNumber, "turnIndicatorOff")) {
         return;
     }
     enableMuxPort(portNumber);
-    if (sensorTypeArray[portNumber] == AS7265X_SENSOR) {
-        as7265x.disableIndicator();  
+    if (sensorTypeArray[portNumber] == AS7265X_SENSOR) {  // the indicator is on the master device
+        writeVirtualRegister(DEV_SELECT_REGISTER, AS7265X_NIR_DEVICE);
     }
-    else if (sensorTypeArray[portNumber] == AS7262_SENSOR || 
-        sensorTypeArray[portNumber] == AS7263_SENSOR) {
-        as726x.disableIndicator();
+    if (sensorTypeArray[portNumber] != NO_SENSOR) {
+        updateVirtualRegister(LED_CONTROL_REGISTER, INDICATOR_ENABLE_BIT, 0);
     }
-    Serial.print("Indicator turned off:"); Serial.println(portNumber);
+    txQueue.print("Indicator turned off:"); txQueue.println(portNumber);
 }
 
 bool SpectroDesktop::enableMuxPort(byte portNumber) {
-    /* Enable one of the mux ports, and 1 port only. The mux is then
-    checked and will return true if the mux is set correctly or false if not*/
+    /* Select a port, see selectMuxPort() */
+    PROFILE_START(selectStart);
+    bool selected = selectMuxPort(portNumber);
+    PROFILE_TIME(portNumber, PROFILE_MUX_SELECT, selectStart);
+    return selected;
+}
+
+bool SpectroDesktop::selectMuxPort(byte portNumber) {
+    /* Enable one of the mux ports, and 1 port only. If the port is already selected
+    (from the cached mux settings) nothing is sent.  Another mux on the same bus is only
+    closed if it has a port open, ie when going from one mux to another.
+    Depending on the verify policy the mux is read back and this will return true
+    if the mux is set correctly or false if not.  The mux is written at the clock of the
+    port that is open, then the bus is set to the clock of the new port*/
     #if(DEBUG_FLAG)
-        Serial.print("enabling port1: "); Serial.println(portNumber);
+        txQueue.print("enabling port1: "); txQueue.println(portNumber);
     #endif
-    if (portNumber > 8) {  // Check for a correct port number
-        Serial.println("enableMuxPort: port Number has to be 7 or less");
+    if (!checkPort(portNumber, "enableMuxPort")) {
         return false;
     }
-    byte settings = (1 << portNumber);
-    _i2cPort->beginTransmission(MUX_ADDR);
-    _i2cPort->write(settings);
-    byte end_transmission = _i2cPort->endTransmission();
-    //if (end_transmission != 0) {
-    #if(DEBUG_FLAG)
-        Serial.print("End transmission (enable): "); Serial.println(end_transmission);
-    #endif
-    //    //return false;  // Device is not responding correctly
-    //}
-    byte current_settings = getMuxSettings();
-    if (current_settings == settings) {
+    transferPort = portNumber;
+    if (!useMux) {  // only the board's Qwiic connection, used as port 0
+        _i2cPort = buses[0];
+        selectedPort = 0;
+        applyPortClock(0);
+        return (portNumber == 0);
+    }
+    selectedPort = NO_PORT;  // until the mux is known to be set
+    byte mux = portNumber / 8;
+    byte settings = (1 << (portNumber % 8));
+    _i2cPort = buses[muxes[mux].bus];
+    for (byte other = 0; other < muxCount; other++) {
+        if (other == mux || muxes[other].bus != muxes[mux].bus ||
+            (muxes[other].cacheValid && muxes[other].settings == 0)) {
+            continue;
+        }
+        if (!sendMuxSettings(other, 0)) {  // the same addresses are behind every mux
+            return false;
+        }
+    }
+    bool verifyDue = (muxVerifyPolicy == VERIFY_PERIODIC &&
+                      muxSelectsSinceVerify >= muxVerifyPeriod);
+    if (muxes[mux].cacheValid && muxes[mux].settings == settings && !verifyDue) {
+        muxSelectsSinceVerify += 1;
+        selectedPort = portNumber;
+        applyPortClock(portNumber);
+        return true;
+    }
+    bool sent = sendMuxSettings(mux, settings);
+    if (sent && muxVerifyPolicy != VERIFY_ALWAYS && !verifyDue) {
+        muxSelectsSinceVerify += 1;
+        selectedPort = portNumber;
+        applyPortClock(portNumber);
+        return true;
+    }
+    byte current_settings = 0;
+    I2cResult result = getMuxSettings(mux, current_settings);  // updates the cache with what the mux reports
+    muxSelectsSinceVerify = 0;
+    if (result == I2C_OK && current_settings == settings) {
         #if(DEBUG_FLAG)
-            Serial.println("Mux set correctly");
+            txQueue.println("Mux set correctly");
         #endif
+        selectedPort = portNumber;
+        applyPortClock(portNumber);
         return true;
     }
-    return false;  // if _settings != settings
+    PROFILE_COUNT(portNumber, PROFILE_MUX_VERIFY_FAILS);
+    return false;  // if _settings != settings, or the mux did not answer even after clearing the bus
+}
+
+void SpectroDesktop::setMuxVerifyPolicy(MuxVerifyPolicy policy, byte period) {
+    /* Set when enableMuxPort() reads back the mux to check the port was selected,
+    period is only used with VERIFY_PERIODIC */
+    muxVerifyPolicy = policy;
+    muxVerifyPeriod = period;
+    muxSelectsSinceVerify = 0;
+}
+
+void SpectroDesktop::invalidateMuxCache() {
+    /* Forget the cached settings of the muxes on the selected bus (which is being reset)
+    so the next enableMuxPort() writes them again, and have the settings of the sensors
+    on them read back before their next measurement */
+    selectedPort = NO_PORT;
+    for (byte i = 0; i < muxCount; i++) {
+        if (buses[muxes[i].bus] == _i2cPort) {
+            muxes[i].cacheValid = false;
+            for (byte channel = 0; channel < 8; channel++) {  // check the sensors' settings as well
+                configSuspect |= PORT_BIT(8 * i + channel);
+            }
+        }
+    }
+    if (!useMux) {
+        configSuspect |= PORT_BIT(0);
+    }
 }
 
-byte SpectroDesktop::getMuxSettings() {
-    /* Check what the setting are in the mux */
-    _i2cPort->requestFrom(MUX_ADDR, 1);
-    if (!_i2cPort->available()) {  // Make sure the mux will respond
-        Serial.println("Mux not sending settings");
-        _i2cPort->end();
-        _i2cPort->begin();
-        return 254;
+I2cResult SpectroDesktop::getMuxSettings(byte mux, byte &settings) {
+    /* Check what the setting are in a mux */
+    I2cResult result = transfer(buses[muxes[mux].bus], muxes[mux].address, nullptr, 0, &settings, 1);
+    if (result != I2C_OK) {  // the bus was already cleared if it was stuck
+        if (outputMode == TEXT_OUTPUT) {
+            txQueue.println("Mux not sending settings");
+        }
+        muxes[mux].cacheValid = false;
+        return result;
     }
-    // get current settings
-    byte settings = _i2cPort->read();
+    muxes[mux].settings = settings;
+    muxes[mux].cacheValid = true;
     #if(DEBUG_FLAG)
-        Serial.print("mux settings (get): "); Serial.println(settings);
+        txQueue.print("mux settings (get): "); txQueue.println(settings);
     #endif
-    return settings;
+    return I2C_OK;
 }
 
-bool SpectroDesktop::sendMuxSettings(byte _settings) {
+bool SpectroDesktop::sendMuxSettings(byte mux, byte _settings) {
     /* Write a new mux setting to set the ports that are open */
-    _i2cPort->beginTransmission(MUX_ADDR);
-    _i2cPort->write(_settings);
-    byte end_trans = _i2cPort->endTransmission();
+    I2cResult result = transfer(buses[muxes[mux].bus], muxes[mux].address, &_settings, 1);
     #if(DEBUG_FLAG)
-        Serial.print("Send mux settings end trans: "); Serial.println(end_trans);
+        txQueue.print("Send mux settings end trans: "); txQueue.println(result);
     #endif
-    if (end_trans != 0) {
+    if (result != I2C_OK) {
+        muxes[mux].cacheValid = false;
         return false;  // Device is not responding correctly
     }
+    muxes[mux].settings = _settings;
+    muxes[mux].cacheValid = true;
     return true;
 }
 
 bool SpectroDesktop::checkI2cAddress(byte _addr) {
-    /* Check if an i2c address is on the i2c bus.  If an error is caused by this
-    the i2c (Wire) will be reset
+    /* Check if an i2c address is on the i2c bus.  A bus error is retried and the bus
+    cleared if needed (see transfer())
     Return true if the address is on the i2c, else false */
-    _i2cPort->beginTransmission(_addr);
-    byte end_trans = _i2cPort->endTransmission();
+    I2cResult result = transfer(_i2cPort, _addr, nullptr, 0);
+    #if(DEBUG_FLAG)
+        txQueue.print("End transmion code (check i2c): "); txQueue.println(result);
+    #endif
+    return (result == I2C_OK);
+}
+
+SensorType SpectroDesktop::getPortSensorType(byte portNumber) {
+    /* Get the type of sensor found on a port when begin() scanned the mux */
+    if (portNumber >= portCount()) {
+        return NO_SENSOR;
+    }
+    return sensorTypeArray[portNumber];
+}
+
+byte SpectroDesktop::getChannelCount(byte portNumber) {
+    /* Get the number of channels a reading of the sensor on a port has, 0 for no sensor */
+    const SensorDriver *driver = driverFor(getPortSensorType(portNumber));
+    return (driver == nullptr) ? 0 : driver->channels;
+}
+
+uint16_t SpectroDesktop::getWavelength(byte portNumber, byte channel) {
+    /* Get the center wavelength in nm of a channel of the sensor on a port, 0 if there is no such channel */
+    const SensorDriver *driver = driverFor(getPortSensorType(portNumber));
+    if (driver == nullptr || channel >= driver->channels) {
+        return 0;
+    }
+    return driver->wavelength(channel);
+}
+
+BusStats SpectroDesktop::getBusStats() {
+    /* Get the I2C traffic counted since begin() or the last resetBusStats().
+    Only traffic the library puts on the bus directly is counted, the AS726X, AS7265X and
+    Qwiic button libraries talk to the bus on their own */
+    return busStats;
+}
+
+void SpectroDesktop::resetBusStats() {
+    /* Clear the bus statistics and the error counts of every port */
+    busStats = BusStats{};
+    memset(portErrors, 0, sizeof(portErrors));
+}
+
+PortErrorStats SpectroDesktop::getPortErrors(byte portNumber) {
+    /* Get the I2C errors, retries and bus clears of the traffic for a port
+    since begin() or the last resetBusStats() */
+    if (portNumber >= portCount()) {
+        return PortErrorStats{};
+    }
+    return portErrors[portNumber];
+}
+
+void SpectroDesktop::countTransaction(byte bytesWritten, byte bytesRead, I2cResult result) {
+    /* Add one I2C transaction to the bus statistics and those of the port it is for */
+    busStats.transactions += 1;
+    busStats.bytesWritten += bytesWritten;
+    busStats.bytesRead += bytesRead;
+    if (result != I2C_OK) {
+        busStats.errors += 1;
+    }
+    if (transferPort < MAX_PORTS) {
+        PortErrorStats &errors = portErrors[transferPort];
+        errors.transactions += 1;
+        if (result != I2C_OK) {
+            errors.errors += 1;
+            errors.lastError = result;
+        }
+    }
+}
+
+I2cResult SpectroDesktop::transfer(TwoWire *bus, byte address, const byte *data, byte length,
+                                   byte *received, byte receiveLength) {
+    /* Write length bytes of data to address and then, if receiveLength is not 0, read that
+    many bytes into received.  No data and nothing to receive checks the address is there.
+    A failed transaction is retried up to I2C_MAX_RETRIES times with a growing wait, except
+    when the address is not acknowledged, which is what a missing device gives and is
+    returned straight away.  If the retries fail the bus is cleared, the port the traffic is
+    for is selected again and the transaction tried once more, with auto clock that port is
+    first moved to the next slower clock (once, however many tries failed) */
+    unsigned int backoff = I2C_RETRY_FIRST_DELAY_US;
+    I2cResult result = I2C_OK;
+    for (byte attempt = 0; attempt <= I2C_MAX_RETRIES; attempt++) {
+        if (attempt > 0) {
+            busStats.retries += 1;
+            if (transferPort < MAX_PORTS) {
+                portErrors[transferPort].retries += 1;
+            }
+            delayMicroseconds(backoff);
+            backoff *= 2;
+        }
+        result = tryTransfer(bus, address, data, length, received, receiveLength);
+        if (result == I2C_OK || result == I2C_ADDRESS_NACK || result == I2C_DATA_TOO_LONG) {
+            return result;
+        }
+    }
+    if (recovering) {  // failed while selecting the port again, the recovery gives up
+        return result;
+    }
+    if (autoClock) {
+        slowPortClock(transferPort);
+    }
+    recovering = true;
+    recoverBus(bus);
+    bool isMux = (address >= MUX_ADDR && address <= LAST_MUX_ADDR);
+    // the bus clear may have reset the mux, so the device may no longer be behind an open port
+    if (isMux || !useMux || transferPort >= portCount() || selectMuxPort(transferPort)) {
+        result = tryTransfer(bus, address, data, length, received, receiveLength);
+    }
+    recovering = false;
+    return result;
+}
+
+I2cResult SpectroDesktop::tryTransfer(TwoWire *bus, byte address, const byte *data, byte length,
+                                      byte *received, byte receiveLength) {
+    /* 1 try of a transfer(), with no retries */
+    if (length > 0 || receiveLength == 0) {
+        bus->beginTransmission(address);
+        for (byte i = 0; i < length; i++) {
+            bus->write(data[i]);
+        }
+        byte end_trans = bus->endTransmission();
+        I2cResult result = (end_trans <= I2C_TIMEOUT) ? (I2cResult)end_trans : I2C_BUS_ERROR;
+        countTransaction(length, 0, result);
+        if (result != I2C_OK) {
+            return result;
+        }
+    }
+    if (receiveLength > 0) {
+        bus->requestFrom(address, receiveLength);
+        bool complete = (bus->available() >= receiveLength);
+        countTransaction(0, receiveLength, complete ? I2C_OK : I2C_NO_DATA);
+        if (!complete) {
+            while (bus->available()) {  // do not leave a short read for the next one
+                bus->read();
+            }
+            return I2C_NO_DATA;
+        }
+        for (byte i = 0; i < receiveLength; i++) {
+            received[i] = bus->read();
+        }
+    }
+    return I2C_OK;
+}
+
+void SpectroDesktop::recoverBus(TwoWire *bus) {
+    /* Clear a stuck bus.  A device that was reset or lost clocks in the middle of a byte can
+    hold SDA low, it is clocked with up to I2C_CLEAR_PULSES SCL pulses until it lets go, then
+    a start and stop reset every device's bus logic.  Without the bus pins (see setBusPins())
+    Wire is only restarted, at the slowest clock until a port is selected.  The muxes on the bus
+    are written again when next used and the settings of the sensors behind them read back
+    before their next measurement */
     #if(DEBUG_FLAG)
-        Serial.print("End transmion code (check i2c): "); Serial.println(end_trans);
+        txQueue.println("Clearing the i2c bus");
     #endif
-    if (end_trans == 0) {
+    busStats.busClears += 1;
+    if (transferPort < MAX_PORTS) {
+        portErrors[transferPort].busClears += 1;
+    }
+    PROFILE_COUNT(transferPort, PROFILE_BUS_RESETS);
+    byte index = 0;
+    while (index < busCount - 1 && buses[index] != bus) {
+        index++;
+    }
+    byte sda = sdaPins[index];
+    byte scl = sclPins[index];
+    bus->end();
+    if (sda != NO_BUS_PIN && scl != NO_BUS_PIN) {
+        // the pins are only pulled low or let go (open drain), the pull up resistors pull them high
+        pinMode(sda, INPUT);
+        pinMode(scl, INPUT);
+        delayMicroseconds(I2C_CLEAR_HALF_PERIOD_US);
+        for (byte i = 0; i < I2C_CLEAR_PULSES && digitalRead(sda) == LOW; i++) {
+            digitalWrite(scl, LOW);
+            pinMode(scl, OUTPUT);
+            delayMicroseconds(I2C_CLEAR_HALF_PERIOD_US);
+            pinMode(scl, INPUT);
+            delayMicroseconds(I2C_CLEAR_HALF_PERIOD_US);
+        }
+        digitalWrite(sda, LOW);  // start: SDA falls while SCL is high
+        pinMode(sda, OUTPUT);
+        delayMicroseconds(I2C_CLEAR_HALF_PERIOD_US);
+        pinMode(sda, INPUT);  // stop: SDA rises while SCL is high
+        delayMicroseconds(I2C_CLEAR_HALF_PERIOD_US);
+    }
+    bus->begin();
+    setBusTimeout(bus);
+    setBusClock(index, I2C_CLOCK_COUNT - 1);  // which mux port is open is not known
+    TwoWire *selected = _i2cPort;
+    _i2cPort = bus;
+    invalidateMuxCache();
+    _i2cPort = selected;
+}
+
+void SpectroDesktop::setBusTimeout(TwoWire *bus) {
+    /* Have a transaction on a stuck bus give up (I2C_TIMEOUT) instead of hanging,
+    if the Wire library can */
+    #ifdef WIRE_HAS_TIMEOUT
+        bus->setWireTimeout(I2C_TIMEOUT_US, true);
+    #else
+        (void)bus;
+    #endif
+}
+
+void SpectroDesktop::setAutoClock(bool enable, unsigned long retestPeriodMs) {
+    /* Turn the automatic I2C clock of each port on or off, it is off until this is called
+    (call it before begin()).  When on, a full scan in begin() (or tuneClocks()) finds the fastest
+    clock each port works at and begin() saves it with the ports, a transaction that still fails
+    after its retries moves its port to the next slower clock, and every retestPeriodMs one port
+    that was slowed down tries the next faster clock again (0 never retests).
+    When off every port stays at the clock setPortClock() gave it */
+    autoClock = enable;
+    clockRetestPeriod = retestPeriodMs;
+    lastClockRetest = millis();
+}
+
+void SpectroDesktop::tuneClocks() {
+    /* Move every port with a sensor to the fastest clock it passes testPortClock() at,
+    starting from 400 kHz.  Nothing is done without auto clock */
+    if (!autoClock) {
+        return;
+    }
+    for (byte i = 0; i < portCount(); i++) {
+        if (sensorTypeArray[i] == NO_SENSOR) {
+            continue;
+        }
+        tunePortClock(i, CLOCK_400KHZ);
+        if (outputMode == TEXT_OUTPUT) {
+            txQueue.print("Port: "); txQueue.print(i);
+            txQueue.print(" I2C clock (kHz): "); txQueue.println(getPortClockHz(i) / 1000);
+        }
+    }
+    lastClockRetest = millis();
+}
+
+void SpectroDesktop::setPortClock(byte portNumber, I2cClock clock) {
+    /* Set the I2C clock a port is used at.  With auto clock it can still be moved by errors
+    and the retest, see setAutoClock() */
+    if (portNumber >= MAX_PORTS || clock >= I2C_CLOCK_COUNT) {
+        return;
+    }
+    portClocks[portNumber] = clock;
+    if (portNumber == selectedPort) {
+        applyPortClock(portNumber);
+    }
+}
+
+I2cClock SpectroDesktop::getPortClock(byte portNumber) {
+    if (portNumber >= MAX_PORTS) {
+        return CLOCK_100KHZ;
+    }
+    return (I2cClock)portClocks[portNumber];
+}
+
+unsigned long SpectroDesktop::getPortClockHz(byte portNumber) {
+    /* Get the I2C clock of a port in Hz */
+    return CLOCK_HZ[getPortClock(portNumber)];
+}
+
+void SpectroDesktop::applyPortClock(byte portNumber) {
+    /* Set the bus of a port to the port's clock, if it is not at it already */
+    setBusClock(useMux ? muxes[portNumber / 8].bus : 0, portClocks[portNumber]);
+}
+
+void SpectroDesktop::setBusClock(byte bus, byte clock) {
+    if (busClocks[bus] != clock) {
+        buses[bus]->setClock(CLOCK_HZ[clock]);
+        busClocks[bus] = clock;
+    }
+}
+
+bool SpectroDesktop::slowPortClock(byte portNumber) {
+    /* Move a port to the next slower clock, the bus is set to it right away so a retry
+    runs slower.  Return false if the port is already at the slowest */
+    if (portNumber >= portCount() || portClocks[portNumber] >= I2C_CLOCK_COUNT - 1) {
+        return false;
+    }
+    portClocks[portNumber] += 1;
+    portErrors[portNumber].clockStepDowns += 1;
+    applyPortClock(portNumber);
+    #if(DEBUG_FLAG)
+        txQueue.print("Slowing the i2c clock of port: "); txQueue.println(portNumber);
+    #endif
+    return true;
+}
+
+bool SpectroDesktop::testPortClock(byte portNumber) {
+    /* Read the hardware version of the sensor on a port, and the button status if it has a
+    button, CLOCK_TEST_READS times at the port's clock.
+    Return true if every read worked the first time and gave the right hardware version */
+    unsigned long errorsBefore = portErrors[portNumber].errors;
+    const SensorDriver *driver = driverFor(sensorTypeArray[portNumber]);
+    if (driver == nullptr || !enableMuxPort(portNumber)) {
+        return false;
+    }
+    for (byte i = 0; i < CLOCK_TEST_READS; i++) {
+        byte value;
+        if (!readVirtualRegister(HW_VERSION_REGISTER, value) || value != driver->hardwareCode) {
+            return false;
+        }
+        if ((buttonPorts & PORT_BIT(portNumber)) && !readButtonStatus(value)) {
+            return false;
+        }
+    }
+    return (portErrors[portNumber].errors == errorsBefore);  // a retry fixed an error
+}
+
+void SpectroDesktop::tunePortClock(byte portNumber, byte fastest) {
+    /* Find the fastest clock, from fastest down, a port passes testPortClock() at.
+    A transaction that failed all its retries already slowed the port in transfer(),
+    a wrong value or an error a retry fixed is slowed here */
+    portClocks[portNumber] = fastest;
+    while (true) {
+        byte clock = portClocks[portNumber];
+        if (testPortClock(portNumber)) {
+            return;
+        }
+        if (portClocks[portNumber] == clock && !slowPortClock(portNumber)) {
+            return;  // at the slowest, the port is left there
+        }
+    }
+}
+
+void SpectroDesktop::retestClockStep() {
+    /* Every clockRetestPeriod have the next port with a sensor that was slowed down, and
+    has no measurement running, try the next faster clock.  If it fails it goes back down */
+    if (!autoClock || clockRetestPeriod == 0 || millis() - lastClockRetest < clockRetestPeriod) {
+        return;
+    }
+    lastClockRetest = millis();
+    for (byte checked = 0; checked < portCount(); checked++) {
+        byte port = clockRetestPort;
+        clockRetestPort = (clockRetestPort + 1) % portCount();
+        if (sensorTypeArray[port] == NO_SENSOR || portClocks[port] == CLOCK_400KHZ ||
+            (pendingPorts & PORT_BIT(port))) {
+            continue;
+        }
+        tunePortClock(port, portClocks[port] - 1);
+        return;
+    }
+}
+
+void SpectroDesktop::dumpProfile() {
+    /* Print the latency histograms and counters of every port that has any, in text.
+    The library has to be compiled with PROFILE_FLAG set to 1 in asm_sensors_w_mux_library.h */
+    #if(PROFILE_FLAG)
+        for (byte i = 0; i <= portCount(); i++) {
+            byte index = (i == portCount()) ? MAX_PORTS : i;
+            const PortProfile &profile = profiles[index];
+            bool used = false;
+            for (byte e = 0; e < PROFILE_EVENTS; e++) {
+                used = used || profile.events[e].count > 0;
+            }
+            for (byte c = 0; c < PROFILE_COUNTERS; c++) {
+                used = used || profile.counters[c] > 0;
+            }
+            if (used) {
+                sendProfile(index);
+            }
+        }
+    #else
+        txQueue.println("Profiling is off, set PROFILE_FLAG to 1");
+    #endif
+}
+
+void SpectroDesktop::resetProfile() {
+    /* Clear the profiles of every port */
+    #if(PROFILE_FLAG)
+        memset(profiles, 0, sizeof(profiles));
+    #endif
+}
+
+void SpectroDesktop::setProfileFramePeriod(unsigned long periodMs) {
+    /* Send the profile of every port from drainRecords() once every periodMs, 1 port per call
+    so the readings are not held up.  0 (the default) only sends them from dumpProfile() */
+    #if(PROFILE_FLAG)
+        profileFramePeriod = periodMs;
+        lastProfileRound = millis();
+    #else
+        (void)periodMs;
+    #endif
+}
+
+bool SpectroDesktop::getPortProfile(byte portNumber, PortProfile &profile) {
+    /* Copy the profile of a port, NO_PORT for what did not happen on a port.
+    Returns false if there is no such port or profiling is off */
+    #if(PROFILE_FLAG)
+        if (portNumber == NO_PORT) {
+            portNumber = MAX_PORTS;
+        }
+        else if (portNumber >= portCount()) {
+            return false;
+        }
+        profile = profiles[portNumber];
         return true;
+    #else
+        (void)portNumber;
+        (void)profile;
+        return false;
+    #endif
+}
+
+#if(PROFILE_FLAG)
+void SpectroDesktop::profileTime(byte portNumber, ProfileEvent event, unsigned long startUs) {
+    /* Add the time since startUs to a histogram of a port, times with no port go to the last profile */
+    unsigned long elapsed = micros() - startUs;
+    addLatency(profiles[(portNumber < MAX_PORTS) ? portNumber : MAX_PORTS].events[event], elapsed);
+}
+
+void SpectroDesktop::profileCount(byte portNumber, ProfileCounter counter) {
+    profiles[(portNumber < MAX_PORTS) ? portNumber : MAX_PORTS].counters[counter] += 1;
+}
+
+void SpectroDesktop::serviceProfile() {
+    /* Send the next profile of the round, or start a round every profileFramePeriod */
+    if (profileRoundPort > MAX_PORTS) {
+        if (profileFramePeriod == 0 || millis() - lastProfileRound < profileFramePeriod) {
+            return;
+        }
+        lastProfileRound = millis();
+        profileRoundPort = 0;
     }
-    else if (end_trans == 4) {
-        #if(DEBUG_FLAG)
-            Serial.println("Restarting i2c from end transmission error of 4");
-        #endif
-        _i2cPort->end();
-        _i2cPort->begin();
+    byte index = profileRoundPort;
+    if (index >= portCount()) {
+        index = MAX_PORTS;  // the ports are done, send what was not on a port
+        profileRoundPort = MAX_PORTS + 1;
+    }
+    else {
+        profileRoundPort += 1;
+    }
+    sendProfile(index);
+}
+
+void SpectroDesktop::sendProfile(byte index) {
+    /* Send the profile of a port as a profile frame, or as text in TEXT_OUTPUT */
+    const PortProfile &profile = profiles[index];
+    byte port = (index < MAX_PORTS) ? index : NO_PORT;
+    if (outputMode != TEXT_OUTPUT) {
+        byte buffer[SPECTRO_FRAME_OVERHEAD + PROFILE_PAYLOAD_SIZE];
+        size_t length = encodeProfileFrame(port, profile, buffer, sizeof(buffer));
+        txQueue.write(buffer, length);
+        return;
+    }
+    static const char *const eventNames[PROFILE_EVENTS] = {
+        "mux select", "integration", "readout", "LED", "serial emit"
+    };
+    txQueue.print("Profile of port ");
+    if (port == NO_PORT) {
+        txQueue.println("none");
+    }
+    else {
+        txQueue.println(port);
+    }
+    for (byte e = 0; e < PROFILE_EVENTS; e++) {
+        const LatencyHistogram &histogram = profile.events[e];
+        if (histogram.count == 0) {
+            continue;
+        }
+        txQueue.print("  ");
+        txQueue.print(eventNames[e]);
+        txQueue.print(": ");
+        txQueue.print(histogram.count);
+        txQueue.print(" times, mean ");
+        txQueue.print(histogram.totalUs / histogram.count);
+        txQueue.print(" us, max ");
+        txQueue.print(histogram.maxUs);
+        txQueue.print(" us, buckets");
+        for (byte b = 0; b < PROFILE_BUCKETS; b++) {
+            txQueue.print(" ");
+            txQueue.print(histogram.buckets[b]);
+        }
+        txQueue.println();
     }
+    txQueue.print("  mux verify fails: ");
+    txQueue.print(profile.counters[PROFILE_MUX_VERIFY_FAILS]);
+    txQueue.print(", bus resets: ");
+    txQueue.println(profile.counters[PROFILE_BUS_RESETS]);
+}
+#endif
+
+bool SpectroDesktop::readRegister(byte _addr, byte &value) {
+    /* Read a physical register of the AS726x / AS7265x on the selected port */
+    return (transfer(_i2cPort, AS726X_ADDR, &_addr, 1, &value, 1) == I2C_OK);
+}
+
+bool SpectroDesktop::writeRegister(byte _addr, byte value) {
+    /* Write a physical register of the AS726x / AS7265x on the selected port */
+    byte data[2] = { _addr, value };
+    return (transfer(_i2cPort, AS726X_ADDR, data, sizeof(data)) == I2C_OK);
+}
+
+bool SpectroDesktop::waitForStatus(byte mask, byte state) {
+    /* Poll the status register until the masked bits match state.
+    Return false if the sensor does not respond or times out */
+    unsigned long start = millis();
+    byte status;
+    do {
+        if (!readRegister(AS726X_STATUS_REG, status)) {
+            return false;
+        }
+        if ((status & mask) == state) {
+            return true;
+        }
+    } while (millis() - start < VIRTUAL_REGISTER_TIMEOUT_MS);
+    #if(DEBUG_FLAG)
+        txQueue.println("Virtual register timed out");
+    #endif
     return false;
 }
+
+bool SpectroDesktop::readVirtualRegister(byte virtualAddr, byte &value) {
+    /* Read a virtual register through the sensor's write / read register handshake */
+    byte status;
+    if (!readRegister(AS726X_STATUS_REG, status)) {
+        return false;
+    }
+    if (status & AS726X_RX_VALID) {  // throw away a byte left over so the read is not offset
+        byte discard;
+        readRegister(AS726X_READ_REG, discard);
+    }
+    if (!waitForStatus(AS726X_TX_VALID, 0) ||
+        !writeRegister(AS726X_WRITE_REG, virtualAddr) ||
+        !waitForStatus(AS726X_RX_VALID, AS726X_RX_VALID)) {
+        return false;
+    }
+    return readRegister(AS726X_READ_REG, value);
+}
+
+bool SpectroDesktop::writeVirtualRegister(byte virtualAddr, byte value) {
+    /* Write a virtual register through the sensor's write register handshake */
+    return (waitForStatus(AS726X_TX_VALID, 0) &&
+            writeRegister(AS726X_WRITE_REG, virtualAddr | 0x80) &&
+            waitForStatus(AS726X_TX_VALID, 0) &&
+            writeRegister(AS726X_WRITE_REG, value));
+}
+
+bool SpectroDesktop::readVirtualBlock(byte firstAddr, byte *buffer, byte length) {
+    /* Read length virtual registers in a row starting at firstAddr.  Once a byte has been
+    returned the sensor has taken the last command, so the write register does not need to
+    be checked before asking for the next byte, this is about half the traffic of reading
+    each register with readVirtualRegister() */
+    if (!readVirtualRegister(firstAddr, buffer[0])) {
+        return false;
+    }
+    for (byte i = 1; i < length; i++) {
+        if (!writeRegister(AS726X_WRITE_REG, firstAddr + i) ||
+            !waitForStatus(AS726X_RX_VALID, AS726X_RX_VALID) ||
+            !readRegister(AS726X_READ_REG, buffer[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SpectroDesktop::updateVirtualRegister(byte virtualAddr, byte mask, byte bits) {
+    /* Read a virtual register, replace the bits in mask with bits and write it back */
+    byte value;
+    if (!readVirtualRegister(virtualAddr, value)) {
+        return false;
+    }
+    return writeVirtualRegister(virtualAddr, (value & ~mask) | (bits & mask));
+}
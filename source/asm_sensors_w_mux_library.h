@@ -31,31 +31,276 @@
 #include <SparkFun_Qwiic_Button.h>  // http://librarymanager/All#Sparkfun_Qwiic_Button_Switch
 #include <Wire.h>
 
+// Boards with 2 KB of RAM (the ATmega328P of an Uno or Nano) get short queues and no
+// DELTA_OUTPUT so the library fits beside the Wire and Serial buffers.  Define any of
+// these before including the library to choose for yourself
+#ifndef SMALL_RAM_FLAG
+#if defined(RAMEND) && (RAMEND < 0x1000)
+#define SMALL_RAM_FLAG (1)
+#else
+#define SMALL_RAM_FLAG (0)
+#endif
+#endif
+#if(SMALL_RAM_FLAG)
+#ifndef SPECTRAL_RECORD_QUEUE_SIZE
+#define SPECTRAL_RECORD_QUEUE_SIZE 2
+#endif
+#ifndef SPECTRO_TX_QUEUE_SIZE
+#define SPECTRO_TX_QUEUE_SIZE 128
+#endif
+#endif
+// Set to 0 to leave out DELTA_OUTPUT and the state it keeps for every port (84 bytes each),
+// setOutputMode(DELTA_OUTPUT) then sends whole binary frames
+#ifndef DELTA_FLAG
+#define DELTA_FLAG (!SMALL_RAM_FLAG)
+#endif
+
+#include "spectro_frame.h"
+#include "spectral_record.h"
+#include "sensor_traits.h"
+#include "spectro_delta.h"
+#include "spectro_profile.h"
+#include "spectro_command.h"
+#include "spectro_tx_queue.h"
+
 // Define statements
+// Number of muxes (8 ports each) and I2C buses the port tables are sized for,
+// muxes can be at MUX_ADDR to MUX_ADDR + 7 on each bus
+#ifndef MAX_MUXES
+#define MAX_MUXES 1
+#endif
+#ifndef MAX_I2C_BUSES
+#define MAX_I2C_BUSES 1
+#endif
+#define MAX_PORTS	(MAX_MUXES * 8)
+// Set to 1 to keep the latency histograms and counters of spectro_profile.h for every port,
+// with 0 none of the profiling code is compiled in
+#ifndef PROFILE_FLAG
+#define PROFILE_FLAG (0)
+#endif
 // I2C info
 #define MUX_ADDR	0x70
+#define LAST_MUX_ADDR	0x77
 #define AS726X_ADDR 0x49
 #define BUTTON_ADDR 0x6F
-// SENSOR TYPE
-#define AS7262_CODE 0x3E
-#define AS7263_CODE 0x3F
-#define AS7265X_CODE 0x41
+// Qwiic button status register and its bits
+#define BUTTON_STATUS_REGISTER	0x03
+#define BUTTON_EVENT_AVAILABLE	0x01
+#define BUTTON_CLICKED	0x02
+// SENSOR TYPE: AS7262_CODE, AS7263_CODE and AS7265X_CODE are in sensor_traits.h
 // Sensor register infor
 #define FIRST_CAL_REGISTER	0x14
+#define FIRST_RAW_REGISTER	0x08  // the 6 raw channels, 2 bytes each, end where the calibrated ones start
+#define AS7265X_NIR_DEVICE	0x00  // AS72651, the master device
+#define AS7265X_VISIBLE_DEVICE	0x01  // AS72652
+#define AS7265X_UV_DEVICE	0x02  // AS72653
+// Physical registers used to reach the AS726x / AS7265x virtual registers
+#define AS726X_STATUS_REG	0x00
+#define AS726X_WRITE_REG	0x01
+#define AS726X_READ_REG	0x02
+#define AS726X_TX_VALID	0x02
+#define AS726X_RX_VALID	0x01
+// Virtual registers, same address on the AS7262/AS7263 and AS7265x
+#define CONTROL_SETUP_REGISTER	0x04
+#define INT_TIME_REGISTER	0x05
+#define LED_CONTROL_REGISTER	0x07
+#define DEV_SELECT_REGISTER	0x4F  // AS7265x only, picks which of the 3 devices is read
+// Control setup and LED control register bits
+#define DATA_READY_BIT	0x02
+#define MEASUREMENT_MODE_MASK	0x0C
+#define MEASUREMENT_MODE_ONE_SHOT	0x0C  // mode 3, all 6 channels one shot
+#define LED_DRIVE_ENABLE_BIT	0x08
+#define INDICATOR_ENABLE_BIT	0x01
+#define LED_CURRENT_MASK	0x30
+#define LED_CURRENT_SHIFT	4
+#define GAIN_MASK	0x30
+#define GAIN_SHIFT	4
 // Project constants
-const int MAX_CHANNEL_VALUE = 65000;  // Is this still used?
+// Raw counts above this are treated as saturated by the auto exposure
+const int MAX_CHANNEL_VALUE = 65000;
+// Auto exposure aims for the brightest raw channel to be between these
+const uint16_t AUTO_EXPOSURE_LOW = 30000;
+const uint16_t AUTO_EXPOSURE_TARGET = 45000;
+// Shortest integration time auto exposure lowers to before it lowers the LED current,
+// shorter times only change in steps too big for the target window
+const byte AUTO_EXPOSURE_MIN_TIME = 4;
+// Most trial measurements auto exposure takes to find a setting
+const byte AUTO_EXPOSURE_MAX_TRIALS = 5;
+// Highest LED current setting, 0b11 is 100 mA (0b00 12.5, 0b01 25, 0b10 50 mA)
+const byte MAX_LED_CURRENT = 0b11;
+// Highest gain setting, 0b11 is 64x (0b00 1x, 0b01 3.7x, 0b10 16x)
+const byte MAX_GAIN = 0b11;
+// Gain the SparkFun AS726X / AS7265X begin() leaves the sensor at
+const byte DEFAULT_GAIN = 0b11;
+// Bits of configDirty, settings changed in the shadow that the sensor does not have yet
+const byte CONFIG_INT_TIME = 0x01;
+const byte CONFIG_LED_CURRENT = 0x02;
+const byte CONFIG_GAIN = 0x04;
+const byte CONFIG_MODE = 0x08;
+const byte CONFIG_ALL = 0x0F;
 // sometimes the mux does not respond correctly so check it a few times, times needed: 9,9
 const int MAX_TIMES_CHECK_FOR_MUX = 20;
+// wait between mux checks, doubled after each try up to the max
+const int MUX_CHECK_FIRST_DELAY_MS = 1;
+const int MUX_CHECK_MAX_DELAY_MS = 64;
+// Where the found ports and their settings are saved in EEPROM so begin() can skip the full scan
+#ifndef TOPOLOGY_EEPROM_ADDRESS
+#define TOPOLOGY_EEPROM_ADDRESS 0
+#endif
+const uint16_t TOPOLOGY_MAGIC = 0x5344;
+const byte TOPOLOGY_VERSION = 4;
 // The 3 LSB set if the bulb should be turned on, so 0x01 turns on the AS7262/7263 LED
-// but the AS7265X has 3 bulbs so 0x01 turn on white LED, 0x02 turns on IR LED and 0x04 turns on UV LED
+// but the AS7265X has 3 bulbs so 0x01 turn on white LED, 0x02 turns on UV LED and 0x04 turns on IR LED
 // AND the bits to get multiple LEDs on the AS7265x to turn on
 const int DEFAULT_BULB_ENABLE = 0x07;  
+// Number of channels of each part, AS7265X_CHANNELS is also the most any part has
+const byte AS726X_CHANNELS = AS7262Traits::channels;
+const byte AS7265X_CHANNELS = AS7265XTraits::channels;
+// How long to wait for the sensor to accept or return a virtual register byte
+const int VIRTUAL_REGISTER_TIMEOUT_MS = 50;
+// Time for 1 integration cycle in microseconds, a 6 channel one shot takes 2 integrations
+const long INTEGRATION_CYCLE_US = 2800;
+// Extra time to wait for a measurement past its expected integration before giving up
+const int MEASUREMENT_TIMEOUT_MARGIN_MS = 250;
 // Level of light to turn the button LED on
 const int BUTTON_LED_LIGHT_LEVEL = 25;
+// Virtual register with the hardware type (AS7262_CODE, AS7263_CODE or AS7265X_CODE)
+#define HW_VERSION_REGISTER	0x00
+// With hot plug on, missed checks in a row before a sensor is treated as unplugged
+const byte DEFAULT_HOT_PLUG_MISSES = 3;
+// Hot plug saves the new port setup to EEPROM only after it has not changed for this long,
+// so a loose connector does not wear out the EEPROM
+const unsigned long TOPOLOGY_SAVE_DELAY_MS = 30000;
+// Used for the button interrupt pin when the button interrupt is not connected
+const byte NO_INTERRUPT_PIN = 0xFF;
+// With VERIFY_PERIODIC, number of port selects between reading back the mux settings
+const byte DEFAULT_MUX_VERIFY_PERIOD = 16;
+// With outlier rejection, values are only checked once a channel has this many samples
+const byte OUTLIER_MIN_SAMPLES = 3;
+// Used for the selected port when no port is known to be selected
+const byte NO_PORT = 0xFF;
+// Retries of a failed I2C transaction before the bus is cleared, the first retry waits
+// I2C_RETRY_FIRST_DELAY_US and each one after it twice as long
+const byte I2C_MAX_RETRIES = 2;
+const unsigned int I2C_RETRY_FIRST_DELAY_US = 200;
+// SCL pulses that free a device holding SDA low in the middle of a byte, and half their period (100 kHz)
+const byte I2C_CLEAR_PULSES = 9;
+const unsigned int I2C_CLEAR_HALF_PERIOD_US = 5;
+// Longest a transaction may hang on a stuck bus, with a Wire library that has timeouts
+const unsigned long I2C_TIMEOUT_US = 25000;
+// Used for the SDA / SCL pin of a bus when it is not known, the bus is then only restarted
+const byte NO_BUS_PIN = 0xFF;
+// Reads of the sensor (and button) a port has to pass without an error to use a clock
+const byte CLOCK_TEST_READS = 8;
+// How often a port that was slowed down tries the next faster clock again, 0 never
+const unsigned long DEFAULT_CLOCK_RETEST_MS = 60000;
+// Used for the clock of a bus when it is not known
+const byte NO_CLOCK = 0xFF;
+// Most received characters serviceCommands() reads in 1 call, so a long batch does not hold up the loop
+const byte COMMAND_BYTES_PER_CALL = 64;
+// Most jobs (measurement starts and readouts) serviceScheduler() runs in 1 call
+const byte SCHEDULER_MAX_JOBS = 2 * MAX_PORTS;
+// Jobs whose latest start times are this close are ordered by priority instead
+const long SCHEDULER_TIE_US = 1000;
 
 // Enums and constants
-enum SensorType : byte {
-	NO_SENSOR, AS7262_SENSOR, AS7263_SENSOR, AS7265X_SENSOR
+// 1 bit per port, bit 0 is port 0
+#if MAX_PORTS <= 8
+typedef uint8_t PortMask;
+#elif MAX_PORTS <= 32
+typedef uint32_t PortMask;
+#else
+typedef uint64_t PortMask;
+#endif
+#define PORT_BIT(port)	((PortMask)1 << (port))
+const PortMask ALL_PORTS = (PortMask)~(PortMask)0;
+
+// How readings are sent over the serial port, TEXT_OUTPUT prints readable lines for
+// debugging, BINARY_OUTPUT sends 1 frame per reading (see spectro_frame.h), DELTA_OUTPUT
+// sends keyframes and the changes from the last reading of each port (see spectro_delta.h)
+enum OutputMode : byte {
+	TEXT_OUTPUT, BINARY_OUTPUT, DELTA_OUTPUT
+};
+
+// When enableMuxPort() reads the mux settings back to check the port was set
+// VERIFY_ALWAYS: after every write, VERIFY_ON_ERROR: only if the write was not acknowledged,
+// VERIFY_PERIODIC: also force a write and read back every muxVerifyPeriod selects
+enum MuxVerifyPolicy : byte {
+	VERIFY_ALWAYS, VERIFY_ON_ERROR, VERIFY_PERIODIC
+};
+
+// Called when hot plug finds a sensor plugged in (attached true) or unplugged
+typedef void (*PortEventCallback)(byte portNumber, SensorType type, bool attached);
+
+// What begin() found and how each port is set up, saved in EEPROM
+struct TopologyCache {
+	uint16_t magic;
+	byte version;
+	byte useMux;
+	byte muxCount;
+	byte muxBuses[MAX_MUXES];
+	byte muxAddresses[MAX_MUXES];
+	PortMask buttonPorts;
+	SensorType sensorTypes[MAX_PORTS];
+	byte integrationTimes[MAX_PORTS];
+	byte ledCurrents[MAX_PORTS];
+	byte gains[MAX_PORTS];
+	byte enableBulbs[MAX_PORTS];
+	byte portClocks[MAX_PORTS];  // I2cClock, used when auto clock is on
+	uint16_t crc;  // CRC-16 of everything above
+};
+
+// A mux found on one of the buses, and the port settings last written to it
+struct MuxInfo {
+	byte bus;
+	byte address;
+	byte settings;
+	bool cacheValid;
+};
+
+// Deadline and jitter statistics of the scheduled samples of 1 port.  A sample is released
+// every period and is due when the next one is released, jitter is how long after its
+// release a sample was started
+struct ScheduleStats {
+	unsigned long samples;  // scheduled samples that were read out
+	unsigned long deadlineMisses;  // read out late, timed out or skipped because the last one was still running
+	unsigned long totalJitterMs;  // divide by samples for the mean
+	unsigned long maxJitterMs;
+	unsigned long maxLatenessMs;  // worst time past the deadline a sample was read out
+};
+
+// Result of an I2C transaction, the first 6 are the Wire endTransmission() codes
+enum I2cResult : byte {
+	I2C_OK, I2C_DATA_TOO_LONG, I2C_ADDRESS_NACK, I2C_DATA_NACK, I2C_BUS_ERROR, I2C_TIMEOUT,
+	I2C_NO_DATA  // a read got fewer bytes than asked for
+};
+
+// I2C clocks a port can use, fastest first.  The mux, sensors and button all support
+// 400 kHz, the slower ones are for long cables.  100 kHz is the Wire default
+enum I2cClock : byte {
+	CLOCK_400KHZ, CLOCK_200KHZ, CLOCK_100KHZ, CLOCK_50KHZ,
+	I2C_CLOCK_COUNT  // number of clocks
+};
+
+// Count of the I2C traffic the library puts on the bus, used to benchmark bus cost
+struct BusStats {
+	unsigned long transactions;  // every start condition (write or read request)
+	unsigned long bytesWritten;  // data bytes written, not counting the address byte
+	unsigned long bytesRead;
+	unsigned long errors;  // transactions that failed, including ones a retry fixed
+	unsigned long retries;
+	unsigned long busClears;  // recoveries after the retries failed
+};
+
+// I2C errors of the traffic for 1 port (its mux selection, sensor and button),
+// errors / transactions is the port's error rate
+struct PortErrorStats {
+	unsigned long transactions;
+	unsigned long errors;
+	unsigned long retries;
+	unsigned long busClears;
+	unsigned long clockStepDowns;  // times an error moved the port to a slower clock
+	I2cResult lastError;
 };
 
 class SpectroDesktop {
@@ -65,36 +310,285 @@ public:
 	AS726X as726x;  // treat all as726x the same
 	AS7265X as7265x;  // treat all as7265x the same
 	
-	byte integrationTimes[8] {0, 0, 0, 0, 0, 0, 0, 0};
-	byte ledCurrents[8]{ 0b00, 0b00, 0b00, 0b00, 0b00, 0b00, 0b00, 0b00 };
 	bool begin(TwoWire &wirePort = Wire);
+	bool addBus(TwoWire &wirePort, byte sdaPin = NO_BUS_PIN, byte sclPin = NO_BUS_PIN);
+	void setBusPins(byte bus, byte sdaPin, byte sclPin);
+	byte getPortCount();
+	bool getPortLocation(byte portNumber, byte &bus, byte &muxAddress, byte &channel);
 	void pollButtons();
 	void readSensor(byte portNumber);
+	PortMask readAllSensors(PortMask portMask = ALL_PORTS);
+	PortMask startAcquisition(PortMask portMask);
+	PortMask serviceAcquisition();
+	bool startCapture(byte portNumber, bool subtractDark = true);
+	bool captureSequence(byte portNumber, bool subtractDark = true);
+	bool readCalibratedData(byte portNumber, float *values);
+	bool readRawData(byte portNumber, uint16_t *counts);
+	void setAutoExposure(byte portNumber, bool enable);
+	bool autoExpose(byte portNumber);
+	void setOversampling(byte portNumber, byte samples, float rejectSigma = 0);
+	byte drainRecords(byte maxRecords = 1);
+	void serviceOutput();
+	void flushOutput();
+	TxQueueStats getTxStats();
+	void resetTxStats();
+	byte recordsWaiting();
+	unsigned long droppedRecords();
+	void setOverflowPolicy(OverflowPolicy policy);
 	void readAS7262(byte portNumber);
 	void readAS7263(byte portNumber);
 	void readAS7265x(byte portNumber);
 	void setEnableBulb(byte portNumber, byte newSetting);
 	void setBulbCurrent(byte portNumber, byte newSetting);
 	void setIntTime(byte portNumber, byte newSetting);
+	void setGain(byte portNumber, byte newSetting);
+	byte getIntTime(byte portNumber);
+	byte getBulbCurrent(byte portNumber);
+	byte getGain(byte portNumber);
 	void turnButtonOn(byte portNumber);
 	void turnButtonOff(byte portNumber);
 	void turnIndicatorOn(byte portNumber);
 	void turnIndicatorOff(byte portNumber);
+	void setButtonInterruptPin(byte pin);
+	bool saveTopology();
+	void setHotPlug(bool enable, byte missLimit = DEFAULT_HOT_PLUG_MISSES);
+	void setPortEventCallback(PortEventCallback callback);
+	void rescanStep();
+	void clearTopology();
+	PortMask getButtonPorts();
+	unsigned long getLastButtonLatency();
+	unsigned long getMaxButtonLatency();
+	void setOutputMode(OutputMode mode);
+	void setDeltaEncoding(byte interval, byte decimals);
+	void dumpProfile();
+	void resetProfile();
+	void setProfileFramePeriod(unsigned long periodMs);
+	bool getPortProfile(byte portNumber, PortProfile &profile);
+	void setMuxVerifyPolicy(MuxVerifyPolicy policy, byte period = DEFAULT_MUX_VERIFY_PERIOD);
+	SensorType getPortSensorType(byte portNumber);
+	byte getChannelCount(byte portNumber);
+	uint16_t getWavelength(byte portNumber, byte channel);
+	BusStats getBusStats();
+	void resetBusStats();
+	PortErrorStats getPortErrors(byte portNumber);
+	void setAutoClock(bool enable, unsigned long retestPeriodMs = DEFAULT_CLOCK_RETEST_MS);
+	void tuneClocks();
+	void setPortClock(byte portNumber, I2cClock clock);
+	I2cClock getPortClock(byte portNumber);
+	unsigned long getPortClockHz(byte portNumber);
+	bool setSamplePeriod(byte portNumber, unsigned long periodMs, byte priority = 0);
+	void startScheduler();
+	void stopScheduler();
+	void serviceScheduler();
+	ScheduleStats getScheduleStats(byte portNumber);
+	void resetScheduleStats();
+	void serviceCommands(Stream &stream = Serial);
 
 private:
-	TwoWire *_i2cPort;
+	TwoWire *_i2cPort;  // the bus of the port that is selected
+	TwoWire *buses[MAX_I2C_BUSES];
+	byte sdaPins[MAX_I2C_BUSES];  // for clearing a stuck bus
+	byte sclPins[MAX_I2C_BUSES];
+	byte busCount = 0;
+	TwoWire *buttonBus = nullptr;  // bus the button object is talking to
 	bool useMux = false;  // flag if there is a mux or not
-	SensorType sensorTypeArray[8] {NO_SENSOR, NO_SENSOR, NO_SENSOR, NO_SENSOR, NO_SENSOR, NO_SENSOR, NO_SENSOR, NO_SENSOR};
-	byte enableBulbsArray[8]{ DEFAULT_BULB_ENABLE, DEFAULT_BULB_ENABLE, DEFAULT_BULB_ENABLE, DEFAULT_BULB_ENABLE,
-							  DEFAULT_BULB_ENABLE, DEFAULT_BULB_ENABLE, DEFAULT_BULB_ENABLE, DEFAULT_BULB_ENABLE };
+	MuxInfo muxes[MAX_MUXES];
+	byte muxCount = 0;
+	SensorType sensorTypeArray[MAX_PORTS] {};  // NO_SENSOR for all
+	byte enableBulbsArray[MAX_PORTS];
+	// Shadow of each sensor's settings, written to the sensor by applyConfig() only
+	// when they change (the bulbs are switched for every measurement so are not shadowed)
+	byte integrationTimes[MAX_PORTS] {};
+	byte ledCurrents[MAX_PORTS] {};  // 0b00 for all
+	byte gains[MAX_PORTS];
+	byte configDirty[MAX_PORTS] {};
+	PortMask configSuspect = 0;  // ports on a reset bus, read back before the next measurement
+	void setConfig(byte portNumber, byte *settings, byte value, byte dirtyBit);
+	bool applyConfig(byte portNumber, byte fields = CONFIG_ALL);
+	bool verifyConfig(byte portNumber);
+	byte portCount();
+	bool checkPort(byte portNumber, const char *caller);
+	QwiicButton &portButton();
+	void findMuxes();
 	SensorType getSensorType(byte channel);
-	void getAS7262Data();
-	void getAS7263Data();
-	void getAS7265xData();
+	bool checkForMux(byte maxTimes);
+	bool scanPorts();
+	bool loadTopology(TopologyCache &cache);
+	bool restoreTopology(const TopologyCache &cache);
+	void fillTopology(TopologyCache &cache);
+	bool configureSensor(byte portNumber);
+	// hot plug checks 1 port each pollButtons(), going around all of them
+	bool hotPlug = false;
+	byte hotPlugMissLimit = DEFAULT_HOT_PLUG_MISSES;
+	byte rescanPort = 0;
+	byte missCounts[MAX_PORTS] {};
+	bool topologyUnsaved = false;  // hot plug changed the ports since the last saveTopology()
+	unsigned long topologyChangedAt = 0;
+	void topologyChanged();
+	PortEventCallback portEventCallback = nullptr;
+	void attachPort(byte portNumber);
+	void detachPort(byte portNumber);
+	// ports found with a Qwiic button, and the pin all the button interrupts are wired to
+	PortMask buttonPorts = 0;
+	byte buttonInterruptPin = NO_INTERRUPT_PIN;
+	// time from a button status read seeing a click to the measurement starting
+	unsigned long lastButtonLatency = 0;
+	unsigned long maxButtonLatency = 0;
+	bool readButtonStatus(byte &status);
+	bool clearButtonEvents();
+	byte serviceButtons();
+	// ports with a one shot measurement running, and when to check / give up on them
+	PortMask pendingPorts = 0;
+	PortMask reportedPorts = 0;
+	unsigned long readyAt[MAX_PORTS];
+	unsigned long deadlineAt[MAX_PORTS];
+	bool startMeasurement(byte portNumber);
+	bool startOneShot(byte portNumber);
+	void finishMeasurement(byte portNumber);
+	bool servicePort(byte portNumber, unsigned long now);
+	// the capture sequence running, 1 port at a time: the bulbs of the frame integrating, the
+	// bulbs still to capture 1 at a time, and the dark frame taken off the lit frames
+	byte capturePort = NO_PORT;
+	byte captureBulbs = 0;
+	byte captureRemaining = 0;
+	bool captureSubtractDark = true;
+	bool captureComplete = false;
+	uint16_t captureSequenceNumber = 0;
+	float captureDark[AS7265X_CHANNELS];
+	bool startCaptureFrame(byte portNumber, byte bulbs);
+	void finishCaptureFrame(byte portNumber);
+	bool queueCaptureFrame(byte portNumber, byte bulbs);
+	void endCapture();
+	// sample period (0 for not scheduled) and priority of each port, when its next sample
+	// is released and when the running one is due, ports with a scheduled sample running
+	bool schedulerRunning = false;
+	unsigned long samplePeriods[MAX_PORTS] {};
+	byte samplePriorities[MAX_PORTS] {};
+	unsigned long nextRelease[MAX_PORTS];
+	unsigned long sampleDeadline[MAX_PORTS];
+	PortMask scheduledPorts = 0;
+	ScheduleStats scheduleStats[MAX_PORTS] {};
+	// measured bus time of a mux switch and of reading out each port, used to order the jobs
+	unsigned long muxSwitchUs = 0;
+	unsigned long readoutUs[MAX_PORTS] {};
+	bool nextJob(unsigned long now, PortMask skip, byte &portNumber, bool &readout);
+	void releaseSample(byte portNumber, unsigned long now);
+	void finishSample(byte portNumber, unsigned long now, bool readOut);
+	OutputMode outputMode = TEXT_OUTPUT;
+	// last frame of each port sent with DELTA_OUTPUT, and how the deltas are made
+#if(DELTA_FLAG)
+	SpectroDeltaState deltaStates[MAX_PORTS];
+#endif
+	byte keyframeInterval = SPECTRO_DEFAULT_KEYFRAME_INTERVAL;
+	byte deltaDecimals = SPECTRO_DEFAULT_DECIMALS;
+	void resetDeltaStates();
+	SpectroCommandParser commandParser {};
+	SpectroCommandStatus runCommand(const SpectroCommand &command);
+	void sendAck(uint16_t sequence, SpectroCommandStatus status);
+	void printStats();
+	uint16_t frameSequence = 0;
+	SpectralRecordQueue records;
+	SpectroTxQueue txQueue;  // everything the library prints goes through this to Serial
+	bool queueReading(byte portNumber, uint16_t *counts = nullptr);
+	void emitRecord(const SpectralRecord &record);
+	void printRecord(const SpectralRecord &record);
+	void sendRecordFrame(const SpectralRecord &record);
+	unsigned long measurementTime(byte portNumber);
+	bool setBulbs(byte portNumber, bool turnOn);
+	bool switchBulbs(byte portNumber, byte bulbs, bool turnOn);
+	// ports using auto exposure, and the ones that have found a good setting
+	PortMask autoExposurePorts = 0;
+	PortMask exposedPorts = 0;
+	bool adjustExposure(byte portNumber, uint16_t peak);
+	bool measureRaw(byte portNumber, uint16_t *counts);
+	// measurements readSensor() averages on each port (0 or 1 for single readings), and how many
+	// standard deviations from the mean a value can be before it is rejected (0 keeps all values)
+	byte oversampleCounts[MAX_PORTS] {};
+	float rejectSigmas[MAX_PORTS] {};
+	bool oversample(byte portNumber);
+	bool waitForData(byte portNumber);
+	void fillRecord(SpectralRecord &record, byte portNumber);
+	bool readRegister(byte _addr, byte &value);
+	bool writeRegister(byte _addr, byte value);
+	bool waitForStatus(byte mask, byte state);
+	bool readVirtualRegister(byte virtualAddr, byte &value);
+	bool writeVirtualRegister(byte virtualAddr, byte value);
+	bool updateVirtualRegister(byte virtualAddr, byte mask, byte bits);
+	bool readVirtualBlock(byte firstAddr, byte *buffer, byte length);
+	bool readCalibratedBlock(SensorType type, float *values, uint16_t *counts = nullptr);
+	bool readRawBlock(SensorType type, uint16_t *counts);
+	// what the generic functions below need at run time for each sensor type,
+	// drivers is indexed by SensorType (see sensor_traits.h)
+	struct SensorDriver {
+		byte hardwareCode;
+		byte channels;
+		byte bulbs;
+		byte decimals;
+		byte defaultIntegration;
+		const char *name;
+		uint16_t (*wavelength)(uint8_t channel);
+		bool (SpectroDesktop::*readCalibrated)(float *values, uint16_t *counts);
+		bool (SpectroDesktop::*readRaw)(uint16_t *counts);
+		bool (SpectroDesktop::*driveBulbs)(byte bulbs, bool turnOn);
+		bool (SpectroDesktop::*updateDevices)(byte virtualAddr, byte mask, byte bits);
+	};
+	static const SensorDriver drivers[SENSOR_TYPE_COUNT];
+	static const SensorDriver *driverFor(SensorType type);
+	static SensorType typeFromHardwareCode(byte hardwareCode);
+	template <class Traits> bool readCalibratedChannels(float *values, uint16_t *counts);
+	template <class Traits> bool readRawChannels(uint16_t *counts);
+	template <class Traits> bool driveBulbs(byte bulbs, bool turnOn);
+	template <class Traits> bool updateDevices(byte virtualAddr, byte mask, byte bits);
 	bool enableMuxPort(byte portNumber);
-	byte getMuxSettings();
-	bool sendMuxSettings(byte _settings);
+	bool selectMuxPort(byte portNumber);
+	byte selectedPort = NO_PORT;
+	I2cResult getMuxSettings(byte mux, byte &settings);
+	bool sendMuxSettings(byte mux, byte _settings);
 	bool checkI2cAddress(byte _addr);
+	// when enableMuxPort() reads the mux back to check the cached settings
+	MuxVerifyPolicy muxVerifyPolicy = VERIFY_ON_ERROR;
+	byte muxVerifyPeriod = DEFAULT_MUX_VERIFY_PERIOD;
+	byte muxSelectsSinceVerify = 0;
+	void invalidateMuxCache();
+	BusStats busStats {};
+	PortErrorStats portErrors[MAX_PORTS] {};
+	byte transferPort = NO_PORT;  // port the bus traffic is for, even before its mux is set
+	bool recovering = false;  // a bus is being recovered, its transactions are not recovered again
+	void countTransaction(byte bytesWritten, byte bytesRead, I2cResult result);
+	I2cResult transfer(TwoWire *bus, byte address, const byte *data, byte length,
+	                   byte *received = nullptr, byte receiveLength = 0);
+	I2cResult tryTransfer(TwoWire *bus, byte address, const byte *data, byte length,
+	                      byte *received, byte receiveLength);
+	void recoverBus(TwoWire *bus);
+	void setBusTimeout(TwoWire *bus);
+	// clock of each port, set on its bus when the port is selected, and the clock each bus is at.
+	// With auto clock a failed transaction moves the port to a slower clock and a slowed port
+	// tries the next faster one every clockRetestPeriod, 1 port at a time
+	byte portClocks[MAX_PORTS];
+	byte busClocks[MAX_I2C_BUSES];
+	bool autoClock = false;
+	unsigned long clockRetestPeriod = DEFAULT_CLOCK_RETEST_MS;
+	unsigned long lastClockRetest = 0;
+	byte clockRetestPort = 0;
+	void applyPortClock(byte portNumber);
+	void setBusClock(byte bus, byte clock);
+	bool slowPortClock(byte portNumber);
+	bool testPortClock(byte portNumber);
+	void tunePortClock(byte portNumber, byte fastest);
+	void retestClockStep();
+#if(PROFILE_FLAG)
+	// profile of each port, the last one is for what did not happen on a port
+	PortProfile profiles[MAX_PORTS + 1] {};
+	unsigned long oneShotStartUs[MAX_PORTS];
+	// profiles are sent 1 port per drainRecords() call, every profileFramePeriod
+	unsigned long profileFramePeriod = 0;
+	unsigned long lastProfileRound = 0;
+	byte profileRoundPort = MAX_PORTS + 1;  // past the last profile when no round is running
+	void profileTime(byte portNumber, ProfileEvent event, unsigned long startUs);
+	void profileCount(byte portNumber, ProfileCounter counter);
+	void serviceProfile();
+	void sendProfile(byte index);
+#endif
 };
 
 #endif
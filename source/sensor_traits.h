@@ -0,0 +1,99 @@
+/*
+  Compile time description of each spectral sensor the library can read.
+  The generic read functions in SpectroDesktop are instantiated once per
+  traits struct, so a new AS7xxx part is added by writing a traits struct
+  for it and adding it to the driver table in asm_sensors_w_mux_library.cpp.
+
+  Every part is read through the same virtual registers, a part with more
+  than 1 device (the AS7265x) has each device selected in turn and its
+  channels put back in wavelength order.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#ifndef _SENSOR_TRAITS_H
+#define _SENSOR_TRAITS_H
+
+#include <stdint.h>
+
+enum SensorType : uint8_t {
+	NO_SENSOR, AS7262_SENSOR, AS7263_SENSOR, AS7265X_SENSOR
+};
+// Hardware version code each sensor type reports
+#define AS7262_CODE 0x3E
+#define AS7263_CODE 0x3F
+#define AS7265X_CODE 0x41
+// Number of sensor types, including NO_SENSOR
+const uint8_t SENSOR_TYPE_COUNT = 4;
+
+// Channels on each device, the AS726x parts are 1 device
+const uint8_t CHANNELS_PER_DEVICE = 6;
+
+// Center wavelength (nm) of each channel, in the order the channels are reported
+constexpr uint16_t AS7262_WAVELENGTHS[6] = { 450, 500, 550, 570, 600, 650 };
+constexpr uint16_t AS7263_WAVELENGTHS[6] = { 610, 680, 730, 760, 810, 860 };
+constexpr uint16_t AS7265X_WAVELENGTHS[18] = {
+	410, 435, 460, 485, 510, 535,  // A, B, C, D, E, F
+	560, 585, 610, 645, 680, 705,  // G, H, R, I, S, J
+	730, 760, 810, 860, 900, 940  // T, U, V, W, K, L
+};
+// Where each reported AS7265x channel is in the device by device read (device * 6 + channel)
+constexpr uint8_t AS7265X_CHANNEL_SOURCE[18] = {
+	12, 13, 14, 15, 16, 17,  // A, B, C, D, E, F from the UV device
+	6, 7, 0, 8, 1, 9,  // G, H, R, I, S, J
+	2, 3, 4, 5, 10, 11  // T, U, V, W, K, L
+};
+// DEV_SELECT value of each AS7265x device in the order they are read, NIR (master), visible, UV
+constexpr uint8_t AS7265X_DEVICE_IDS[3] = { 0x00, 0x01, 0x02 };
+// Device driving each AS7265x bulb bit: 0x01 white (NIR device), 0x02 UV, 0x04 IR (visible device)
+constexpr uint8_t AS7265X_BULB_DEVICES[3] = { 0x00, 0x02, 0x01 };
+
+struct AS7262Traits {
+	static constexpr SensorType type = AS7262_SENSOR;
+	static constexpr uint8_t hardwareCode = AS7262_CODE;
+	static constexpr uint8_t devices = 1;
+	static constexpr uint8_t channels = 6;
+	static constexpr uint8_t bulbs = 0x01;  // bulb bits the part has
+	static constexpr uint8_t decimals = 4;  // decimal places the channels are printed with
+	static constexpr uint8_t defaultIntegration = 200;
+	static constexpr const char *name() { return "AS7262"; }
+	static constexpr uint8_t deviceId(uint8_t) { return 0; }
+	static constexpr uint8_t bulbDevice(uint8_t) { return 0; }
+	static constexpr uint8_t channelSource(uint8_t channel) { return channel; }
+	static constexpr uint16_t wavelength(uint8_t channel) { return AS7262_WAVELENGTHS[channel]; }
+};
+
+struct AS7263Traits {
+	static constexpr SensorType type = AS7263_SENSOR;
+	static constexpr uint8_t hardwareCode = AS7263_CODE;
+	static constexpr uint8_t devices = 1;
+	static constexpr uint8_t channels = 6;
+	static constexpr uint8_t bulbs = 0x01;
+	static constexpr uint8_t decimals = 4;
+	static constexpr uint8_t defaultIntegration = 200;
+	static constexpr const char *name() { return "AS7263"; }
+	static constexpr uint8_t deviceId(uint8_t) { return 0; }
+	static constexpr uint8_t bulbDevice(uint8_t) { return 0; }
+	static constexpr uint8_t channelSource(uint8_t channel) { return channel; }
+	static constexpr uint16_t wavelength(uint8_t channel) { return AS7263_WAVELENGTHS[channel]; }
+};
+
+struct AS7265XTraits {
+	static constexpr SensorType type = AS7265X_SENSOR;
+	static constexpr uint8_t hardwareCode = AS7265X_CODE;
+	static constexpr uint8_t devices = 3;
+	static constexpr uint8_t channels = 18;
+	static constexpr uint8_t bulbs = 0x07;
+	static constexpr uint8_t decimals = 2;
+	static constexpr uint8_t defaultIntegration = 200;
+	static constexpr const char *name() { return "AS7265x"; }
+	static constexpr uint8_t deviceId(uint8_t device) { return AS7265X_DEVICE_IDS[device]; }
+	static constexpr uint8_t bulbDevice(uint8_t bulb) { return AS7265X_BULB_DEVICES[bulb]; }
+	static constexpr uint8_t channelSource(uint8_t channel) { return AS7265X_CHANNEL_SOURCE[channel]; }
+	static constexpr uint16_t wavelength(uint8_t channel) { return AS7265X_WAVELENGTHS[channel]; }
+};
+
+#endif
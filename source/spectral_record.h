@@ -0,0 +1,89 @@
+/*
+  Fixed size queue of spectral readings so taking measurements does not
+  have to wait for the serial port.  The records are stored in a statically
+  allocated ring, nothing is allocated at run time.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#ifndef _SPECTRAL_RECORD_H
+#define _SPECTRAL_RECORD_H
+
+#include <stdint.h>
+#include "spectro_frame.h"
+
+// Number of readings that can wait to be sent, each record is 92 bytes
+#ifndef SPECTRAL_RECORD_QUEUE_SIZE
+#define SPECTRAL_RECORD_QUEUE_SIZE 4
+#endif
+
+struct SpectralRecord {
+	uint8_t port;
+	uint8_t sensorType;
+	uint32_t timestamp;  // millis() when the data was read
+	uint16_t sequence;  // counts every reading, gaps show readings that were dropped
+	uint8_t integrationTime;
+	uint8_t ledCurrent;
+	uint8_t bulbMask;  // bulbs enabled on the port, or for a capture frame the bulbs that were on
+	uint8_t channelCount;
+	uint8_t kind;  // RECORD_READING, which statistic of an oversampled reading or which capture frame this is
+	uint8_t sampleCount;  // measurements in an oversampled reading, 1 for a reading
+	uint8_t rejectedCount;  // channel values left out as outliers
+	float channels[SPECTRO_FRAME_MAX_CHANNELS];
+};
+
+// What to do with a new reading when the queue is full
+// DROP_OLDEST: overwrite the oldest reading, DROP_NEWEST: throw away the new reading,
+// BLOCK_WHEN_FULL: the caller sends queued readings until there is room
+enum OverflowPolicy : uint8_t {
+	DROP_OLDEST, DROP_NEWEST, BLOCK_WHEN_FULL
+};
+
+class SpectralRecordQueue {
+public:
+	OverflowPolicy policy = DROP_OLDEST;
+	unsigned long droppedRecords = 0;
+
+	SpectralRecord *beginWrite() {
+		/* Get the slot for the next record, fill it in and call commitWrite().
+		Returns nullptr if the queue is full and the policy does not overwrite */
+		if (count == SPECTRAL_RECORD_QUEUE_SIZE) {
+			if (policy != DROP_OLDEST) {
+				if (policy == DROP_NEWEST) {
+					droppedRecords += 1;
+				}
+				return nullptr;
+			}
+			pop();
+			droppedRecords += 1;
+		}
+		return &records[head];
+	}
+	void commitWrite() {
+		head = (head + 1) % SPECTRAL_RECORD_QUEUE_SIZE;
+		count += 1;
+	}
+	const SpectralRecord *peek() const {
+		return (count == 0) ? nullptr : &records[tail];
+	}
+	void pop() {
+		if (count == 0) {
+			return;
+		}
+		tail = (tail + 1) % SPECTRAL_RECORD_QUEUE_SIZE;
+		count -= 1;
+	}
+	uint8_t size() const { return count; }
+	bool full() const { return count == SPECTRAL_RECORD_QUEUE_SIZE; }
+
+private:
+	SpectralRecord records[SPECTRAL_RECORD_QUEUE_SIZE];
+	uint8_t head = 0;
+	uint8_t tail = 0;
+	uint8_t count = 0;
+};
+
+#endif
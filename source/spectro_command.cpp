@@ -0,0 +1,212 @@
+/*
+  Text command parser, see spectro_command.h for the commands.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include "spectro_command.h"
+
+// Name and number of arguments (not counting the port) of each command
+struct CommandInfo {
+    const char *name;
+    SpectroOpcode opcode;
+    bool hasPort;
+    uint8_t minArgs;
+    uint8_t maxArgs;
+};
+
+static const CommandInfo COMMANDS[] = {
+    { "INT", COMMAND_INT, true, 1, 1 },
+    { "LED", COMMAND_LED, true, 1, 1 },
+    { "GAIN", COMMAND_GAIN, true, 1, 1 },
+    { "BULB", COMMAND_BULB, true, 1, 1 },
+    { "READ", COMMAND_READ, true, 0, 0 },
+    { "SWEEP", COMMAND_SWEEP, false, 0, 0 },
+    { "PERIOD", COMMAND_PERIOD, true, 1, 2 },
+    { "START", COMMAND_START, false, 0, 0 },
+    { "STOP", COMMAND_STOP, false, 0, 0 },
+    { "STATS", COMMAND_STATS, false, 0, 0 },
+    { "CAPTURE", COMMAND_CAPTURE, true, 0, 1 }
+};
+
+static bool isSeparator(char c) {
+    return c == ' ' || c == '\t' || c == ',';
+}
+
+static char upperCase(char c) {
+    return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+}
+
+static bool nextToken(const char *text, uint8_t length, uint8_t &position, uint8_t &start, uint8_t &size) {
+    /* Find the next token at or after position and move position past it.
+    Return false if there are no more */
+    while (position < length && isSeparator(text[position])) {
+        position++;
+    }
+    start = position;
+    while (position < length && !isSeparator(text[position])) {
+        position++;
+    }
+    size = position - start;
+    return size > 0;
+}
+
+static bool parseNumber(const char *token, uint8_t size, uint32_t &value) {
+    /* Read a decimal or 0x hexadecimal number, return false if it is not one or is over 32 bits */
+    uint8_t base = 10;
+    uint8_t i = 0;
+    if (size > 2 && token[0] == '0' && upperCase(token[1]) == 'X') {
+        base = 16;
+        i = 2;
+    }
+    value = 0;
+    for (; i < size; i++) {
+        char c = upperCase(token[i]);
+        uint8_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        }
+        else if (base == 16 && c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        }
+        else {
+            return false;
+        }
+        if (value > (0xFFFFFFFFUL - digit) / base) {
+            return false;
+        }
+        value = value * base + digit;
+    }
+    return true;
+}
+
+static bool sameName(const char *token, uint8_t size, const char *name) {
+    uint8_t i = 0;
+    for (; i < size && name[i] != '\0'; i++) {
+        if (upperCase(token[i]) != name[i]) {
+            return false;
+        }
+    }
+    return i == size && name[i] == '\0';
+}
+
+static SpectroCommandStatus parseCommand(const char *text, uint8_t length, SpectroCommand &command) {
+    /* Fill in command from the text of 1 command, the sequence number is filled in
+    even if the rest of it is bad */
+    uint8_t position = 0;
+    uint8_t start;
+    uint8_t size;
+    uint32_t value;
+    command.sequence = 0;
+    command.opcode = COMMAND_NONE;
+    command.port = SPECTRO_COMMAND_ALL_PORTS;
+    command.argCount = 0;
+    if (!nextToken(text, length, position, start, size)) {
+        return COMMAND_UNKNOWN;
+    }
+    if (parseNumber(&text[start], size, value)) {
+        if (value > 0xFFFF) {
+            return COMMAND_BAD_ARGUMENTS;
+        }
+        command.sequence = value;
+        if (!nextToken(text, length, position, start, size)) {
+            return COMMAND_UNKNOWN;
+        }
+    }
+    const CommandInfo *info = nullptr;
+    for (uint8_t i = 0; i < sizeof(COMMANDS) / sizeof(COMMANDS[0]); i++) {
+        if (sameName(&text[start], size, COMMANDS[i].name)) {
+            info = &COMMANDS[i];
+        }
+    }
+    if (info == nullptr) {
+        return COMMAND_UNKNOWN;
+    }
+    command.opcode = info->opcode;
+    if (info->hasPort) {
+        if (!nextToken(text, length, position, start, size)) {
+            return COMMAND_BAD_ARGUMENTS;
+        }
+        if (!(size == 1 && text[start] == '*')) {
+            if (!parseNumber(&text[start], size, value) || value >= SPECTRO_COMMAND_ALL_PORTS) {
+                return COMMAND_BAD_PORT;
+            }
+            command.port = value;
+        }
+    }
+    while (nextToken(text, length, position, start, size)) {
+        if (command.argCount == info->maxArgs || !parseNumber(&text[start], size, value)) {
+            return COMMAND_BAD_ARGUMENTS;
+        }
+        command.args[command.argCount++] = value;
+    }
+    if (command.argCount < info->minArgs) {
+        return COMMAND_BAD_ARGUMENTS;
+    }
+    return COMMAND_OK;
+}
+
+void resetCommandParser(SpectroCommandParser &parser) {
+    parser.length = 0;
+    parser.overflow = false;
+}
+
+bool feedCommandParser(SpectroCommandParser &parser, char c, SpectroCommand &command,
+                       SpectroCommandStatus &status) {
+    /* Add 1 received character to the command being received.
+    Returns true when it ends a command, then command and status (COMMAND_OK if the
+    command can be run) are filled in.  Empty commands are skipped */
+    if (c != '\n' && c != ';') {
+        if (c == '\r') {
+            return false;
+        }
+        if (parser.length < SPECTRO_COMMAND_MAX_LENGTH) {
+            parser.text[parser.length++] = c;
+        }
+        else {
+            parser.overflow = true;
+        }
+        return false;
+    }
+    uint8_t position = 0;
+    uint8_t start;
+    uint8_t size;
+    bool empty = !nextToken(parser.text, parser.length, position, start, size);
+    if (empty && !parser.overflow) {
+        resetCommandParser(parser);
+        return false;
+    }
+    status = parseCommand(parser.text, parser.length, command);
+    if (parser.overflow) {
+        status = COMMAND_TOO_LONG;
+    }
+    resetCommandParser(parser);
+    return true;
+}
+
+const char *commandStatusName(SpectroCommandStatus status) {
+    switch (status) {
+        case COMMAND_OK: return "OK";
+        case COMMAND_UNKNOWN: return "UNKNOWN";
+        case COMMAND_BAD_ARGUMENTS: return "BAD_ARGUMENTS";
+        case COMMAND_TOO_LONG: return "TOO_LONG";
+        case COMMAND_BAD_PORT: return "BAD_PORT";
+        default: return "FAILED";
+    }
+}
+
+size_t encodeAckFrame(uint16_t sequence, SpectroCommandStatus status, uint8_t *buffer, size_t bufferSize) {
+    /* Make an ack frame answering a command, the payload is built in place in buffer.
+    Returns the number of bytes in the frame or 0 if buffer is too small */
+    if ((size_t)SPECTRO_ACK_PAYLOAD_SIZE + SPECTRO_FRAME_OVERHEAD > bufferSize) {
+        return 0;
+    }
+    uint8_t *payload = &buffer[4];
+    payload[0] = sequence & 0xFF;
+    payload[1] = sequence >> 8;
+    payload[2] = status;
+    return encodeSpectroFrame(SPECTRO_FRAME_ACK, payload, SPECTRO_ACK_PAYLOAD_SIZE, buffer, bufferSize);
+}
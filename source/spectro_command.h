@@ -0,0 +1,82 @@
+/*
+  Parser for the text commands the host sends to change settings and start
+  readings while the sketch runs.  The parser is fed 1 character at a time so
+  it never waits for the rest of a line, and like spectro_frame.h it does not
+  use any Arduino code.
+
+  A command is an optional sequence number (0 to 65535), a name and its
+  arguments, separated by spaces or commas.  Commands end with a newline or
+  ';' so a batch of them can be sent on 1 line, e.g.
+    1 INT 3 100; 2 LED 3 2; 3 BULB * 0x07; 4 SWEEP
+  A port of '*' is every port.  Names are not case sensitive.
+
+    INT port cycles          integration time, 2.8 ms cycles (1 to 255)
+    LED port current         LED current, 0 (12.5 mA) to 3 (100 mA)
+    GAIN port gain           gain, 0 (1x) to 3 (64x)
+    BULB port mask           bulbs turned on for a reading (0x01 white, 0x02 UV, 0x04 IR)
+    READ port                start a reading of 1 port
+    SWEEP                    start a reading of every port
+    PERIOD port ms [prio]    scheduled sample period of a port, 0 takes it off the schedule
+    START                    start the scheduled sampling
+    STOP                     stop the scheduled sampling
+    STATS                    send the bus, schedule and profile statistics
+    CAPTURE port [subtract]  start a dark, then 1 frame per enabled bulb capture (1 port),
+                             the dark frame is taken off the others unless subtract is 0
+
+  Every command is answered with its sequence number (0 if it had none),
+  "ACK seq" if it was done or "NAK seq reason" if not.  With binary output the
+  answer is an ack frame instead, payload (SPECTRO_FRAME_ACK):
+    sequence (2 bytes, little endian) | SpectroCommandStatus
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#ifndef _SPECTRO_COMMAND_H
+#define _SPECTRO_COMMAND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "spectro_frame.h"
+
+// Longest command kept, the characters past this are dropped and the command is refused
+const uint8_t SPECTRO_COMMAND_MAX_LENGTH = 32;
+const uint8_t SPECTRO_COMMAND_MAX_ARGS = 2;  // not counting the port
+// Port given as '*', and the port of the commands that do not take one
+const uint8_t SPECTRO_COMMAND_ALL_PORTS = 0xFF;
+const uint8_t SPECTRO_ACK_PAYLOAD_SIZE = 3;
+
+enum SpectroOpcode : uint8_t {
+	COMMAND_NONE, COMMAND_INT, COMMAND_LED, COMMAND_GAIN, COMMAND_BULB, COMMAND_READ,
+	COMMAND_SWEEP, COMMAND_PERIOD, COMMAND_START, COMMAND_STOP, COMMAND_STATS, COMMAND_CAPTURE
+};
+
+enum SpectroCommandStatus : uint8_t {
+	COMMAND_OK, COMMAND_UNKNOWN, COMMAND_BAD_ARGUMENTS, COMMAND_TOO_LONG, COMMAND_BAD_PORT,
+	COMMAND_FAILED
+};
+
+struct SpectroCommand {
+	uint16_t sequence;
+	SpectroOpcode opcode;
+	uint8_t port;
+	uint8_t argCount;
+	uint32_t args[SPECTRO_COMMAND_MAX_ARGS];
+};
+
+// Characters of the command being received
+struct SpectroCommandParser {
+	char text[SPECTRO_COMMAND_MAX_LENGTH];
+	uint8_t length;
+	bool overflow;
+};
+
+void resetCommandParser(SpectroCommandParser &parser);
+bool feedCommandParser(SpectroCommandParser &parser, char c, SpectroCommand &command,
+                       SpectroCommandStatus &status);
+const char *commandStatusName(SpectroCommandStatus status);
+size_t encodeAckFrame(uint16_t sequence, SpectroCommandStatus status, uint8_t *buffer, size_t bufferSize);
+
+#endif
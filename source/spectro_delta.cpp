@@ -0,0 +1,228 @@
+/*
+  Delta compression of the readings of each port,
+  see spectro_delta.h for the frame layouts.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include "spectro_delta.h"
+#include <math.h>
+#include <string.h>
+
+static void putUint16(uint8_t *buffer, uint16_t value) {
+    buffer[0] = value & 0xFF;
+    buffer[1] = value >> 8;
+}
+
+static void putUint32(uint8_t *buffer, uint32_t value) {
+    for (uint8_t i = 0; i < 4; i++) {
+        buffer[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint32_t getUint32(const uint8_t *buffer) {
+    return (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) |
+           ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
+
+static uint8_t putVarint(uint8_t *buffer, uint32_t value) {
+    /* Write value 7 bits at a time, low bits first, with the top bit set on all but
+    the last byte.  Returns the number of bytes written */
+    uint8_t size = 0;
+    while (value >= 0x80) {
+        buffer[size++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buffer[size++] = value;
+    return size;
+}
+
+static bool getVarint(const uint8_t *payload, uint8_t length, uint8_t &position, uint32_t &value) {
+    /* Read a varint starting at position and move position past it.
+    Return false if it runs past the end of the payload or is too long */
+    value = 0;
+    for (uint8_t shift = 0; shift < 7 * SPECTRO_MAX_VARINT_SIZE; shift += 7) {
+        if (position >= length) {
+            return false;
+        }
+        uint8_t data = payload[position++];
+        value |= (uint32_t)(data & 0x7F) << shift;
+        if (!(data & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t zigzag(int32_t value) {
+    /* Map signed to unsigned so small changes either way are small: 0, -1, 1, -2 ... -> 0, 1, 2, 3 ... */
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static float decimalScale(uint8_t decimals) {
+    float scale = 1;
+    for (uint8_t i = 0; i < decimals; i++) {
+        scale *= 10;
+    }
+    return scale;
+}
+
+static int32_t quantize(float value, float scale) {
+    /* Round value * scale to the nearest integer, clamped to 32 bits */
+    float scaled = floor(value * scale + 0.5f);
+    if (scaled >= 2147483520.0f) {  // largest float below 2^31
+        return INT32_MAX;
+    }
+    if (scaled <= -2147483648.0f || scaled != scaled) {  // NaN goes to the minimum as well
+        return INT32_MIN;
+    }
+    return (int32_t)scaled;
+}
+
+void resetDeltaState(SpectroDeltaState &state) {
+    /* Forget the last frame so the next one is (or has to be) a keyframe */
+    state.valid = false;
+    state.frameCount = 0;
+    state.sinceKeyframe = 0;
+}
+
+size_t encodeDeltaFrame(const SpectroFrame &frame, SpectroDeltaState &state, uint8_t keyframeInterval,
+                        uint8_t decimals, uint8_t *buffer, size_t bufferSize) {
+    /* Make a keyframe or delta frame from a reading of the port state belongs to.
+    A keyframe is sent for the first frame, every keyframeInterval frames (0 or 1 sends
+    only keyframes) and when the sensor type, channel count or decimals change.
+    The payload is built in place in buffer.
+    Returns the number of bytes in the frame or 0 if buffer is too small */
+    if (frame.channelCount > SPECTRO_FRAME_MAX_CHANNELS || decimals > SPECTRO_MAX_DECIMALS) {
+        return 0;
+    }
+    size_t maxLength = SPECTRO_KEY_HEADER_SIZE + (size_t)SPECTRO_MAX_VARINT_SIZE * frame.channelCount;
+    if (maxLength + SPECTRO_FRAME_OVERHEAD > bufferSize) {
+        return 0;
+    }
+    bool keyframe = (!state.valid || state.sensorType != frame.sensorType ||
+                     state.channelCount != frame.channelCount || state.decimals != decimals ||
+                     state.sinceKeyframe + 1 >= keyframeInterval);
+    float scale = decimalScale(decimals);
+    uint8_t *payload = &buffer[4];
+    uint8_t length;
+    state.frameCount++;
+    if (keyframe) {
+        payload[0] = frame.port;
+        payload[1] = frame.sensorType;
+        putUint32(&payload[2], frame.timestamp);
+        putUint16(&payload[6], frame.sequence);
+        payload[8] = frame.channelCount;
+        payload[9] = decimals;
+        payload[10] = state.frameCount;
+        length = SPECTRO_KEY_HEADER_SIZE;
+        for (uint8_t i = 0; i < frame.channelCount; i++) {
+            state.values[i] = quantize(frame.channels[i], scale);
+            length += putVarint(&payload[length], zigzag(state.values[i]));
+        }
+        state.valid = true;
+        state.sensorType = frame.sensorType;
+        state.channelCount = frame.channelCount;
+        state.decimals = decimals;
+        state.sinceKeyframe = 0;
+    }
+    else {
+        payload[0] = frame.port;
+        payload[1] = state.frameCount;
+        putUint16(&payload[2], frame.sequence);
+        length = SPECTRO_DELTA_HEADER_SIZE;
+        length += putVarint(&payload[length], frame.timestamp - state.timestamp);
+        for (uint8_t i = 0; i < frame.channelCount; i++) {
+            int32_t value = quantize(frame.channels[i], scale);
+            // the change wraps around in 32 bits, and the decoder wraps it back the same way
+            length += putVarint(&payload[length], zigzag((int32_t)((uint32_t)value - (uint32_t)state.values[i])));
+            state.values[i] = value;
+        }
+        state.sinceKeyframe++;
+    }
+    state.timestamp = frame.timestamp;
+    return encodeSpectroFrame(keyframe ? SPECTRO_FRAME_KEY : SPECTRO_FRAME_DELTA,
+                              payload, length, buffer, bufferSize);
+}
+
+bool decodeDeltaFrame(uint8_t type, const uint8_t *payload, uint8_t length,
+                      SpectroDeltaState &state, SpectroFrame &frame) {
+    /* Fill in frame from the payload of a keyframe or delta frame, state has to be the
+    state of the frame's port (payload[0]).  The quantized channels are left in state.values.
+    Return false if the payload is bad, or for a delta frame that does not follow
+    the last frame of the port (then the port waits for its next keyframe) */
+    uint8_t position;
+    if (type == SPECTRO_FRAME_KEY) {
+        if (length < SPECTRO_KEY_HEADER_SIZE || payload[8] > SPECTRO_FRAME_MAX_CHANNELS ||
+            payload[9] > SPECTRO_MAX_DECIMALS) {
+            return false;
+        }
+        state.sensorType = payload[1];
+        state.timestamp = getUint32(&payload[2]);
+        frame.sequence = payload[6] | ((uint16_t)payload[7] << 8);
+        state.channelCount = payload[8];
+        state.decimals = payload[9];
+        state.frameCount = payload[10];
+        position = SPECTRO_KEY_HEADER_SIZE;
+        for (uint8_t i = 0; i < state.channelCount; i++) {
+            uint32_t value;
+            if (!getVarint(payload, length, position, value)) {
+                state.valid = false;
+                return false;
+            }
+            state.values[i] = unzigzag(value);
+        }
+        state.valid = true;
+    }
+    else if (type == SPECTRO_FRAME_DELTA) {
+        if (length < SPECTRO_DELTA_HEADER_SIZE || !state.valid ||
+            payload[1] != (uint8_t)(state.frameCount + 1)) {
+            state.valid = false;  // a frame of this port was lost
+            return false;
+        }
+        state.frameCount = payload[1];
+        frame.sequence = payload[2] | ((uint16_t)payload[3] << 8);
+        position = SPECTRO_DELTA_HEADER_SIZE;
+        uint32_t elapsed;
+        if (!getVarint(payload, length, position, elapsed)) {
+            state.valid = false;
+            return false;
+        }
+        state.timestamp += elapsed;
+        for (uint8_t i = 0; i < state.channelCount; i++) {
+            uint32_t change;
+            if (!getVarint(payload, length, position, change)) {
+                state.valid = false;
+                return false;
+            }
+            state.values[i] = (int32_t)((uint32_t)state.values[i] + (uint32_t)unzigzag(change));
+        }
+    }
+    else {
+        return false;
+    }
+    if (position != length) {
+        state.valid = false;
+        return false;
+    }
+    float scale = decimalScale(state.decimals);
+    frame.port = payload[0];
+    frame.sensorType = state.sensorType;
+    frame.timestamp = state.timestamp;
+    frame.channelCount = state.channelCount;
+    for (uint8_t i = 0; i < state.channelCount; i++) {
+        frame.channels[i] = state.values[i] / scale;
+    }
+    frame.kind = RECORD_READING;
+    frame.sampleCount = 1;
+    frame.rejectedCount = 0;
+    frame.bulbMask = 0;
+    return true;
+}
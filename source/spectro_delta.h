@@ -0,0 +1,64 @@
+/*
+  Delta compression of the readings of each port for the binary output.
+  Like spectro_frame.h this does not use any Arduino code, the host computer
+  compiles the same file to decode the frames.
+
+  The channel values are quantized to a fixed number of decimals
+  (value * 10^decimals rounded to an integer).  The first reading of a port,
+  and then every keyframe interval readings, is sent whole in a keyframe,
+  the readings between are sent as the change of each quantized channel from
+  the last reading of that port.  The integers are zigzag / variable length
+  (LEB128) encoded so a small change takes 1 byte.  The decoder ends up with the
+  same quantized integers as the encoder, so the output is exact at the chosen
+  number of decimals.
+
+  Key frame payload (SPECTRO_FRAME_KEY):
+    port | sensor type | timestamp (ms, 4 bytes) | sequence (2 bytes) |
+    channel count | decimals | port frame count | quantized channels (varints)
+  Delta frame payload (SPECTRO_FRAME_DELTA):
+    port | port frame count | sequence (2 bytes) | ms since the last frame (varint) |
+    change of each quantized channel (varints)
+  The port frame count goes up by 1 for every frame of a port, if the decoder
+  sees a gap it ignores the deltas of that port until the next keyframe.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#ifndef _SPECTRO_DELTA_H
+#define _SPECTRO_DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "spectro_frame.h"
+
+const uint8_t SPECTRO_KEY_HEADER_SIZE = 11;
+const uint8_t SPECTRO_DELTA_HEADER_SIZE = 4;  // not counting the time varint
+// Most bytes a 32 bit varint takes
+const uint8_t SPECTRO_MAX_VARINT_SIZE = 5;
+// Most decimals the channels can be quantized to, 10^9 still fits in 32 bits
+const uint8_t SPECTRO_MAX_DECIMALS = 9;
+const uint8_t SPECTRO_DEFAULT_DECIMALS = 2;
+const uint8_t SPECTRO_DEFAULT_KEYFRAME_INTERVAL = 16;
+
+// What the encoder or decoder remembers about the last frame of 1 port
+struct SpectroDeltaState {
+	bool valid;  // false until a keyframe is sent / received
+	uint8_t sensorType;
+	uint8_t channelCount;
+	uint8_t decimals;
+	uint8_t frameCount;
+	uint8_t sinceKeyframe;
+	uint32_t timestamp;
+	int32_t values[SPECTRO_FRAME_MAX_CHANNELS];  // quantized channels
+};
+
+void resetDeltaState(SpectroDeltaState &state);
+size_t encodeDeltaFrame(const SpectroFrame &frame, SpectroDeltaState &state, uint8_t keyframeInterval,
+                        uint8_t decimals, uint8_t *buffer, size_t bufferSize);
+bool decodeDeltaFrame(uint8_t type, const uint8_t *payload, uint8_t length,
+                      SpectroDeltaState &state, SpectroFrame &frame);
+
+#endif
@@ -0,0 +1,213 @@
+/*
+  Binary frames for sending spectral readings over a serial port,
+  see spectro_frame.h for the frame layout.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include "spectro_frame.h"
+#include <string.h>
+
+static void putUint16(uint8_t *buffer, uint16_t value) {
+    buffer[0] = value & 0xFF;
+    buffer[1] = value >> 8;
+}
+
+static void putUint32(uint8_t *buffer, uint32_t value) {
+    for (uint8_t i = 0; i < 4; i++) {
+        buffer[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint32_t getUint32(const uint8_t *buffer) {
+    return (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) |
+           ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
+
+uint16_t spectroCrc16(const uint8_t *data, size_t length, uint16_t crc) {
+    /* CRC-16/CCITT-FALSE (polynomial 0x1021), pass the last crc in to continue a calculation */
+    for (size_t i = 0; i < length; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+size_t encodeSpectroFrame(uint8_t type, const uint8_t *payload, uint8_t length,
+                          uint8_t *buffer, size_t bufferSize) {
+    /* Put the sync bytes, type, length and CRC around a payload.
+    Returns the number of bytes in the frame or 0 if buffer is too small */
+    size_t frameSize = (size_t)length + SPECTRO_FRAME_OVERHEAD;
+    if (frameSize > bufferSize) {
+        return 0;
+    }
+    buffer[0] = SPECTRO_FRAME_SYNC1;
+    buffer[1] = SPECTRO_FRAME_SYNC2;
+    buffer[2] = type;
+    buffer[3] = length;
+    memmove(&buffer[4], payload, length);
+    putUint16(&buffer[4 + length], spectroCrc16(&buffer[2], (size_t)length + 2));
+    return frameSize;
+}
+
+size_t encodeDataFrame(const SpectroFrame &frame, uint8_t *buffer, size_t bufferSize) {
+    /* Make a data frame from a reading, a statistics frame if frame.kind is one of the
+    statistics or a capture frame if it is a capture frame kind, the payload is built in
+    place in buffer.  Returns the number of bytes in the frame or 0 if buffer is too small */
+    if (frame.channelCount > SPECTRO_FRAME_MAX_CHANNELS) {
+        return 0;
+    }
+    uint8_t type = SPECTRO_FRAME_DATA;
+    uint8_t headerSize = 0;
+    if (frame.kind >= RECORD_DARK) {
+        type = SPECTRO_FRAME_CAPTURE;
+        headerSize = SPECTRO_CAPTURE_HEADER_SIZE;
+    }
+    else if (frame.kind != RECORD_READING) {
+        type = SPECTRO_FRAME_STATS;
+        headerSize = SPECTRO_STATS_HEADER_SIZE;
+    }
+    uint8_t length = headerSize + SPECTRO_DATA_HEADER_SIZE + 4 * frame.channelCount;
+    if ((size_t)length + SPECTRO_FRAME_OVERHEAD > bufferSize) {
+        return 0;
+    }
+    uint8_t *payload = &buffer[4];
+    if (type == SPECTRO_FRAME_STATS) {
+        payload[0] = frame.kind;
+        payload[1] = frame.sampleCount;
+        payload[2] = frame.rejectedCount;
+    }
+    else if (type == SPECTRO_FRAME_CAPTURE) {
+        payload[0] = frame.kind;
+        payload[1] = frame.bulbMask;
+    }
+    payload += headerSize;
+    payload[0] = frame.port;
+    payload[1] = frame.sensorType;
+    putUint32(&payload[2], frame.timestamp);
+    putUint16(&payload[6], frame.sequence);
+    payload[8] = frame.channelCount;
+    for (uint8_t i = 0; i < frame.channelCount; i++) {
+        uint32_t bits;
+        memcpy(&bits, &frame.channels[i], sizeof(bits));
+        putUint32(&payload[SPECTRO_DATA_HEADER_SIZE + 4 * i], bits);
+    }
+    return encodeSpectroFrame(type, &buffer[4], length, buffer, bufferSize);
+}
+
+bool decodeDataFrame(const uint8_t *payload, uint8_t length, SpectroFrame &frame) {
+    /* Fill in frame from the payload of a data frame.
+    Return false if the payload length does not match its channel count */
+    if (length < SPECTRO_DATA_HEADER_SIZE) {
+        return false;
+    }
+    uint8_t channelCount = payload[8];
+    if (channelCount > SPECTRO_FRAME_MAX_CHANNELS ||
+        length != SPECTRO_DATA_HEADER_SIZE + 4 * channelCount) {
+        return false;
+    }
+    frame.port = payload[0];
+    frame.sensorType = payload[1];
+    frame.timestamp = getUint32(&payload[2]);
+    frame.sequence = payload[6] | ((uint16_t)payload[7] << 8);
+    frame.channelCount = channelCount;
+    for (uint8_t i = 0; i < channelCount; i++) {
+        uint32_t bits = getUint32(&payload[SPECTRO_DATA_HEADER_SIZE + 4 * i]);
+        memcpy(&frame.channels[i], &bits, sizeof(bits));
+    }
+    frame.kind = RECORD_READING;
+    frame.sampleCount = 1;
+    frame.rejectedCount = 0;
+    frame.bulbMask = 0;
+    return true;
+}
+
+bool decodeStatsFrame(const uint8_t *payload, uint8_t length, SpectroFrame &frame) {
+    /* Fill in frame from the payload of a statistics frame.
+    Return false if the payload is not a valid statistics payload */
+    if (length < SPECTRO_STATS_HEADER_SIZE || payload[0] == RECORD_READING || payload[0] > RECORD_MAX ||
+        !decodeDataFrame(&payload[SPECTRO_STATS_HEADER_SIZE], length - SPECTRO_STATS_HEADER_SIZE, frame)) {
+        return false;
+    }
+    frame.kind = payload[0];
+    frame.sampleCount = payload[1];
+    frame.rejectedCount = payload[2];
+    return true;
+}
+
+bool decodeCaptureFrame(const uint8_t *payload, uint8_t length, SpectroFrame &frame) {
+    /* Fill in frame from the payload of a capture frame.
+    Return false if the payload is not a valid capture payload */
+    if (length < SPECTRO_CAPTURE_HEADER_SIZE || payload[0] < RECORD_DARK || payload[0] > RECORD_DARK_SUBTRACTED ||
+        !decodeDataFrame(&payload[SPECTRO_CAPTURE_HEADER_SIZE], length - SPECTRO_CAPTURE_HEADER_SIZE, frame)) {
+        return false;
+    }
+    frame.kind = payload[0];
+    frame.bulbMask = payload[1];
+    return true;
+}
+
+SpectroFrameDecoder::SpectroFrameDecoder() {
+}
+
+void SpectroFrameDecoder::reset() {
+    state = WAIT_SYNC1;
+}
+
+bool SpectroFrameDecoder::feed(uint8_t data) {
+    /* Add the next received byte.  Returns true when it completes a frame whose
+    CRC is correct, then type(), length() and payload() describe that frame.
+    A bad CRC is counted and the decoder goes back to looking for the sync bytes */
+    switch (state) {
+    case WAIT_SYNC1:
+        if (data == SPECTRO_FRAME_SYNC1) {
+            state = WAIT_SYNC2;
+        }
+        break;
+    case WAIT_SYNC2:
+        if (data == SPECTRO_FRAME_SYNC2) {
+            state = READ_TYPE;
+        }
+        else if (data != SPECTRO_FRAME_SYNC1) {
+            state = WAIT_SYNC1;
+        }
+        break;
+    case READ_TYPE:
+        frameType = data;
+        state = READ_LENGTH;
+        break;
+    case READ_LENGTH:
+        payloadLength = data;
+        received = 0;
+        state = (payloadLength == 0) ? READ_CRC_LOW : READ_PAYLOAD;
+        break;
+    case READ_PAYLOAD:
+        payloadBuffer[received++] = data;
+        if (received == payloadLength) {
+            state = READ_CRC_LOW;
+        }
+        break;
+    case READ_CRC_LOW:
+        frameCrc = data;
+        state = READ_CRC_HIGH;
+        break;
+    case READ_CRC_HIGH: {
+        frameCrc |= (uint16_t)data << 8;
+        state = WAIT_SYNC1;
+        uint8_t head[2] = { frameType, payloadLength };
+        uint16_t crc = spectroCrc16(payloadBuffer, payloadLength, spectroCrc16(head, 2));
+        if (crc != frameCrc) {
+            crcErrors += 1;
+            return false;
+        }
+        goodFrames += 1;
+        return true;
+    }
+    }
+    return false;
+}
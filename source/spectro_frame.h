@@ -0,0 +1,110 @@
+/*
+  Binary frames for sending spectral readings over a serial port.
+  This file does not use any Arduino code so the same encoder / decoder
+  can be compiled on the host computer to read the frames back.
+
+  Frame layout (multi-byte fields are little endian):
+    0xA5 0x5A | type | payload length | payload ... | CRC-16 (low, high)
+  The CRC is CRC-16/CCITT-FALSE over the type, length and payload bytes.
+
+  Data frame payload (SPECTRO_FRAME_DATA):
+    port | sensor type | timestamp (ms, 4 bytes) | sequence (2 bytes) |
+    channel count | channel values (4 byte floats)
+
+  Statistics frame payload (SPECTRO_FRAME_STATS), 1 of the 4 frames sent for an
+  oversampled reading, all 4 have the same sequence number:
+    kind (SpectroRecordKind) | samples | values rejected as outliers |
+    the data frame payload, with the statistic as the channel values
+
+  Capture frame payload (SPECTRO_FRAME_CAPTURE), 1 frame per illumination of a
+  capture sequence, all the frames of a capture have the same sequence number and each
+  frame that was dropped adds 1 to the gap before the next sequence number:
+    kind (RECORD_DARK, RECORD_LIT or RECORD_DARK_SUBTRACTED) | bulbs that were on |
+    the data frame payload
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#ifndef _SPECTRO_FRAME_H
+#define _SPECTRO_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SPECTRO_FRAME_SYNC1	0xA5
+#define SPECTRO_FRAME_SYNC2	0x5A
+// Frame types
+#define SPECTRO_FRAME_DATA	0x01
+#define SPECTRO_FRAME_STATS	0x02
+#define SPECTRO_FRAME_KEY	0x03  // see spectro_delta.h
+#define SPECTRO_FRAME_DELTA	0x04
+#define SPECTRO_FRAME_PROFILE	0x05  // see spectro_profile.h
+#define SPECTRO_FRAME_ACK	0x06  // see spectro_command.h
+#define SPECTRO_FRAME_CAPTURE	0x07
+
+const uint8_t SPECTRO_FRAME_MAX_CHANNELS = 18;
+const uint8_t SPECTRO_FRAME_MAX_PAYLOAD = 255;
+// sync, type and length in front of the payload and the CRC after it
+const uint8_t SPECTRO_FRAME_OVERHEAD = 6;
+const uint8_t SPECTRO_DATA_HEADER_SIZE = 9;
+const uint8_t SPECTRO_STATS_HEADER_SIZE = 3;
+const uint8_t SPECTRO_CAPTURE_HEADER_SIZE = 2;
+
+// What the channel values are: a single reading, 1 statistic of an oversampled reading
+// or 1 frame of a capture sequence (the dark frame, or a frame with bulbs on with or
+// without the dark frame taken off)
+enum SpectroRecordKind : uint8_t {
+	RECORD_READING, RECORD_MEAN, RECORD_VARIANCE, RECORD_MIN, RECORD_MAX,
+	RECORD_DARK, RECORD_LIT, RECORD_DARK_SUBTRACTED
+};
+
+struct SpectroFrame {
+	uint8_t port;
+	uint8_t sensorType;
+	uint32_t timestamp;
+	uint16_t sequence;
+	uint8_t channelCount;
+	float channels[SPECTRO_FRAME_MAX_CHANNELS];
+	uint8_t kind;  // RECORD_READING is sent as a data frame, the others as statistics or capture frames
+	uint8_t sampleCount;
+	uint8_t rejectedCount;
+	uint8_t bulbMask;  // bulbs that were on, only sent in capture frames
+};
+
+uint16_t spectroCrc16(const uint8_t *data, size_t length, uint16_t crc = 0xFFFF);
+size_t encodeSpectroFrame(uint8_t type, const uint8_t *payload, uint8_t length,
+                          uint8_t *buffer, size_t bufferSize);
+size_t encodeDataFrame(const SpectroFrame &frame, uint8_t *buffer, size_t bufferSize);
+bool decodeDataFrame(const uint8_t *payload, uint8_t length, SpectroFrame &frame);
+bool decodeStatsFrame(const uint8_t *payload, uint8_t length, SpectroFrame &frame);
+bool decodeCaptureFrame(const uint8_t *payload, uint8_t length, SpectroFrame &frame);
+
+// Decoder that is fed one byte at a time, it finds the start of a frame,
+// checks the CRC and holds on to the last good frame
+class SpectroFrameDecoder {
+public:
+	SpectroFrameDecoder();
+	bool feed(uint8_t data);  // true when a complete frame with a good CRC was received
+	void reset();
+	uint8_t type() const { return frameType; }
+	uint8_t length() const { return payloadLength; }
+	const uint8_t *payload() const { return payloadBuffer; }
+	unsigned long goodFrames = 0;
+	unsigned long crcErrors = 0;
+
+private:
+	enum DecoderState : uint8_t {
+		WAIT_SYNC1, WAIT_SYNC2, READ_TYPE, READ_LENGTH, READ_PAYLOAD, READ_CRC_LOW, READ_CRC_HIGH
+	};
+	DecoderState state = WAIT_SYNC1;
+	uint8_t frameType = 0;
+	uint8_t payloadLength = 0;
+	uint8_t received = 0;
+	uint16_t frameCrc = 0;
+	uint8_t payloadBuffer[SPECTRO_FRAME_MAX_PAYLOAD];
+};
+
+#endif
@@ -0,0 +1,103 @@
+/*
+  Latency histograms and the profile frame, see spectro_profile.h.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include "spectro_profile.h"
+
+static void putUint16(uint8_t *buffer, uint16_t value) {
+    buffer[0] = value & 0xFF;
+    buffer[1] = value >> 8;
+}
+
+static void putUint32(uint8_t *buffer, uint32_t value) {
+    for (uint8_t i = 0; i < 4; i++) {
+        buffer[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint16_t getUint16(const uint8_t *buffer) {
+    return buffer[0] | ((uint16_t)buffer[1] << 8);
+}
+
+static uint32_t getUint32(const uint8_t *buffer) {
+    return (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) |
+           ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
+
+uint32_t bucketLimitUs(uint8_t bucket) {
+    /* Times in a bucket are under this, the last bucket has no limit (returns 0) */
+    if (bucket >= PROFILE_BUCKETS - 1) {
+        return 0;
+    }
+    return PROFILE_FIRST_BUCKET_US << (2 * bucket);
+}
+
+void addLatency(LatencyHistogram &histogram, uint32_t us) {
+    /* Count 1 operation that took us microseconds */
+    uint8_t bucket = 0;
+    while (bucket < PROFILE_BUCKETS - 1 && us >= bucketLimitUs(bucket)) {
+        bucket++;
+    }
+    if (histogram.buckets[bucket] < 0xFFFF) {
+        histogram.buckets[bucket]++;
+    }
+    histogram.count++;
+    histogram.totalUs += us;
+    if (us > histogram.maxUs) {
+        histogram.maxUs = us;
+    }
+}
+
+size_t encodeProfileFrame(uint8_t port, const PortProfile &profile, uint8_t *buffer, size_t bufferSize) {
+    /* Make a profile frame, the payload is built in place in buffer.
+    Returns the number of bytes in the frame or 0 if buffer is too small */
+    if ((size_t)PROFILE_PAYLOAD_SIZE + SPECTRO_FRAME_OVERHEAD > bufferSize) {
+        return 0;
+    }
+    uint8_t *payload = &buffer[4];
+    payload[0] = port;
+    uint8_t *next = &payload[1];
+    for (uint8_t i = 0; i < PROFILE_EVENTS; i++) {
+        const LatencyHistogram &histogram = profile.events[i];
+        putUint32(&next[0], histogram.count);
+        putUint32(&next[4], histogram.totalUs);
+        putUint32(&next[8], histogram.maxUs);
+        for (uint8_t b = 0; b < PROFILE_BUCKETS; b++) {
+            putUint16(&next[12 + 2 * b], histogram.buckets[b]);
+        }
+        next += PROFILE_HISTOGRAM_SIZE;
+    }
+    for (uint8_t i = 0; i < PROFILE_COUNTERS; i++) {
+        putUint32(&next[4 * i], profile.counters[i]);
+    }
+    return encodeSpectroFrame(SPECTRO_FRAME_PROFILE, payload, PROFILE_PAYLOAD_SIZE, buffer, bufferSize);
+}
+
+bool decodeProfileFrame(const uint8_t *payload, uint8_t length, uint8_t &port, PortProfile &profile) {
+    /* Fill in profile from the payload of a profile frame.
+    Return false if the payload is not the right length */
+    if (length != PROFILE_PAYLOAD_SIZE) {
+        return false;
+    }
+    port = payload[0];
+    const uint8_t *next = &payload[1];
+    for (uint8_t i = 0; i < PROFILE_EVENTS; i++) {
+        LatencyHistogram &histogram = profile.events[i];
+        histogram.count = getUint32(&next[0]);
+        histogram.totalUs = getUint32(&next[4]);
+        histogram.maxUs = getUint32(&next[8]);
+        for (uint8_t b = 0; b < PROFILE_BUCKETS; b++) {
+            histogram.buckets[b] = getUint16(&next[12 + 2 * b]);
+        }
+        next += PROFILE_HISTOGRAM_SIZE;
+    }
+    for (uint8_t i = 0; i < PROFILE_COUNTERS; i++) {
+        profile.counters[i] = getUint32(&next[4 * i]);
+    }
+    return true;
+}
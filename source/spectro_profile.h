@@ -0,0 +1,64 @@
+/*
+  Latency histograms and event counters for finding where the time goes,
+  kept per port by SpectroDesktop when PROFILE_FLAG is set.  Like
+  spectro_frame.h this does not use any Arduino code so the host computer
+  can decode the profile frames.
+
+  Each histogram has fixed buckets, bucket b counts the times under
+  16 * 4^b microseconds (16 us, 64 us, 256 us ... 1 s) and the last
+  bucket the times over 1 s.
+
+  Profile frame payload (SPECTRO_FRAME_PROFILE), multi-byte fields little endian:
+    port | for each ProfileEvent: count (4 bytes), total us (4 bytes), max us (4 bytes),
+    bucket counts (2 bytes each) | each ProfileCounter (4 bytes)
+  The port is 0xFF for what did not happen on a port (e.g. a bus reset during the scan).
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#ifndef _SPECTRO_PROFILE_H
+#define _SPECTRO_PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "spectro_frame.h"
+
+const uint8_t PROFILE_BUCKETS = 10;
+const uint32_t PROFILE_FIRST_BUCKET_US = 16;
+
+// Operations that are timed
+enum ProfileEvent : uint8_t {
+	PROFILE_MUX_SELECT, PROFILE_INTEGRATION_WAIT, PROFILE_READOUT, PROFILE_LED, PROFILE_SERIAL_EMIT,
+	PROFILE_EVENTS  // number of events
+};
+
+// Things that are only counted
+enum ProfileCounter : uint8_t {
+	PROFILE_MUX_VERIFY_FAILS, PROFILE_BUS_RESETS,
+	PROFILE_COUNTERS  // number of counters
+};
+
+struct LatencyHistogram {
+	uint32_t count;
+	uint32_t totalUs;  // divide by count for the mean
+	uint32_t maxUs;
+	uint16_t buckets[PROFILE_BUCKETS];  // stop counting at 65535
+};
+
+struct PortProfile {
+	LatencyHistogram events[PROFILE_EVENTS];
+	uint32_t counters[PROFILE_COUNTERS];
+};
+
+const uint8_t PROFILE_HISTOGRAM_SIZE = 12 + 2 * PROFILE_BUCKETS;
+const uint8_t PROFILE_PAYLOAD_SIZE = 1 + PROFILE_EVENTS * PROFILE_HISTOGRAM_SIZE + 4 * PROFILE_COUNTERS;
+
+void addLatency(LatencyHistogram &histogram, uint32_t us);
+uint32_t bucketLimitUs(uint8_t bucket);
+size_t encodeProfileFrame(uint8_t port, const PortProfile &profile, uint8_t *buffer, size_t bufferSize);
+bool decodeProfileFrame(const uint8_t *payload, uint8_t length, uint8_t &port, PortProfile &profile);
+
+#endif
@@ -0,0 +1,97 @@
+/*
+  Serial output queue, see spectro_tx_queue.h.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include "spectro_tx_queue.h"
+
+void SpectroTxQueue::begin(Print &outputPort) {
+    /* Send the queued output to outputPort, anything already queued goes to the old port first */
+    if (port != nullptr) {
+        flush();
+    }
+    port = &outputPort;
+}
+
+size_t SpectroTxQueue::write(uint8_t data) {
+    return write(&data, 1);
+}
+
+size_t SpectroTxQueue::write(const uint8_t *data, size_t size) {
+    /* Queue the bytes, if there is not room for them hand the oldest bytes to the
+    serial port (waiting for it) until there is.  A write bigger than the queue
+    goes out in pieces */
+    if (port == nullptr) {
+        return 0;
+    }
+    size_t written = 0;
+    while (written < size) {
+        unsigned int part = min(size - written, (size_t)SPECTRO_TX_QUEUE_SIZE);
+        if (SPECTRO_TX_QUEUE_SIZE - count < part) {
+            service();
+        }
+        if (SPECTRO_TX_QUEUE_SIZE - count < part) {
+            unsigned long start = micros();
+            sendOldest(part - (SPECTRO_TX_QUEUE_SIZE - count));
+            stats.stalls += 1;
+            stats.stallUs += micros() - start;
+        }
+        for (unsigned int i = 0; i < part; i++) {
+            buffer[head] = data[written + i];
+            head = (head + 1) % SPECTRO_TX_QUEUE_SIZE;
+        }
+        count += part;
+        written += part;
+        if (count > stats.highWater) {
+            stats.highWater = count;
+        }
+    }
+    stats.bytesQueued += size;
+    return size;
+}
+
+int SpectroTxQueue::availableForWrite() {
+    return SPECTRO_TX_QUEUE_SIZE - count;
+}
+
+void SpectroTxQueue::service() {
+    /* Hand the serial port as many queued bytes as its transmit buffer has room for,
+    so this never waits for the port */
+    if (port == nullptr || count == 0) {
+        return;
+    }
+    int room = port->availableForWrite();
+    if (room > 0) {
+        sendOldest(min((unsigned int)room, count));
+    }
+}
+
+void SpectroTxQueue::flush() {
+    /* Hand every queued byte to the serial port, waiting for it if it is busy */
+    if (port != nullptr) {
+        sendOldest(count);
+    }
+}
+
+unsigned int SpectroTxQueue::queued() {
+    return count;
+}
+
+void SpectroTxQueue::resetStats() {
+    stats = TxQueueStats {};
+}
+
+void SpectroTxQueue::sendOldest(unsigned int bytes) {
+    /* Write the oldest bytes to the serial port, in up to 2 pieces as the queue wraps */
+    while (bytes > 0) {
+        unsigned int part = min(bytes, (unsigned int)(SPECTRO_TX_QUEUE_SIZE - tail));
+        port->write(&buffer[tail], part);
+        tail = (tail + part) % SPECTRO_TX_QUEUE_SIZE;
+        count -= part;
+        bytes -= part;
+    }
+}
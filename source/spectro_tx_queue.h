@@ -0,0 +1,66 @@
+/*
+  Queue in front of the serial port so printing a reading does not wait for
+  the bytes to go out.  Everything SpectroDesktop prints is written here, the
+  bytes are handed to the serial port only as fast as its own transmit buffer
+  has room (availableForWrite()), so the port's transmit interrupt sends them
+  in the background while the next measurement runs.  service() has to be
+  called often to move the queued bytes on, SpectroDesktop calls it from its
+  service functions and while it waits for a measurement.
+
+  When the queue is full a write has to wait for the serial port, that time
+  is counted in TxQueueStats so the queue can be sized for the output rate.
+  A port that always reports 0 from availableForWrite() only gets the queued
+  bytes when the queue fills or flush() is called.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#ifndef _SPECTRO_TX_QUEUE_H
+#define _SPECTRO_TX_QUEUE_H
+
+#include <Arduino.h>
+
+// Bytes of output that can wait for the serial port, a text reading of an AS7265X is
+// about 300 bytes, a data frame 94
+#ifndef SPECTRO_TX_QUEUE_SIZE
+#if defined(__AVR__)
+#define SPECTRO_TX_QUEUE_SIZE 256
+#else
+#define SPECTRO_TX_QUEUE_SIZE 2048
+#endif
+#endif
+
+struct TxQueueStats {
+	unsigned long bytesQueued;  // every byte written, including ones that had to wait
+	unsigned int highWater;  // most bytes that were waiting at once
+	unsigned long stalls;  // writes that found the queue full and waited for the serial port
+	unsigned long stallUs;  // total time those writes waited
+};
+
+class SpectroTxQueue : public Print {
+public:
+	TxQueueStats stats {};
+
+	void begin(Print &outputPort);
+	size_t write(uint8_t data) override;
+	size_t write(const uint8_t *buffer, size_t size) override;
+	using Print::write;
+	int availableForWrite() override;
+	void service();
+	void flush() override;
+	unsigned int queued();
+	void resetStats();
+
+private:
+	Print *port = nullptr;
+	uint8_t buffer[SPECTRO_TX_QUEUE_SIZE];
+	unsigned int head = 0;  // where the next byte is written
+	unsigned int tail = 0;  // oldest byte
+	unsigned int count = 0;
+	void sendOldest(unsigned int bytes);
+};
+
+#endif
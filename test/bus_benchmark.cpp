@@ -0,0 +1,120 @@
+/*
+  Bus benchmark of SpectroDesktop on the simulated bus (test/host/sim_bus.h),
+  so the cost of a change can be compared against a baseline without hardware.
+
+  For 1 to 8 populated mux ports (an AS7265X, AS7262 and AS7263 in turn, each
+  with a button) it reports the I2C transactions, bytes and simulated time of
+    begin() with an erased EEPROM (full scan), and again with the saved ports
+    pollButtons() while nothing is pressed, per call
+    readSensor() of each port in turn, per port
+    readAllSensors() of every port and sending the readings
+  The counts are every transaction on the bus, including the ones the SparkFun
+  drivers make, "library" is the part the library's own BusStats sees.
+  The serial port runs at 115200 baud like the examples.
+
+  Exits with 1 if a sensor is not found or a reading is missing.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include <stdio.h>
+#include "asm_sensors_w_mux_library.h"
+#include "sim_bus.h"
+
+const int POLL_REPEATS = 10;
+const uint8_t SENSOR_CODES[3] = { SIM_AS7265X, SIM_AS7262, SIM_AS7263 };
+
+struct Sample {
+    SimBusCounters bus;
+    unsigned long libraryTransactions;
+    unsigned long long us;
+};
+
+static unsigned long long sampleStart;
+
+static void startSample(SpectroDesktop &spectro) {
+    simResetCounters();
+    spectro.resetBusStats();
+    sampleStart = simNowUs();
+}
+
+static Sample endSample(SpectroDesktop &spectro, unsigned long repeats = 1) {
+    Sample sample;
+    sample.us = (simNowUs() - sampleStart) / repeats;
+    sample.bus = simCounters();
+    sample.bus.transactions /= repeats;
+    sample.bus.bytesWritten /= repeats;
+    sample.bus.bytesRead /= repeats;
+    sample.bus.nacks /= repeats;
+    sample.libraryTransactions = spectro.getBusStats().transactions / repeats;
+    return sample;
+}
+
+static void printSample(int ports, const char *name, const Sample &sample) {
+    printf("%5d  %-28s %12lu %9lu %9lu %8lu %11lu %12llu\n", ports, name, sample.bus.transactions,
+           sample.bus.bytesWritten, sample.bus.bytesRead, sample.bus.nacks,
+           sample.libraryTransactions, sample.us);
+}
+
+static bool benchmark(int ports) {
+    /* Run every measurement with ports sensors on mux channels 0 up, return false if
+    the library did not find them all or a reading was missing */
+    simReset();
+    simAddMux(0, 0);
+    for (int i = 0; i < ports; i++) {
+        simAddSensor(0, 0, i, SENSOR_CODES[i % 3]);
+        simAddButton(0, 0, i);
+    }
+    Serial.begin(115200);
+    bool ok = true;
+
+    SpectroDesktop *spectro = new SpectroDesktop();
+    startSample(*spectro);
+    ok &= spectro->begin();
+    printSample(ports, "begin() full scan", endSample(*spectro));
+    delete spectro;
+
+    spectro = new SpectroDesktop();
+    startSample(*spectro);
+    ok &= spectro->begin();
+    printSample(ports, "begin() saved ports", endSample(*spectro));
+
+    startSample(*spectro);
+    for (int i = 0; i < POLL_REPEATS; i++) {
+        spectro->pollButtons();
+    }
+    printSample(ports, "pollButtons() idle, per call", endSample(*spectro, POLL_REPEATS));
+
+    startSample(*spectro);
+    for (int i = 0; i < ports; i++) {
+        spectro->readSensor(i);
+    }
+    spectro->flushOutput();
+    printSample(ports, "readSensor(), per port", endSample(*spectro, ports));
+
+    startSample(*spectro);
+    PortMask reported = spectro->readAllSensors();
+    spectro->drainRecords(SPECTRAL_RECORD_QUEUE_SIZE);
+    spectro->flushOutput();
+    printSample(ports, "readAllSensors(), all ports", endSample(*spectro));
+    // readings past the record queue size are dropped, the sweep still has to report them
+    ok &= reported == (PortMask)((1UL << ports) - 1);
+    delete spectro;
+    return ok;
+}
+
+int main() {
+    printf("ports  %-28s %12s %9s %9s %8s %11s %12s\n", "operation", "transactions", "written", "read",
+           "errors", "library", "time (us)");
+    bool ok = true;
+    for (int ports = 1; ports <= 8; ports++) {
+        if (!benchmark(ports)) {
+            printf("%d ports: a sensor was not found or did not report\n", ports);
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
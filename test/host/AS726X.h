@@ -0,0 +1,34 @@
+/*
+  Host build of the SparkFun AS726X driver, only the functions the library uses.
+  They talk to the simulated sensor over TwoWire with the same virtual register
+  transactions as the real driver, so the bus benchmark counts their traffic.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#ifndef _HOST_AS726X_H
+#define _HOST_AS726X_H
+
+#include "Wire.h"
+
+class AS726X {
+public:
+	bool begin(TwoWire &wirePort = Wire, uint8_t gain = 3, uint8_t measurementMode = 3);
+	uint8_t getVersion();
+	void setMeasurementMode(uint8_t mode);
+	void setIntegrationTime(uint8_t integrationValue);
+	void setGain(uint8_t gain);
+	void setBulbCurrent(uint8_t current);
+	void disableBulb();
+	void setIndicatorCurrent(uint8_t current);
+	void disableIndicator();
+
+private:
+	TwoWire *_i2cPort = &Wire;
+	uint8_t _sensorVersion = 0;
+};
+
+#endif
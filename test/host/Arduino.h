@@ -0,0 +1,109 @@
+/*
+  The parts of the Arduino core the library uses, for building it on the host
+  computer with the simulated I2C devices of sim_bus.h.  Used by the tests and
+  the bus benchmark in test/, not by the Arduino build.
+
+  Time is simulated: it moves on with the I2C traffic, the serial output,
+  delay() and by 1 us for every millis() / micros() call (the CPU time of a
+  polling loop), so loops that wait for a time always end.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#ifndef _HOST_ARDUINO_H
+#define _HOST_ARDUINO_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#define LOW	0
+#define HIGH	1
+#define INPUT	0
+#define OUTPUT	1
+#define INPUT_PULLUP	2
+#define DEC	10
+#define HEX	16
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+
+// The core's min() / max() are macros, templates do the same without clashing with <algorithm>
+template <typename T, typename U>
+auto min(T a, U b) -> decltype(a < b ? a : b) { return a < b ? a : b; }
+template <typename T, typename U>
+auto max(T a, U b) -> decltype(a > b ? a : b) { return a > b ? a : b; }
+template <typename T, typename L, typename H>
+T constrain(T value, L low, H high) { return value < low ? low : (value > high ? high : value); }
+
+class Print {
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t data) = 0;
+	virtual size_t write(const uint8_t *buffer, size_t size);
+	size_t write(const char *text) { return text == nullptr ? 0 : write((const uint8_t *)text, strlen(text)); }
+	virtual int availableForWrite() { return 0; }
+	virtual void flush() {}
+
+	size_t print(const char text[]);
+	size_t print(char c);
+	size_t print(unsigned char value, int base = DEC);
+	size_t print(int value, int base = DEC);
+	size_t print(unsigned int value, int base = DEC);
+	size_t print(long value, int base = DEC);
+	size_t print(unsigned long value, int base = DEC);
+	size_t print(double value, int digits = 2);
+	size_t println();
+	template <typename T>
+	size_t println(T value) { size_t n = print(value); return n + println(); }
+	template <typename T>
+	size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+
+private:
+	size_t printNumber(unsigned long value, int base);
+};
+
+class Stream : public Print {
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+};
+
+// Serial port, what is written is kept for the test to read (see sim_bus.h).  After
+// begin() the transmit buffer empties at the baud rate like the real port's interrupt
+// would send it, a write to a full buffer waits.  Without begin() it never fills.
+class HardwareSerial : public Stream {
+public:
+	void begin(unsigned long baud);
+	void end();
+	size_t write(uint8_t data) override;
+	using Print::write;
+	int availableForWrite() override;
+	void flush() override;
+	int available() override;
+	int read() override;
+	int peek() override;
+	operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
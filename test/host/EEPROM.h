@@ -0,0 +1,28 @@
+/*
+  EEPROM for the host build, 1 KB like an ATmega328.  Writes are counted so
+  a test can see how often the library wears it (see sim_bus.h).
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#ifndef _HOST_EEPROM_H
+#define _HOST_EEPROM_H
+
+#include <stdint.h>
+
+const uint16_t HOST_EEPROM_SIZE = 1024;
+
+class EEPROMClass {
+public:
+	uint8_t read(int address);
+	void write(int address, uint8_t value);
+	void update(int address, uint8_t value);
+	uint16_t length() { return HOST_EEPROM_SIZE; }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,43 @@
+/*
+  Host build of the SparkFun AS7265X driver, only the functions the library uses,
+  talking to the simulated sensor with the real driver's transactions (see AS726X.h).
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#ifndef _HOST_SPARKFUN_AS7265X_H
+#define _HOST_SPARKFUN_AS7265X_H
+
+#include "Wire.h"
+
+#define AS7265x_LED_WHITE	0x00  // device the bulb is driven by
+#define AS7265x_LED_IR	0x01
+#define AS7265x_LED_UV	0x02
+#define AS7265X_LED_CURRENT_LIMIT_12_5MA	0b00
+#define AS7265X_LED_CURRENT_LIMIT_25MA	0b01
+#define AS7265X_LED_CURRENT_LIMIT_50MA	0b10
+#define AS7265X_LED_CURRENT_LIMIT_100MA	0b11
+
+class AS7265X {
+public:
+	bool begin(TwoWire &wirePort = Wire);
+	bool isConnected();
+	void setBulbCurrent(uint8_t current, uint8_t device);
+	void disableBulb(uint8_t device);
+	void enableIndicator();
+	void disableIndicator();
+	void setIndicatorCurrent(uint8_t current);
+	void setIntegrationCycles(uint8_t cycleValue);
+	void setGain(uint8_t gain);
+	void setMeasurementMode(uint8_t mode);
+	void enableInterrupt();
+
+private:
+	TwoWire *_i2cPort = &Wire;
+	void selectDevice(uint8_t device);
+};
+
+#endif
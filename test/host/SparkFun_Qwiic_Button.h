@@ -0,0 +1,59 @@
+/*
+  Host build of the SparkFun Qwiic Button driver, only the functions the library
+  uses, talking to the simulated button with the real driver's register reads and
+  writes (see AS726X.h).
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#ifndef _HOST_SPARKFUN_QWIIC_BUTTON_H
+#define _HOST_SPARKFUN_QWIIC_BUTTON_H
+
+#include "Wire.h"
+
+#define DEFAULT_BUTTON_ADDRESS	0x6F
+#define DEV_ID	0x5D
+
+// Register map of the button firmware
+enum QwiicButtonRegister : uint8_t {
+	BUTTON_ID = 0x00,
+	BUTTON_VERSION1 = 0x01,
+	BUTTON_VERSION2 = 0x02,
+	BUTTON_STATUS = 0x03,
+	BUTTON_INTERRUPT_CONFIG = 0x04,
+	BUTTON_DEBOUNCE_TIME = 0x05,
+	BUTTON_LED_BRIGHTNESS = 0x19,
+	BUTTON_LED_PULSE_GRANULARITY = 0x1A,
+	BUTTON_LED_PULSE_CYCLE_TIME = 0x1B,
+	BUTTON_LED_PULSE_OFF_TIME = 0x1D,
+	BUTTON_I2C_ADDRESS = 0x1F
+};
+
+class QwiicButton {
+public:
+	bool begin(uint8_t address = DEFAULT_BUTTON_ADDRESS, TwoWire &wirePort = Wire);
+	bool isConnected();
+	uint8_t deviceID();
+	bool hasBeenClicked();
+	uint8_t clearEventBits();
+	uint16_t getDebounceTime();
+	uint8_t setDebounceTime(uint16_t time);
+	uint8_t enableClickedInterrupt();
+	uint8_t disableClickedInterrupt();
+	uint8_t LEDconfig(uint8_t brightness, uint16_t cycleTime, uint16_t offTime, uint8_t granularity = 1);
+	uint8_t LEDoff();
+	uint8_t LEDon(uint8_t brightness = 255);
+
+private:
+	TwoWire *_i2cPort = &Wire;
+	uint8_t _deviceAddress = DEFAULT_BUTTON_ADDRESS;
+	uint8_t readSingleRegister(uint8_t reg);
+	uint16_t readDoubleRegister(uint8_t reg);
+	bool writeSingleRegister(uint8_t reg, uint8_t data);
+	bool writeDoubleRegister(uint8_t reg, uint16_t data);
+};
+
+#endif
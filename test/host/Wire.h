@@ -0,0 +1,54 @@
+/*
+  TwoWire for the host build, each transaction goes to the simulated devices
+  of sim_bus.h instead of a bus.  Has the same 32 byte buffers as the AVR Wire.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#ifndef _HOST_WIRE_H
+#define _HOST_WIRE_H
+
+#include "Arduino.h"
+
+#define BUFFER_LENGTH 32
+
+class TwoWire : public Stream {
+public:
+	explicit TwoWire(uint8_t busNumber);
+	void begin();
+	void end();
+	void setClock(uint32_t hz);
+	void beginTransmission(uint8_t address);
+	void beginTransmission(int address) { beginTransmission((uint8_t)address); }
+	uint8_t endTransmission(bool sendStop = true);
+	uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop = true);
+	uint8_t requestFrom(int address, int quantity, int sendStop = 1) {
+		return requestFrom((uint8_t)address, (uint8_t)quantity, (uint8_t)sendStop);
+	}
+	size_t write(uint8_t data) override;
+	size_t write(const uint8_t *data, size_t size) override;
+	using Print::write;
+	int available() override;
+	int read() override;
+	int peek() override;
+	uint8_t busNumber() const { return bus; }
+	uint32_t clock() const { return clockHz; }
+
+private:
+	uint8_t bus;
+	uint32_t clockHz = 100000;
+	uint8_t txAddress = 0;
+	uint8_t txBuffer[BUFFER_LENGTH];
+	uint8_t txLength = 0;
+	uint8_t rxBuffer[BUFFER_LENGTH];
+	uint8_t rxLength = 0;
+	uint8_t rxPosition = 0;
+};
+
+extern TwoWire Wire;
+extern TwoWire Wire1;
+
+#endif
@@ -0,0 +1,252 @@
+/*
+  Arduino core of the host build: simulated time, pins, Print, the serial
+  port and the EEPROM.  See Arduino.h.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include <stdio.h>
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "sim_bus.h"
+#include "sim_internal.h"
+
+// Transmit buffer of the serial port, 64 bytes with 1 always free like the AVR core
+const int SERIAL_TX_ROOM = 63;
+const uint8_t HOST_PINS = 64;
+
+unsigned long long simTimeUs = 0;
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+
+static std::string serialOutput;
+static std::string serialInput;
+static size_t serialInputPosition = 0;
+static unsigned long serialByteUs = 0;  // 0 until begin(), the port never fills then
+static unsigned long long serialIdleAt = 0;  // when the transmit buffer is empty
+static uint8_t pinLevels[HOST_PINS];
+static uint8_t eeprom[HOST_EEPROM_SIZE];
+static unsigned long eepromWrites = 0;
+
+void simResetCore() {
+    simTimeUs = 0;
+    serialOutput.clear();
+    serialInput.clear();
+    serialInputPosition = 0;
+    serialByteUs = 0;
+    serialIdleAt = 0;
+    memset(pinLevels, HIGH, sizeof(pinLevels));  // pulled up
+    memset(eeprom, 0xFF, sizeof(eeprom));  // erased
+    eepromWrites = 0;
+}
+
+unsigned long long simNowUs() {
+    return simTimeUs;
+}
+
+std::string &simSerialOutput() {
+    return serialOutput;
+}
+
+void simSerialInput(const std::string &text) {
+    serialInput.append(text);
+}
+
+unsigned long simEepromWrites() {
+    return eepromWrites;
+}
+
+// ---- time and pins
+
+unsigned long millis() {
+    simTimeUs += 1;
+    return (unsigned long)(simTimeUs / 1000);
+}
+
+unsigned long micros() {
+    simTimeUs += 1;
+    return (unsigned long)simTimeUs;
+}
+
+void delay(unsigned long ms) {
+    simTimeUs += 1000ULL * ms;
+}
+
+void delayMicroseconds(unsigned int us) {
+    simTimeUs += us;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin < HOST_PINS && mode != OUTPUT) {
+        pinLevels[pin] = HIGH;  // released, the pull up takes it high
+    }
+}
+
+int digitalRead(uint8_t pin) {
+    int level = simInterruptPinLevel(pin);
+    if (level >= 0) {
+        return level;
+    }
+    return pin < HOST_PINS ? pinLevels[pin] : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    if (pin < HOST_PINS) {
+        pinLevels[pin] = value ? HIGH : LOW;
+    }
+}
+
+// ---- Print
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (n < size && write(buffer[n])) {
+        n++;
+    }
+    return n;
+}
+
+size_t Print::printNumber(unsigned long value, int base) {
+    char text[8 * sizeof(long) + 1];
+    char *digit = &text[sizeof(text) - 1];
+    *digit = '\0';
+    if (base < 2) {
+        base = 10;
+    }
+    do {
+        unsigned long remainder = value % base;
+        value /= base;
+        *--digit = remainder < 10 ? '0' + remainder : 'A' + remainder - 10;
+    } while (value != 0);
+    return write(digit);
+}
+
+size_t Print::print(const char text[]) {
+    return write(text);
+}
+
+size_t Print::print(char c) {
+    return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char value, int base) {
+    return printNumber(value, base);
+}
+
+size_t Print::print(int value, int base) {
+    return print((long)value, base);
+}
+
+size_t Print::print(unsigned int value, int base) {
+    return printNumber(value, base);
+}
+
+size_t Print::print(long value, int base) {
+    if (base == DEC && value < 0) {
+        return print('-') + printNumber(0UL - (unsigned long)value, DEC);
+    }
+    return printNumber((unsigned long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base) {
+    return printNumber(value, base);
+}
+
+size_t Print::print(double value, int digits) {
+    /* Same special cases as the AVR core */
+    if (isnan(value)) {
+        return print("nan");
+    }
+    if (isinf(value)) {
+        return print("inf");
+    }
+    if (value > 4294967040.0 || value < -4294967040.0) {
+        return print("ovf");
+    }
+    char text[48];
+    snprintf(text, sizeof(text), "%.*f", digits, value);
+    return write(text);
+}
+
+size_t Print::println() {
+    return write("\r\n");
+}
+
+// ---- serial port
+
+void HardwareSerial::begin(unsigned long baud) {
+    serialByteUs = baud ? 10000000UL / baud : 0;  // start, 8 data and stop bits
+    serialIdleAt = simTimeUs;
+}
+
+void HardwareSerial::end() {
+    flush();
+    serialByteUs = 0;
+}
+
+int HardwareSerial::availableForWrite() {
+    if (serialByteUs == 0 || serialIdleAt <= simTimeUs) {
+        return SERIAL_TX_ROOM;
+    }
+    int used = (int)((serialIdleAt - simTimeUs + serialByteUs - 1) / serialByteUs);
+    return used >= SERIAL_TX_ROOM ? 0 : SERIAL_TX_ROOM - used;
+}
+
+size_t HardwareSerial::write(uint8_t data) {
+    /* Wait for room in the transmit buffer, then the byte goes out after the ones in it */
+    if (serialByteUs != 0) {
+        if (availableForWrite() == 0) {
+            simTimeUs = serialIdleAt - (unsigned long long)(SERIAL_TX_ROOM - 1) * serialByteUs;
+        }
+        serialIdleAt = (serialIdleAt > simTimeUs ? serialIdleAt : simTimeUs) + serialByteUs;
+    }
+    serialOutput.push_back((char)data);
+    return 1;
+}
+
+void HardwareSerial::flush() {
+    /* Wait for the transmit buffer to empty */
+    if (serialByteUs != 0 && serialIdleAt > simTimeUs) {
+        simTimeUs = serialIdleAt;
+    }
+}
+
+int HardwareSerial::available() {
+    return (int)(serialInput.size() - serialInputPosition);
+}
+
+int HardwareSerial::read() {
+    if (serialInputPosition >= serialInput.size()) {
+        return -1;
+    }
+    return (uint8_t)serialInput[serialInputPosition++];
+}
+
+int HardwareSerial::peek() {
+    if (serialInputPosition >= serialInput.size()) {
+        return -1;
+    }
+    return (uint8_t)serialInput[serialInputPosition];
+}
+
+// ---- EEPROM
+
+uint8_t EEPROMClass::read(int address) {
+    return (address >= 0 && address < HOST_EEPROM_SIZE) ? eeprom[address] : 0xFF;
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+    if (address >= 0 && address < HOST_EEPROM_SIZE) {
+        eeprom[address] = value;
+        eepromWrites += 1;
+    }
+}
+
+void EEPROMClass::update(int address, uint8_t value) {
+    if (read(address) != value) {
+        write(address, value);
+    }
+}
@@ -0,0 +1,539 @@
+/*
+  Simulated muxes, sensors and buttons behind the host TwoWire, see sim_bus.h.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include "Wire.h"
+#include "sim_bus.h"
+#include "sim_internal.h"
+
+// AS726x I2C registers, the virtual registers are reached through these
+const uint8_t SENSOR_STATUS_REG = 0x00;
+const uint8_t SENSOR_WRITE_REG = 0x01;
+const uint8_t SENSOR_READ_REG = 0x02;
+const uint8_t SENSOR_RX_VALID = 0x01;
+// Virtual registers
+const uint8_t V_HW_VERSION = 0x00;
+const uint8_t V_CONTROL_SETUP = 0x04;
+const uint8_t V_INT_TIME = 0x05;
+const uint8_t V_TEMPERATURE = 0x06;
+const uint8_t V_LED_CONTROL = 0x07;
+const uint8_t V_FIRST_RAW = 0x08;
+const uint8_t V_FIRST_CAL = 0x14;
+const uint8_t V_LAST_CAL = 0x2B;
+const uint8_t V_DEV_SELECT = 0x4F;
+const uint8_t CONTROL_DATA_READY = 0x02;
+const uint8_t LED_DRIVE_ON = 0x08;
+const uint8_t SLAVES_FOUND = 0x30;  // DEV_SELECT bits of the AS7265X visible and UV devices
+// Qwiic button
+const uint8_t BUTTON_REGISTERS = 32;
+const uint8_t BUTTON_ID_VALUE = 0x5D;
+const uint8_t BUTTON_STATUS_REG = 0x03;
+const uint8_t BUTTON_INTERRUPT_REG = 0x04;
+const uint8_t BUTTON_LED_REG = 0x19;
+const uint8_t BUTTON_EVENT = 0x01;
+const uint8_t BUTTON_CLICKED = 0x02;
+const uint8_t BUTTON_CLICKED_INTERRUPT = 0x01;
+// Counts per integration cycle at 1x gain for a reflectance and light of 1
+const float COUNTS_PER_CYCLE = 1.5f;
+const float GAIN_FACTORS[4] = { 1.0f, 3.7f, 16.0f, 64.0f };
+const float BULB_LIGHT[4] = { 1.0f, 2.0f, 4.0f, 8.0f };  // 12.5, 25, 50 and 100 mA
+const uint8_t SIM_DEVICES = 3;
+const uint8_t SIM_CHANNELS = 6;
+const uint8_t DIRECT = SIM_MUXES;  // position index of the devices straight on the bus
+
+struct SimSensor {
+    bool present;
+    uint8_t code;
+    uint8_t status;
+    uint8_t readValue;
+    int pendingWrite;  // virtual register being written, -1 if none
+    uint8_t pointer;  // I2C register the next read is from
+    uint8_t control;
+    uint8_t integration;
+    uint8_t device;  // AS7265X device selected
+    uint8_t led[SIM_DEVICES];
+    bool measuring;
+    unsigned long long readyAt;
+    uint16_t raw[SIM_DEVICES][SIM_CHANNELS];
+    float calibrated[SIM_DEVICES][SIM_CHANNELS];
+    float reflectance;
+    float ambient;
+    float flicker;  // more ambient light on every flickerPeriod-th measurement
+    uint8_t flickerPeriod;
+    unsigned long measurements;  // since the flicker was set
+    unsigned long long bulbOnUs[SIM_DEVICES];
+    unsigned long long bulbOnSince[SIM_DEVICES];
+};
+
+struct SimButton {
+    bool present;
+    uint8_t registers[BUTTON_REGISTERS];
+    uint8_t pointer;
+};
+
+struct SimPosition {
+    SimSensor sensor;
+    SimButton button;
+    float errorRate;
+    unsigned long maxClock;  // 0 works at any clock
+};
+
+struct SimMux {
+    bool present;
+    uint8_t channels;
+};
+
+static SimMux muxes[SIM_BUSES][SIM_MUXES];
+static SimPosition positions[SIM_BUSES][SIM_MUXES + 1][8];
+static bool stuckBuses[SIM_BUSES];
+static unsigned long restarts[SIM_BUSES];
+static SimBusCounters counters;
+static unsigned long failCount = 0;
+static uint8_t failError = 2;
+static unsigned long cycleUs = SIM_DEFAULT_CYCLE_US;
+static uint8_t interruptPin = 0xFF;
+static uint32_t randomState = 1;
+
+TwoWire Wire(0);
+TwoWire Wire1(1);
+
+static SimPosition &position(uint8_t bus, uint8_t mux, uint8_t channel) {
+    return positions[bus % SIM_BUSES][mux == SIM_NO_MUX ? DIRECT : mux % SIM_MUXES][channel % 8];
+}
+
+static float nextRandom() {
+    randomState = randomState * 1103515245UL + 12345UL;
+    return ((randomState >> 8) & 0xFFFF) / 65536.0f;
+}
+
+void simReset() {
+    simResetCore();
+    memset(muxes, 0, sizeof(muxes));
+    memset(positions, 0, sizeof(positions));
+    memset(stuckBuses, 0, sizeof(stuckBuses));
+    memset(restarts, 0, sizeof(restarts));
+    counters = SimBusCounters {};
+    failCount = 0;
+    cycleUs = SIM_DEFAULT_CYCLE_US;
+    interruptPin = 0xFF;
+    randomState = 1;
+    Wire.setClock(100000);
+    Wire1.setClock(100000);
+}
+
+void simAddMux(uint8_t bus, uint8_t mux) {
+    muxes[bus % SIM_BUSES][mux % SIM_MUXES] = SimMux { true, 0 };
+}
+
+void simAddSensor(uint8_t bus, uint8_t mux, uint8_t channel, uint8_t hardwareCode) {
+    SimSensor &sensor = position(bus, mux, channel).sensor;
+    memset(&sensor, 0, sizeof(sensor));
+    sensor.present = true;
+    sensor.code = hardwareCode;
+    sensor.pendingWrite = -1;
+    sensor.integration = 0xFF;  // power on value
+    sensor.reflectance = 1.0f;
+    sensor.ambient = 1.0f;
+}
+
+void simAddButton(uint8_t bus, uint8_t mux, uint8_t channel) {
+    SimButton &button = position(bus, mux, channel).button;
+    memset(&button, 0, sizeof(button));
+    button.present = true;
+    button.registers[0] = BUTTON_ID_VALUE;
+}
+
+void simRemoveDevices(uint8_t bus, uint8_t mux, uint8_t channel) {
+    position(bus, mux, channel).sensor.present = false;
+    position(bus, mux, channel).button.present = false;
+}
+
+void simSetScene(uint8_t bus, uint8_t mux, uint8_t channel, float reflectance, float ambient) {
+    position(bus, mux, channel).sensor.reflectance = reflectance;
+    position(bus, mux, channel).sensor.ambient = ambient;
+}
+
+void simSetFlicker(uint8_t bus, uint8_t mux, uint8_t channel, float extraAmbient, uint8_t period) {
+    SimSensor &sensor = position(bus, mux, channel).sensor;
+    sensor.flicker = extraAmbient;
+    sensor.flickerPeriod = period;
+    sensor.measurements = 0;
+}
+
+unsigned long long simBulbOnUs(uint8_t bus, uint8_t mux, uint8_t channel, uint8_t device) {
+    const SimSensor &sensor = position(bus, mux, channel).sensor;
+    if (device >= SIM_DEVICES) {
+        return 0;
+    }
+    unsigned long long total = sensor.bulbOnUs[device];
+    if (sensor.led[device] & LED_DRIVE_ON) {
+        total += simTimeUs - sensor.bulbOnSince[device];
+    }
+    return total;
+}
+
+void simSetCycleUs(unsigned long us) {
+    cycleUs = us;
+}
+
+void simClickButton(uint8_t bus, uint8_t mux, uint8_t channel) {
+    position(bus, mux, channel).button.registers[BUTTON_STATUS_REG] |= BUTTON_EVENT | BUTTON_CLICKED;
+}
+
+uint8_t simButtonLed(uint8_t bus, uint8_t mux, uint8_t channel) {
+    return position(bus, mux, channel).button.registers[BUTTON_LED_REG];
+}
+
+void simSetButtonInterruptPin(uint8_t pin) {
+    interruptPin = pin;
+}
+
+int simInterruptPinLevel(uint8_t pin) {
+    if (pin != interruptPin) {
+        return -1;
+    }
+    for (uint8_t bus = 0; bus < SIM_BUSES; bus++) {
+        for (uint8_t mux = 0; mux <= SIM_MUXES; mux++) {
+            for (uint8_t channel = 0; channel < 8; channel++) {
+                const SimButton &button = positions[bus][mux][channel].button;
+                if (button.present && (button.registers[BUTTON_INTERRUPT_REG] & BUTTON_CLICKED_INTERRUPT) &&
+                    (button.registers[BUTTON_STATUS_REG] & BUTTON_EVENT)) {
+                    return LOW;
+                }
+            }
+        }
+    }
+    return HIGH;
+}
+
+void simFailNext(unsigned long transactions, uint8_t error) {
+    failCount = transactions;
+    failError = error;
+}
+
+void simSetErrorRate(uint8_t bus, uint8_t mux, uint8_t channel, float rate) {
+    position(bus, mux, channel).errorRate = rate;
+}
+
+void simSetMaxClock(uint8_t bus, uint8_t mux, uint8_t channel, unsigned long hz) {
+    position(bus, mux, channel).maxClock = hz;
+}
+
+void simSetStuck(uint8_t bus, bool stuck) {
+    stuckBuses[bus % SIM_BUSES] = stuck;
+}
+
+unsigned long simBusRestarts(uint8_t bus) {
+    return restarts[bus % SIM_BUSES];
+}
+
+SimBusCounters simCounters() {
+    return counters;
+}
+
+void simResetCounters() {
+    counters = SimBusCounters {};
+}
+
+// ---- sensor
+
+static void putFloat(uint8_t *bytes, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    for (uint8_t i = 0; i < 4; i++) {
+        bytes[i] = bits >> (24 - 8 * i);
+    }
+}
+
+static void switchLed(SimSensor &sensor, uint8_t device, uint8_t value) {
+    bool wasOn = sensor.led[device] & LED_DRIVE_ON;
+    bool isOn = value & LED_DRIVE_ON;
+    if (!wasOn && isOn) {
+        sensor.bulbOnSince[device] = simTimeUs;
+    }
+    else if (wasOn && !isOn) {
+        sensor.bulbOnUs[device] += simTimeUs - sensor.bulbOnSince[device];
+    }
+    sensor.led[device] = value;
+}
+
+static void finishMeasurement(SimSensor &sensor) {
+    /* Fill in the data registers from the scene, the light of every bulb that is on
+    reaches all the devices */
+    uint8_t devices = (sensor.code == SIM_AS7265X) ? SIM_DEVICES : 1;
+    float light = sensor.ambient;
+    if (sensor.flickerPeriod != 0 && sensor.measurements % sensor.flickerPeriod == sensor.flickerPeriod - 1u) {
+        light += sensor.flicker;
+    }
+    sensor.measurements++;
+    for (uint8_t device = 0; device < devices; device++) {
+        if (sensor.led[device] & LED_DRIVE_ON) {
+            light += BULB_LIGHT[(sensor.led[device] >> 4) & 0x03];
+        }
+    }
+    float gain = GAIN_FACTORS[(sensor.control >> 4) & 0x03];
+    for (uint8_t device = 0; device < devices; device++) {
+        for (uint8_t channel = 0; channel < SIM_CHANNELS; channel++) {
+            float shape = 0.5f + (SIM_CHANNELS * device + channel) / 18.0f;
+            float counts = sensor.reflectance * light * shape * sensor.integration * COUNTS_PER_CYCLE;
+            float raw = counts * gain;
+            sensor.raw[device][channel] = raw > 65535.0f ? 65535 : (uint16_t)raw;
+            sensor.calibrated[device][channel] = counts;
+        }
+    }
+    sensor.measuring = false;
+    sensor.control |= CONTROL_DATA_READY;
+}
+
+static uint8_t readVirtual(SimSensor &sensor, uint8_t address) {
+    if (sensor.measuring && simTimeUs >= sensor.readyAt) {
+        finishMeasurement(sensor);
+    }
+    uint8_t device = (sensor.code == SIM_AS7265X) ? sensor.device : 0;
+    switch (address) {
+        case V_HW_VERSION:
+            return sensor.code;
+        case V_CONTROL_SETUP:
+            return sensor.control;
+        case V_INT_TIME:
+            return sensor.integration;
+        case V_TEMPERATURE:
+            return 25;
+        case V_LED_CONTROL:
+            return sensor.led[device];
+        case V_DEV_SELECT:
+            return (sensor.code == SIM_AS7265X) ? (sensor.device | SLAVES_FOUND) : 0;
+    }
+    if (address >= V_FIRST_RAW && address < V_FIRST_CAL) {
+        uint16_t value = sensor.raw[device][(address - V_FIRST_RAW) / 2];
+        return ((address - V_FIRST_RAW) % 2 == 0) ? value >> 8 : value & 0xFF;
+    }
+    if (address >= V_FIRST_CAL && address <= V_LAST_CAL) {
+        uint8_t bytes[4];
+        putFloat(bytes, sensor.calibrated[device][(address - V_FIRST_CAL) / 4]);
+        return bytes[(address - V_FIRST_CAL) % 4];
+    }
+    return 0;
+}
+
+static void writeVirtual(SimSensor &sensor, uint8_t address, uint8_t value) {
+    uint8_t device = (sensor.code == SIM_AS7265X) ? sensor.device : 0;
+    switch (address) {
+        case V_CONTROL_SETUP: {
+            sensor.control = value & 0x7F;  // the reset bit is not kept
+            uint8_t mode = (value >> 2) & 0x03;
+            // modes 2 (all channels continuous) and 3 (one shot) start a measurement
+            // of 2 integration periods when the data ready bit is written as 0
+            if (mode >= 2 && !(value & CONTROL_DATA_READY)) {
+                sensor.measuring = true;
+                sensor.readyAt = simTimeUs + 2ULL * sensor.integration * cycleUs;
+            }
+            break;
+        }
+        case V_INT_TIME:
+            sensor.integration = value;
+            break;
+        case V_LED_CONTROL:
+            switchLed(sensor, device, value);
+            break;
+        case V_DEV_SELECT:
+            sensor.device = value & 0x03;
+            break;
+    }
+}
+
+static void sensorWrite(SimSensor &sensor, const uint8_t *data, uint8_t length) {
+    if (length == 0) {
+        return;
+    }
+    sensor.pointer = data[0];
+    if (length < 2 || data[0] != SENSOR_WRITE_REG) {
+        return;
+    }
+    if (sensor.pendingWrite >= 0) {
+        writeVirtual(sensor, sensor.pendingWrite, data[1]);
+        sensor.pendingWrite = -1;
+    }
+    else if (data[1] & 0x80) {
+        sensor.pendingWrite = data[1] & 0x7F;
+    }
+    else {
+        sensor.readValue = readVirtual(sensor, data[1]);
+        sensor.status |= SENSOR_RX_VALID;
+    }
+}
+
+static uint8_t sensorRead(SimSensor &sensor) {
+    if (sensor.pointer == SENSOR_STATUS_REG) {
+        return sensor.status;
+    }
+    if (sensor.pointer == SENSOR_READ_REG) {
+        sensor.status &= ~SENSOR_RX_VALID;
+        return sensor.readValue;
+    }
+    return 0;
+}
+
+// ---- bus
+
+static void transactionTime(uint32_t clockHz, uint8_t bytes) {
+    /* Start, address byte and the data bytes with their acks, and the stop */
+    unsigned long bits = 2 + 9UL * (1 + bytes);
+    simTimeUs += (bits * 1000000UL + clockHz - 1) / clockHz;
+}
+
+static SimPosition *findDevice(uint8_t bus, uint8_t address) {
+    /* The device at address that is on the bus or behind an open mux channel */
+    for (uint8_t mux = 0; mux <= SIM_MUXES; mux++) {
+        for (uint8_t channel = 0; channel < 8; channel++) {
+            bool open = (mux == DIRECT) ? channel == 0 :
+                        (muxes[bus][mux].present && (muxes[bus][mux].channels & (1 << channel)));
+            if (!open) {
+                continue;
+            }
+            SimPosition &candidate = positions[bus][mux][channel];
+            if ((address == SIM_SENSOR_ADDRESS && candidate.sensor.present) ||
+                (address == SIM_BUTTON_ADDRESS && candidate.button.present)) {
+                return &candidate;
+            }
+        }
+    }
+    return nullptr;
+}
+
+static uint8_t checkTransaction(uint8_t bus, uint32_t clockHz, uint8_t address, SimPosition *&device) {
+    /* 0 if the transaction goes through, otherwise the Wire error it ends with */
+    device = nullptr;
+    if (stuckBuses[bus]) {
+        return 4;
+    }
+    if (failCount > 0) {
+        failCount--;
+        return failError;
+    }
+    if (address >= SIM_MUX_ADDRESS && address < SIM_MUX_ADDRESS + SIM_MUXES) {
+        return muxes[bus][address - SIM_MUX_ADDRESS].present ? 0 : 2;
+    }
+    device = findDevice(bus, address);
+    if (device == nullptr) {
+        return 2;
+    }
+    if ((device->maxClock != 0 && clockHz > device->maxClock) ||
+        (device->errorRate > 0 && nextRandom() < device->errorRate)) {
+        return 3;
+    }
+    return 0;
+}
+
+TwoWire::TwoWire(uint8_t busNumber) : bus(busNumber % SIM_BUSES) {
+}
+
+void TwoWire::begin() {
+}
+
+void TwoWire::end() {
+    /* The library restarts a stuck bus with end(), the bus clear and begin() */
+    stuckBuses[bus] = false;
+    restarts[bus] += 1;
+}
+
+void TwoWire::setClock(uint32_t hz) {
+    clockHz = hz ? hz : 100000;
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+    txAddress = address;
+    txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t data) {
+    if (txLength >= BUFFER_LENGTH) {
+        return 0;
+    }
+    txBuffer[txLength++] = data;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t size) {
+    size_t n = 0;
+    while (n < size && write(data[n])) {
+        n++;
+    }
+    return n;
+}
+
+uint8_t TwoWire::endTransmission(bool) {
+    counters.transactions += 1;
+    counters.bytesWritten += txLength;
+    transactionTime(clockHz, txLength);
+    SimPosition *device;
+    uint8_t error = checkTransaction(bus, clockHz, txAddress, device);
+    if (error != 0) {
+        counters.nacks += 1;
+        return error;
+    }
+    if (device == nullptr) {  // a mux
+        if (txLength > 0) {
+            muxes[bus][txAddress - SIM_MUX_ADDRESS].channels = txBuffer[txLength - 1];
+        }
+    }
+    else if (txAddress == SIM_SENSOR_ADDRESS) {
+        sensorWrite(device->sensor, txBuffer, txLength);
+    }
+    else if (txLength > 0) {
+        SimButton &button = device->button;
+        button.pointer = txBuffer[0];
+        for (uint8_t i = 1; i < txLength; i++) {
+            button.registers[(txBuffer[0] + i - 1) % BUTTON_REGISTERS] = txBuffer[i];
+        }
+    }
+    return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint8_t) {
+    rxLength = 0;
+    rxPosition = 0;
+    quantity = min(quantity, (uint8_t)BUFFER_LENGTH);
+    counters.transactions += 1;
+    SimPosition *device;
+    uint8_t error = checkTransaction(bus, clockHz, address, device);
+    if (error != 0) {
+        counters.nacks += 1;
+        transactionTime(clockHz, 0);
+        return 0;
+    }
+    for (uint8_t i = 0; i < quantity; i++) {
+        if (device == nullptr) {
+            rxBuffer[i] = muxes[bus][address - SIM_MUX_ADDRESS].channels;
+        }
+        else if (address == SIM_SENSOR_ADDRESS) {
+            rxBuffer[i] = sensorRead(device->sensor);
+        }
+        else {
+            SimButton &button = device->button;
+            rxBuffer[i] = button.registers[button.pointer % BUTTON_REGISTERS];
+            button.pointer += 1;
+        }
+    }
+    rxLength = quantity;
+    counters.bytesRead += quantity;
+    transactionTime(clockHz, quantity);
+    return quantity;
+}
+
+int TwoWire::available() {
+    return rxLength - rxPosition;
+}
+
+int TwoWire::read() {
+    return rxPosition < rxLength ? rxBuffer[rxPosition++] : -1;
+}
+
+int TwoWire::peek() {
+    return rxPosition < rxLength ? rxBuffer[rxPosition] : -1;
+}
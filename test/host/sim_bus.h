@@ -0,0 +1,95 @@
+/*
+  Simulated bus for the host build: TCA9548A muxes, AS7262 / AS7263 / AS7265X
+  sensors and Qwiic buttons on the Wire (bus 0) and Wire1 (bus 1) of Wire.h.
+  A device is either behind a mux channel or straight on the bus (SIM_NO_MUX),
+  it answers when the path to it is open like on the real bus.
+
+  Timing model: each transaction takes its bits (address, data, ack, start and
+  stop) at the bus clock set with setClock().  A one shot measurement takes
+  2 integration periods of integrationTime * 2.8 ms, the cycle time can be changed.
+
+  Faults: the next n transactions can be made to fail, each device can get a
+  random error rate and the fastest clock it works at (faster transactions are
+  not acknowledged), and a bus can be held stuck until the library restarts it.
+
+  Every transaction is counted in SimBusCounters, including the ones the
+  SparkFun drivers make, unlike the library's own BusStats.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#ifndef _SIM_BUS_H
+#define _SIM_BUS_H
+
+#include <stdint.h>
+#include <string>
+
+const uint8_t SIM_BUSES = 2;
+const uint8_t SIM_MUXES = 8;  // per bus, at 0x70 to 0x77
+const uint8_t SIM_NO_MUX = 0xFF;  // the device is straight on the bus
+const uint8_t SIM_MUX_ADDRESS = 0x70;
+const uint8_t SIM_SENSOR_ADDRESS = 0x49;
+const uint8_t SIM_BUTTON_ADDRESS = 0x6F;
+const unsigned long SIM_DEFAULT_CYCLE_US = 2800;
+
+// Hardware version codes of the sensors
+const uint8_t SIM_AS7262 = 0x3E;
+const uint8_t SIM_AS7263 = 0x3F;
+const uint8_t SIM_AS7265X = 0x41;
+
+struct SimBusCounters {
+	unsigned long transactions;  // every start condition, write or read
+	unsigned long bytesWritten;  // data bytes, not the address byte
+	unsigned long bytesRead;
+	unsigned long nacks;  // transactions that failed
+};
+
+// Start again with an empty bus, a clear clock and an erased EEPROM
+void simReset();
+
+// Devices, bus is 0 for Wire and 1 for Wire1, mux 0 is at 0x70
+void simAddMux(uint8_t bus, uint8_t mux);
+void simAddSensor(uint8_t bus, uint8_t mux, uint8_t channel, uint8_t hardwareCode);
+void simAddButton(uint8_t bus, uint8_t mux, uint8_t channel);
+void simRemoveDevices(uint8_t bus, uint8_t mux, uint8_t channel);
+
+// What a sensor sees, the counts scale with the integration time, gain and the
+// current of each bulb that is on.  ambient is the light without the bulbs.
+void simSetScene(uint8_t bus, uint8_t mux, uint8_t channel, float reflectance, float ambient);
+// From the next measurement, every period-th one has extraAmbient more light, 0 stops it
+void simSetFlicker(uint8_t bus, uint8_t mux, uint8_t channel, float extraAmbient, uint8_t period);
+// Total time each bulb (0 white, 1 IR, 2 UV by AS7265X device) of a sensor was on
+unsigned long long simBulbOnUs(uint8_t bus, uint8_t mux, uint8_t channel, uint8_t device);
+void simSetCycleUs(unsigned long cycleUs);
+
+// Buttons, a click stays until the library clears the event bits
+void simClickButton(uint8_t bus, uint8_t mux, uint8_t channel);
+uint8_t simButtonLed(uint8_t bus, uint8_t mux, uint8_t channel);
+// Pin held low while a button with the clicked interrupt on has an event
+void simSetButtonInterruptPin(uint8_t pin);
+
+// Faults
+void simFailNext(unsigned long transactions, uint8_t error = 2);
+void simSetErrorRate(uint8_t bus, uint8_t mux, uint8_t channel, float rate);
+void simSetMaxClock(uint8_t bus, uint8_t mux, uint8_t channel, unsigned long hz);
+void simSetStuck(uint8_t bus, bool stuck);
+unsigned long simBusRestarts(uint8_t bus);
+
+// Bus traffic of all the buses since simReset() or simResetCounters()
+SimBusCounters simCounters();
+void simResetCounters();
+
+// Time in microseconds since simReset()
+unsigned long long simNowUs();
+
+// Serial port, what the sketch wrote and the text the host sends to it
+std::string &simSerialOutput();
+void simSerialInput(const std::string &text);
+
+// EEPROM bytes written (not counting writes of the same value with update())
+unsigned long simEepromWrites();
+
+#endif
@@ -0,0 +1,19 @@
+/*
+  What the host Arduino core and the simulated bus share, not for the tests.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#ifndef _SIM_INTERNAL_H
+#define _SIM_INTERNAL_H
+
+#include <stdint.h>
+
+extern unsigned long long simTimeUs;
+void simResetCore();  // time, serial port, pins and EEPROM
+int simInterruptPinLevel(uint8_t pin);  // LOW, HIGH or -1 if pin is not the button interrupt
+
+#endif
@@ -0,0 +1,310 @@
+/*
+  Host builds of the SparkFun AS726X, AS7265X and Qwiic Button drivers.  Each
+  function makes the same I2C transactions as the driver it stands in for, so
+  the bus benchmark sees the traffic they add to begin() and the button handling.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include "AS726X.h"
+#include "SparkFun_AS7265X.h"
+#include "SparkFun_Qwiic_Button.h"
+
+const uint8_t SENSOR_ADDRESS = 0x49;
+const uint8_t STATUS_REG = 0x00;
+const uint8_t WRITE_REG = 0x01;
+const uint8_t READ_REG = 0x02;
+const uint8_t TX_VALID = 0x02;
+const uint8_t RX_VALID = 0x01;
+const uint8_t POLLING_DELAY_MS = 5;
+const uint8_t MAX_POLLS = 20;  // the real drivers wait forever, a missing sensor should not hang a test
+const uint8_t HW_VERSION = 0x00;
+const uint8_t CONTROL_SETUP = 0x04;
+const uint8_t INT_TIME = 0x05;
+const uint8_t LED_CONTROL = 0x07;
+const uint8_t DEV_SELECT = 0x4F;
+
+// ---- virtual register access shared by the AS726X and AS7265X drivers
+
+static uint8_t readRegister(TwoWire *port, uint8_t address) {
+    port->beginTransmission(SENSOR_ADDRESS);
+    port->write(address);
+    if (port->endTransmission() != 0) {
+        return 0;
+    }
+    port->requestFrom(SENSOR_ADDRESS, (uint8_t)1);
+    return port->available() ? port->read() : 0;
+}
+
+static void writeRegister(TwoWire *port, uint8_t address, uint8_t value) {
+    port->beginTransmission(SENSOR_ADDRESS);
+    port->write(address);
+    port->write(value);
+    port->endTransmission();
+}
+
+static bool waitForStatus(TwoWire *port, uint8_t mask, bool set) {
+    for (uint8_t i = 0; i < MAX_POLLS; i++) {
+        bool isSet = readRegister(port, STATUS_REG) & mask;
+        if (isSet == set) {
+            return true;
+        }
+        delay(POLLING_DELAY_MS);
+    }
+    return false;
+}
+
+static uint8_t virtualReadRegister(TwoWire *port, uint8_t virtualAddress) {
+    if (readRegister(port, STATUS_REG) & RX_VALID) {
+        readRegister(port, READ_REG);  // throw away a byte left from before
+    }
+    if (!waitForStatus(port, TX_VALID, false)) {
+        return 0;
+    }
+    writeRegister(port, WRITE_REG, virtualAddress);
+    if (!waitForStatus(port, RX_VALID, true)) {
+        return 0;
+    }
+    return readRegister(port, READ_REG);
+}
+
+static void virtualWriteRegister(TwoWire *port, uint8_t virtualAddress, uint8_t value) {
+    if (!waitForStatus(port, TX_VALID, false)) {
+        return;
+    }
+    writeRegister(port, WRITE_REG, virtualAddress | 0x80);
+    if (!waitForStatus(port, TX_VALID, false)) {
+        return;
+    }
+    writeRegister(port, WRITE_REG, value);
+}
+
+static void changeBits(TwoWire *port, uint8_t virtualAddress, uint8_t mask, uint8_t bits) {
+    uint8_t value = virtualReadRegister(port, virtualAddress);
+    virtualWriteRegister(port, virtualAddress, (value & ~mask) | (bits & mask));
+}
+
+// ---- AS726X
+
+bool AS726X::begin(TwoWire &wirePort, uint8_t gain, uint8_t measurementMode) {
+    _i2cPort = &wirePort;
+    _sensorVersion = virtualReadRegister(_i2cPort, HW_VERSION);
+    if (_sensorVersion != 0x3E && _sensorVersion != 0x3F) {
+        return false;
+    }
+    setBulbCurrent(0b00);
+    disableBulb();
+    setIndicatorCurrent(0b11);
+    disableIndicator();
+    setIntegrationTime(50);
+    setGain(gain);
+    setMeasurementMode(measurementMode);
+    return true;
+}
+
+uint8_t AS726X::getVersion() {
+    return _sensorVersion;
+}
+
+void AS726X::setMeasurementMode(uint8_t mode) {
+    changeBits(_i2cPort, CONTROL_SETUP, 0x0C, (mode & 0x03) << 2);
+}
+
+void AS726X::setIntegrationTime(uint8_t integrationValue) {
+    virtualWriteRegister(_i2cPort, INT_TIME, integrationValue);
+}
+
+void AS726X::setGain(uint8_t gain) {
+    changeBits(_i2cPort, CONTROL_SETUP, 0x30, (gain & 0x03) << 4);
+}
+
+void AS726X::setBulbCurrent(uint8_t current) {
+    changeBits(_i2cPort, LED_CONTROL, 0x30, (current & 0x03) << 4);
+}
+
+void AS726X::disableBulb() {
+    changeBits(_i2cPort, LED_CONTROL, 0x08, 0);
+}
+
+void AS726X::setIndicatorCurrent(uint8_t current) {
+    changeBits(_i2cPort, LED_CONTROL, 0x06, (current & 0x03) << 1);
+}
+
+void AS726X::disableIndicator() {
+    changeBits(_i2cPort, LED_CONTROL, 0x01, 0);
+}
+
+// ---- AS7265X
+
+bool AS7265X::begin(TwoWire &wirePort) {
+    _i2cPort = &wirePort;
+    if (!isConnected()) {
+        return false;
+    }
+    if ((virtualReadRegister(_i2cPort, DEV_SELECT) & 0x30) == 0) {
+        return false;  // the visible and UV devices were not found
+    }
+    setBulbCurrent(AS7265X_LED_CURRENT_LIMIT_12_5MA, AS7265x_LED_WHITE);
+    setBulbCurrent(AS7265X_LED_CURRENT_LIMIT_12_5MA, AS7265x_LED_IR);
+    setBulbCurrent(AS7265X_LED_CURRENT_LIMIT_12_5MA, AS7265x_LED_UV);
+    disableBulb(AS7265x_LED_WHITE);
+    disableBulb(AS7265x_LED_IR);
+    disableBulb(AS7265x_LED_UV);
+    setIndicatorCurrent(0b01);
+    enableIndicator();
+    setIntegrationCycles(49);
+    setGain(0b11);
+    setMeasurementMode(0b10);
+    enableInterrupt();
+    return true;
+}
+
+bool AS7265X::isConnected() {
+    _i2cPort->beginTransmission(SENSOR_ADDRESS);
+    return _i2cPort->endTransmission() == 0;
+}
+
+void AS7265X::selectDevice(uint8_t device) {
+    virtualWriteRegister(_i2cPort, DEV_SELECT, device);
+}
+
+void AS7265X::setBulbCurrent(uint8_t current, uint8_t device) {
+    selectDevice(device);
+    changeBits(_i2cPort, LED_CONTROL, 0x30, (current & 0x03) << 4);
+}
+
+void AS7265X::disableBulb(uint8_t device) {
+    selectDevice(device);
+    changeBits(_i2cPort, LED_CONTROL, 0x08, 0);
+}
+
+void AS7265X::enableIndicator() {
+    selectDevice(AS7265x_LED_WHITE);
+    changeBits(_i2cPort, LED_CONTROL, 0x01, 0x01);
+}
+
+void AS7265X::disableIndicator() {
+    selectDevice(AS7265x_LED_WHITE);
+    changeBits(_i2cPort, LED_CONTROL, 0x01, 0);
+}
+
+void AS7265X::setIndicatorCurrent(uint8_t current) {
+    selectDevice(AS7265x_LED_WHITE);
+    changeBits(_i2cPort, LED_CONTROL, 0x06, (current & 0x03) << 1);
+}
+
+void AS7265X::setIntegrationCycles(uint8_t cycleValue) {
+    virtualWriteRegister(_i2cPort, INT_TIME, cycleValue);
+}
+
+void AS7265X::setGain(uint8_t gain) {
+    changeBits(_i2cPort, CONTROL_SETUP, 0x30, (gain & 0x03) << 4);
+}
+
+void AS7265X::setMeasurementMode(uint8_t mode) {
+    changeBits(_i2cPort, CONTROL_SETUP, 0x0C, (mode & 0x03) << 2);
+}
+
+void AS7265X::enableInterrupt() {
+    changeBits(_i2cPort, CONTROL_SETUP, 0x40, 0x40);
+}
+
+// ---- Qwiic Button
+
+bool QwiicButton::begin(uint8_t address, TwoWire &wirePort) {
+    _deviceAddress = address;
+    _i2cPort = &wirePort;
+    return isConnected() && deviceID() == DEV_ID;
+}
+
+bool QwiicButton::isConnected() {
+    _i2cPort->beginTransmission(_deviceAddress);
+    return _i2cPort->endTransmission() == 0;
+}
+
+uint8_t QwiicButton::deviceID() {
+    return readSingleRegister(BUTTON_ID);
+}
+
+bool QwiicButton::hasBeenClicked() {
+    return readSingleRegister(BUTTON_STATUS) & 0x02;
+}
+
+uint8_t QwiicButton::clearEventBits() {
+    uint8_t status = readSingleRegister(BUTTON_STATUS);
+    status &= ~0x07;  // event available, clicked and pressed
+    return writeSingleRegister(BUTTON_STATUS, status) ? 0 : 1;
+}
+
+uint16_t QwiicButton::getDebounceTime() {
+    return readDoubleRegister(BUTTON_DEBOUNCE_TIME);
+}
+
+uint8_t QwiicButton::setDebounceTime(uint16_t time) {
+    return writeDoubleRegister(BUTTON_DEBOUNCE_TIME, time) ? 0 : 1;
+}
+
+uint8_t QwiicButton::enableClickedInterrupt() {
+    uint8_t config = readSingleRegister(BUTTON_INTERRUPT_CONFIG);
+    return writeSingleRegister(BUTTON_INTERRUPT_CONFIG, config | 0x01) ? 0 : 1;
+}
+
+uint8_t QwiicButton::disableClickedInterrupt() {
+    uint8_t config = readSingleRegister(BUTTON_INTERRUPT_CONFIG);
+    return writeSingleRegister(BUTTON_INTERRUPT_CONFIG, config & ~0x01) ? 0 : 1;
+}
+
+uint8_t QwiicButton::LEDconfig(uint8_t brightness, uint16_t cycleTime, uint16_t offTime, uint8_t granularity) {
+    bool ok = writeSingleRegister(BUTTON_LED_BRIGHTNESS, brightness);
+    ok &= writeSingleRegister(BUTTON_LED_PULSE_GRANULARITY, granularity);
+    ok &= writeDoubleRegister(BUTTON_LED_PULSE_CYCLE_TIME, cycleTime);
+    ok &= writeDoubleRegister(BUTTON_LED_PULSE_OFF_TIME, offTime);
+    return ok ? 0 : 1;
+}
+
+uint8_t QwiicButton::LEDoff() {
+    return LEDconfig(0, 0, 0);
+}
+
+uint8_t QwiicButton::LEDon(uint8_t brightness) {
+    return LEDconfig(brightness, 0, 0);
+}
+
+uint8_t QwiicButton::readSingleRegister(uint8_t reg) {
+    _i2cPort->beginTransmission(_deviceAddress);
+    _i2cPort->write(reg);
+    _i2cPort->endTransmission();
+    if (_i2cPort->requestFrom(_deviceAddress, (uint8_t)1) != 0) {
+        return _i2cPort->read();
+    }
+    return 0;
+}
+
+uint16_t QwiicButton::readDoubleRegister(uint8_t reg) {
+    _i2cPort->beginTransmission(_deviceAddress);
+    _i2cPort->write(reg);
+    _i2cPort->endTransmission();
+    if (_i2cPort->requestFrom(_deviceAddress, (uint8_t)2) != 0) {
+        uint16_t low = _i2cPort->read();
+        return low | ((uint16_t)_i2cPort->read() << 8);
+    }
+    return 0;
+}
+
+bool QwiicButton::writeSingleRegister(uint8_t reg, uint8_t data) {
+    _i2cPort->beginTransmission(_deviceAddress);
+    _i2cPort->write(reg);
+    _i2cPort->write(data);
+    return _i2cPort->endTransmission() == 0;
+}
+
+bool QwiicButton::writeDoubleRegister(uint8_t reg, uint16_t data) {
+    _i2cPort->beginTransmission(_deviceAddress);
+    _i2cPort->write(reg);
+    _i2cPort->write(data & 0xFF);
+    _i2cPort->write(data >> 8);
+    return _i2cPort->endTransmission() == 0;
+}
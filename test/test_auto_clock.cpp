@@ -0,0 +1,135 @@
+/*
+  Tests of the automatic I2C clock of each port (setAutoClock()) on the simulated
+  bus: it is off unless turned on, a transaction that fails all its retries moves
+  its port 1 clock slower (once, however many tries failed), an error a retry
+  fixes does not, and a full scan finds the fastest clock a port works at.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include "asm_sensors_w_mux_library.h"
+#include "sim_bus.h"
+#include "test_check.h"
+
+static void setUp(bool withButton) {
+    /* 1 AS7262 on mux port 0, and an erased EEPROM so begin() scans.  The button
+    driver talks to the bus on its own, so the tests that count the library's
+    transactions leave it out */
+    simReset();
+    simAddMux(0, 0);
+    simAddSensor(0, 0, 0, SIM_AS7262);
+    if (withButton) {
+        simAddButton(0, 0, 0);
+    }
+    Serial.begin(115200);
+}
+
+static void testOffByDefault() {
+    /* Without setAutoClock(true) no error moves the port off 100 kHz */
+    setUp(true);
+    simSetMaxClock(0, 0, 0, 200000);
+    SpectroDesktop spectro;
+    CHECK(spectro.begin());
+    CHECK(spectro.getPortClockHz(0) == 100000);
+    spectro.resetBusStats();
+    simSetErrorRate(0, 0, 0, 0.5f);
+    for (int i = 0; i < 4; i++) {
+        spectro.readSensor(0);
+    }
+    spectro.flushOutput();
+    PortErrorStats errors = spectro.getPortErrors(0);
+    CHECK(errors.busClears > 0);
+    CHECK(errors.clockStepDowns == 0);
+    CHECK(spectro.getPortClockHz(0) == 100000);
+}
+
+static void testStepDownPerFailedTransaction() {
+    setUp(false);
+    SpectroDesktop spectro;
+    spectro.setAutoClock(true, 0);
+    CHECK(spectro.begin());
+    CHECK(spectro.getPortClockHz(0) == 400000);
+    spectro.readSensor(0);  // the port is selected and its settings read back
+
+    // errors the retries fix leave the clock alone
+    spectro.resetBusStats();
+    simFailNext(I2C_MAX_RETRIES, I2C_BUS_ERROR);
+    spectro.readSensor(0);
+    PortErrorStats errors = spectro.getPortErrors(0);
+    CHECK(errors.retries == I2C_MAX_RETRIES);
+    CHECK(errors.busClears == 0 && errors.clockStepDowns == 0);
+    CHECK(spectro.getPortClockHz(0) == 400000);
+
+    // a transaction that fails every try moves the port 1 step, not 1 per try
+    spectro.resetBusStats();
+    simFailNext(I2C_MAX_RETRIES + 1, I2C_BUS_ERROR);
+    spectro.readSensor(0);
+    errors = spectro.getPortErrors(0);
+    CHECK(errors.errors == I2C_MAX_RETRIES + 1u);
+    CHECK(errors.busClears == 1 && errors.clockStepDowns == 1);
+    CHECK(spectro.getPortClockHz(0) == 200000);
+
+    simFailNext(I2C_MAX_RETRIES + 1, I2C_BUS_ERROR);
+    spectro.readSensor(0);
+    CHECK(spectro.getPortErrors(0).clockStepDowns == 2);
+    CHECK(spectro.getPortClockHz(0) == 100000);
+    spectro.flushOutput();
+}
+
+static void testErrorRate() {
+    /* At an 8% error rate most errors are fixed by a retry, the few transactions
+    that fail every try each take the port 1 step down */
+    setUp(true);
+    SpectroDesktop spectro;
+    spectro.setAutoClock(true, 0);
+    CHECK(spectro.begin());
+    spectro.resetBusStats();
+    simSetErrorRate(0, 0, 0, 0.08f);
+    spectro.readSensor(0);
+    spectro.readSensor(0);
+    simSetErrorRate(0, 0, 0, 0);
+    spectro.flushOutput();
+    PortErrorStats errors = spectro.getPortErrors(0);
+    printf("8%% error rate: %lu transactions, %lu errors, %lu retries, %lu bus clears, "
+           "%lu step downs, %lu kHz\n", errors.transactions, errors.errors, errors.retries,
+           errors.busClears, errors.clockStepDowns, spectro.getPortClockHz(0) / 1000);
+    CHECK(errors.errors > errors.busClears);
+    CHECK(errors.clockStepDowns == errors.busClears);
+    CHECK(spectro.getPortClockHz(0) == 200000);
+}
+
+static void testScanFindsMaxClock() {
+    /* A full scan tunes the port to the fastest clock it answers at and saves it,
+    begin() with the saved ports uses it without testing again */
+    setUp(true);
+    simSetMaxClock(0, 0, 0, 200000);
+    SpectroDesktop *spectro = new SpectroDesktop();
+    spectro->setAutoClock(true, 0);
+    simResetCounters();
+    CHECK(spectro->begin());
+    unsigned long scanTransactions = simCounters().transactions;
+    CHECK(spectro->getPortClockHz(0) == 200000);
+    CHECK(spectro->getPortErrors(0).clockStepDowns == 1);
+    delete spectro;
+
+    spectro = new SpectroDesktop();
+    spectro->setAutoClock(true, 0);
+    simResetCounters();
+    CHECK(spectro->begin());
+    printf("begin() at a 200 kHz port: %lu transactions scanning, %lu with the saved ports\n",
+           scanTransactions, simCounters().transactions);
+    CHECK(simCounters().transactions < scanTransactions);
+    CHECK(spectro->getPortClockHz(0) == 200000);
+    delete spectro;
+}
+
+int main() {
+    testOffByDefault();
+    testStepDownPerFailedTransaction();
+    testErrorRate();
+    testScanFindsMaxClock();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,124 @@
+/*
+  Tests of the auto exposure (setAutoExposure() and autoExpose()) on the simulated
+  bus with scenes from dim to very bright: it ends with the brightest raw channel
+  in the target window, with the bulbs on it picks the LED current first and
+  lowers it for a bright sample, without bulbs (or only bulbs the part does not
+  have) it only changes the integration time, and each reading corrects the
+  next one from its own raw counts.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include "asm_sensors_w_mux_library.h"
+#include "sim_bus.h"
+#include "test_check.h"
+
+static void setUp(SpectroDesktop &spectro, uint8_t code, float reflectance, float ambient) {
+    simReset();
+    simAddMux(0, 0);
+    simAddSensor(0, 0, 0, code);
+    simSetScene(0, 0, 0, reflectance, ambient);
+    Serial.begin(115200);
+    CHECK(spectro.begin());
+}
+
+static uint16_t peak(SpectroDesktop &spectro) {
+    /* Brightest raw channel of the last measurement */
+    uint16_t counts[AS7265X_CHANNELS];
+    CHECK(spectro.readRawData(0, counts));
+    uint16_t brightest = 0;
+    for (byte i = 0; i < spectro.getChannelCount(0); i++) {
+        brightest = max(brightest, counts[i]);
+    }
+    return brightest;
+}
+
+static bool inWindow(uint16_t value) {
+    return value >= AUTO_EXPOSURE_LOW && value < MAX_CHANNEL_VALUE;
+}
+
+static void testBulbsOn() {
+    /* A very bright sample settles at 25 mA and 6 cycles, a dim one at 100 mA */
+    SpectroDesktop bright;
+    setUp(bright, SIM_AS7262, 50.0f, 0.05f);
+    CHECK(bright.autoExpose(0));
+    printf("bright, bulb on: %u cycles, current %u, peak %u\n", bright.getIntTime(0),
+           bright.getBulbCurrent(0), peak(bright));
+    CHECK(bright.getBulbCurrent(0) == 0b01);
+    CHECK(bright.getIntTime(0) == 6);
+    CHECK(inWindow(peak(bright)));
+
+    SpectroDesktop dim;
+    setUp(dim, SIM_AS7262, 0.3f, 0.05f);
+    CHECK(dim.autoExpose(0));
+    printf("dim, bulb on: %u cycles, current %u, peak %u\n", dim.getIntTime(0),
+           dim.getBulbCurrent(0), peak(dim));
+    CHECK(dim.getBulbCurrent(0) == MAX_LED_CURRENT);
+    CHECK(inWindow(peak(dim)));
+    dim.flushOutput();
+}
+
+static void testBulbsOff() {
+    /* With no bulb the part has enabled the current is not touched, only the time */
+    const byte enables[] = { 0, 0x06 };  // 0x06 is the AS7265x UV and IR bulbs
+    for (byte enable : enables) {
+        SpectroDesktop spectro;
+        setUp(spectro, SIM_AS7262, 5.0f, 1.0f);
+        spectro.setEnableBulb(0, enable);
+        CHECK(spectro.autoExpose(0));
+        printf("bulb enable 0x%02X: %u cycles, current %u, peak %u\n", enable, spectro.getIntTime(0),
+               spectro.getBulbCurrent(0), peak(spectro));
+        CHECK(spectro.getBulbCurrent(0) == 0);
+        CHECK(inWindow(peak(spectro)));
+        CHECK(simBulbOnUs(0, 0, 0, 0) == 0);
+        spectro.flushOutput();
+    }
+}
+
+static void testReadingsCorrect() {
+    /* After the first reading each reading's own raw counts correct the next one, the
+    readings cost less on the bus than a reading and a raw read each */
+    const uint8_t codes[] = { SIM_AS7262, SIM_AS7265X };
+    for (uint8_t code : codes) {
+        SpectroDesktop spectro;
+        setUp(spectro, code, 1.0f, 1.0f);
+        spectro.setAutoExposure(0, true);
+        spectro.readSensor(0);  // runs autoExpose() first
+        CHECK(inWindow(peak(spectro)));
+        byte settled = spectro.getIntTime(0);
+
+        // the sample gets 4 times darker, the reading that sees it sets the next one
+        simSetScene(0, 0, 0, 0.25f, 0.25f);
+        spectro.readSensor(0);
+        CHECK(!inWindow(peak(spectro)));
+        CHECK(spectro.getIntTime(0) > settled || spectro.getBulbCurrent(0) == MAX_LED_CURRENT);
+        spectro.readSensor(0);
+        CHECK(inWindow(peak(spectro)));
+
+        // with nothing to change, against the same reading without auto exposure and a raw read
+        spectro.resetBusStats();
+        spectro.readSensor(0);
+        unsigned long readingTransactions = spectro.getBusStats().transactions;
+
+        spectro.setAutoExposure(0, false);
+        spectro.resetBusStats();
+        spectro.readSensor(0);
+        uint16_t counts[AS7265X_CHANNELS];
+        spectro.readRawData(0, counts);
+        unsigned long separateTransactions = spectro.getBusStats().transactions;
+        printf("sensor 0x%02X: auto exposed reading %lu transactions, reading and raw read %lu\n",
+               code, readingTransactions, separateTransactions);
+        CHECK(readingTransactions < separateTransactions);
+        spectro.flushOutput();
+    }
+}
+
+int main() {
+    testBulbsOn();
+    testBulbsOff();
+    testReadingsCorrect();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,101 @@
+/*
+  Tests of the I2C error handling (transfer() and recoverBus()) on the simulated
+  bus: errors, retries and bus clears are counted for the port the traffic is for,
+  looking for the muxes is counted for no port, an error a retry fixes costs
+  nothing more, and a stuck bus is cleared and the reading still made.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include "asm_sensors_w_mux_library.h"
+#include "sim_bus.h"
+#include "test_check.h"
+
+static void setUp(SpectroDesktop &spectro) {
+    /* An AS7262 on mux ports 0 and 1, without buttons so all the traffic is the library's */
+    simReset();
+    simAddMux(0, 0);
+    simAddSensor(0, 0, 0, SIM_AS7262);
+    simAddSensor(0, 0, 1, SIM_AS7262);
+    Serial.begin(115200);
+    CHECK(spectro.begin());
+}
+
+static void testPortStats() {
+    SpectroDesktop spectro;
+    setUp(spectro);
+    spectro.readSensor(1);
+    spectro.readSensor(0);
+
+    // the first transaction of a reading of port 1 is for port 1, a retry fixes it
+    spectro.resetBusStats();
+    simFailNext(1, I2C_BUS_ERROR);
+    spectro.readSensor(1);
+    PortErrorStats errors = spectro.getPortErrors(1);
+    CHECK(errors.errors == 1 && errors.retries == 1 && errors.busClears == 0);
+    CHECK(errors.lastError == I2C_BUS_ERROR);
+    CHECK(errors.transactions == spectro.getBusStats().transactions);
+    CHECK(spectro.getPortErrors(0).transactions == 0);
+    CHECK(spectro.getPortErrors(0).errors == 0);
+
+    // begin() after a reading of port 1, with and without an error checking for the mux
+    // (the button driver's check comes first and takes the first failure)
+    spectro.resetBusStats();
+    CHECK(spectro.begin());
+    PortErrorStats clean = spectro.getPortErrors(1);
+    BusStats cleanBus = spectro.getBusStats();
+    spectro.readSensor(1);
+    spectro.resetBusStats();
+    simFailNext(2, I2C_BUS_ERROR);
+    CHECK(spectro.begin());
+    errors = spectro.getPortErrors(1);
+    BusStats bus = spectro.getBusStats();
+    printf("begin() after a reading of port 1: %lu more errors, %lu more retries, port 1 %lu more\n",
+           bus.errors - cleanBus.errors, bus.retries - cleanBus.retries, errors.errors - clean.errors);
+    CHECK(bus.errors == cleanBus.errors + 1 && bus.retries == cleanBus.retries + 1);
+    CHECK(errors.errors == clean.errors && errors.retries == clean.retries);
+    CHECK(errors.transactions == clean.transactions);
+    spectro.flushOutput();
+}
+
+static void testStuckBus() {
+    /* A device holding the bus fails every try, the bus is restarted once and the
+    reading made anyway */
+    SpectroDesktop spectro;
+    setUp(spectro);
+    spectro.readSensor(0);
+    float before[AS726X_CHANNELS];
+    CHECK(spectro.readCalibratedData(0, before));
+
+    spectro.resetBusStats();
+    unsigned long restarts = simBusRestarts(0);
+    simSetStuck(0, true);
+    spectro.readSensor(0);
+    PortErrorStats errors = spectro.getPortErrors(0);
+    printf("stuck bus: %lu errors, %lu retries, %lu bus clears, %lu restarts\n", errors.errors,
+           errors.retries, errors.busClears, simBusRestarts(0) - restarts);
+    CHECK(simBusRestarts(0) == restarts + 1);
+    CHECK(errors.busClears == 1);
+    CHECK(errors.retries == I2C_MAX_RETRIES);
+    CHECK(spectro.getBusStats().busClears == 1);
+
+    // the bus works again and the reading was the same as before
+    float after[AS726X_CHANNELS];
+    CHECK(spectro.readCalibratedData(0, after));
+    for (byte i = 0; i < AS726X_CHANNELS; i++) {
+        CHECK(after[i] == before[i]);
+    }
+    spectro.resetBusStats();
+    spectro.readSensor(0);
+    CHECK(spectro.getBusStats().errors == 0);
+    spectro.flushOutput();
+}
+
+int main() {
+    testPortStats();
+    testStuckBus();
+    return CHECK_RESULT();
+}
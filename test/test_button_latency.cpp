@@ -0,0 +1,122 @@
+/*
+  Tests of the button polling of pollButtons() on the simulated bus: every click
+  gets its reading, 2 clicks in the same poll are both handled, the latency is
+  from the status read that saw the click to its measurement starting (so a click
+  that waits behind another port's reading shows that wait), and with the button
+  interrupt pin nothing is put on the bus until a button is clicked.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include "asm_sensors_w_mux_library.h"
+#include "sim_bus.h"
+#include "test_check.h"
+
+const uint8_t PORTS = 3;
+const uint8_t INTERRUPT_PIN = 2;
+
+static PortMask sentPorts() {
+    /* Ports of the data frames written to the serial port since the last call */
+    SpectroFrameDecoder decoder;
+    PortMask ports = 0;
+    std::string &output = simSerialOutput();
+    for (size_t i = 0; i < output.size(); i++) {
+        SpectroFrame frame;
+        if (decoder.feed(output[i]) && decoder.type() == SPECTRO_FRAME_DATA &&
+            decodeDataFrame(decoder.payload(), decoder.length(), frame)) {
+            ports |= PORT_BIT(frame.port);
+        }
+    }
+    output.clear();
+    return ports;
+}
+
+static void setUp(SpectroDesktop &spectro) {
+    /* An AS7262 with a button on mux ports 0 to 2 */
+    simReset();
+    simAddMux(0, 0);
+    for (uint8_t i = 0; i < PORTS; i++) {
+        simAddSensor(0, 0, i, SIM_AS7262);
+        simAddButton(0, 0, i);
+    }
+    Serial.begin(115200);
+    CHECK(spectro.begin());
+    CHECK(spectro.getButtonPorts() == 0x07);
+    spectro.setOutputMode(BINARY_OUTPUT);
+    spectro.flushOutput();
+    sentPorts();
+}
+
+static void testPolling() {
+    SpectroDesktop spectro;
+    setUp(spectro);
+    spectro.pollButtons();
+    spectro.flushOutput();
+    CHECK(sentPorts() == 0);
+
+    // 1 click, read straight away
+    simClickButton(0, 0, 2);
+    spectro.pollButtons();
+    spectro.flushOutput();
+    CHECK(sentPorts() == PORT_BIT(2));
+    CHECK(spectro.getLastButtonLatency() < 1000);
+    CHECK(simButtonLed(0, 0, 2) == 0);  // off again after the reading
+
+    // the time 1 reading takes, what a click behind it waits
+    unsigned long long start = simNowUs();
+    spectro.readSensor(0);
+    unsigned long readingUs = simNowUs() - start;
+    spectro.flushOutput();
+    sentPorts();
+
+    // 2 clicks in the same poll are both read, the second 1 reading later
+    simClickButton(0, 0, 0);
+    simClickButton(0, 0, 2);
+    spectro.pollButtons();
+    spectro.flushOutput();
+    CHECK(sentPorts() == (PORT_BIT(0) | PORT_BIT(2)));
+    printf("second click in a poll: %lu us latency, a reading takes %lu us\n",
+           spectro.getLastButtonLatency(), readingUs);
+    CHECK(spectro.getLastButtonLatency() >= readingUs);
+    CHECK(spectro.getMaxButtonLatency() == spectro.getLastButtonLatency());
+
+    // the clicks were cleared, nothing is read again
+    spectro.pollButtons();
+    spectro.flushOutput();
+    CHECK(sentPorts() == 0);
+}
+
+static void testInterruptPin() {
+    SpectroDesktop spectro;
+    setUp(spectro);
+    simSetButtonInterruptPin(INTERRUPT_PIN);
+    spectro.setButtonInterruptPin(INTERRUPT_PIN);
+    CHECK(digitalRead(INTERRUPT_PIN) == HIGH);
+
+    // no click, no bus traffic
+    simResetCounters();
+    for (int i = 0; i < 10; i++) {
+        spectro.pollButtons();
+    }
+    CHECK(simCounters().transactions == 0);
+
+    simClickButton(0, 0, 1);
+    CHECK(digitalRead(INTERRUPT_PIN) == LOW);
+    spectro.pollButtons();
+    spectro.flushOutput();
+    CHECK(sentPorts() == PORT_BIT(1));
+    CHECK(digitalRead(INTERRUPT_PIN) == HIGH);  // the click was cleared
+
+    simResetCounters();
+    spectro.pollButtons();
+    CHECK(simCounters().transactions == 0);
+}
+
+int main() {
+    testPolling();
+    testInterruptPin();
+    return CHECK_RESULT();
+}
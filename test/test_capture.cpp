@@ -0,0 +1,186 @@
+/*
+  Tests of the capture sequence (startCapture() and captureSequence()) on the
+  simulated bus: each frame is read out before the next one is started, so every
+  frame has the light of its own bulb alone even when the integration is shorter
+  than a readout, each bulb is only on for about its own frame, and a frame
+  dropped because the record queue is full leaves a gap in the sequence numbers
+  like a dropped reading does.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include <math.h>
+#include "asm_sensors_w_mux_library.h"
+#include "sim_bus.h"
+#include "test_check.h"
+
+const int MAX_FRAMES = 8;
+const byte AS7265X_BULBS = 0x07;
+
+struct Sent {
+    int frameCount;  // capture frames
+    SpectroFrame frames[MAX_FRAMES];
+    int readingCount;  // data frames
+    uint16_t readingSequences[MAX_FRAMES];
+};
+
+static Sent decodeOutput() {
+    /* Decode the frames written to the serial port since the last call */
+    Sent sent = {};
+    SpectroFrameDecoder decoder;
+    std::string &output = simSerialOutput();
+    for (size_t i = 0; i < output.size(); i++) {
+        if (!decoder.feed(output[i])) {
+            continue;
+        }
+        SpectroFrame frame;
+        if (decoder.type() == SPECTRO_FRAME_CAPTURE && sent.frameCount < MAX_FRAMES &&
+            decodeCaptureFrame(decoder.payload(), decoder.length(), sent.frames[sent.frameCount])) {
+            sent.frameCount++;
+        }
+        else if (decoder.type() == SPECTRO_FRAME_DATA && sent.readingCount < MAX_FRAMES &&
+                 decodeDataFrame(decoder.payload(), decoder.length(), frame)) {
+            sent.readingSequences[sent.readingCount++] = frame.sequence;
+        }
+    }
+    output.clear();
+    return sent;
+}
+
+static void setUp(SpectroDesktop &spectro) {
+    /* An AS7262 on mux port 0 and an AS7265x on port 1, binary output */
+    simReset();
+    simAddMux(0, 0);
+    simAddSensor(0, 0, 0, SIM_AS7262);
+    simAddSensor(0, 0, 1, SIM_AS7265X);
+    simSetScene(0, 0, 1, 0.5f, 0.2f);
+    Serial.begin(115200);
+    CHECK(spectro.begin());
+    spectro.setOutputMode(BINARY_OUTPUT);
+    spectro.flushOutput();
+    simSerialOutput().clear();
+}
+
+static void acquire(SpectroDesktop &spectro, PortMask ports) {
+    /* Start a measurement on ports and wait for it, leaving the readings in the queue */
+    spectro.startAcquisition(ports);
+    while (spectro.serviceAcquisition() != 0) {
+        delay(1);
+    }
+}
+
+static bool sameValues(const float *a, const float *b, byte channels) {
+    for (byte i = 0; i < channels; i++) {
+        if (fabs(a[i] - b[i]) > 0.01f * fabs(b[i]) + 0.01f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void testFrames() {
+    /* The dark frame is the sample with the bulbs off and each lit frame has 1 bulb's
+    light, the bulbs each give the same light in the simulator */
+    SpectroDesktop spectro;
+    setUp(spectro);
+    simSetCycleUs(50);  // integrations much shorter than a readout
+    spectro.setEnableBulb(1, 0);
+    spectro.readSensor(1);
+    float dark[AS7265X_CHANNELS];
+    CHECK(spectro.readCalibratedData(1, dark));
+    spectro.setEnableBulb(1, AS7265X_BULBS);
+    spectro.flushOutput();
+    decodeOutput();
+
+    CHECK(spectro.captureSequence(1));
+    spectro.flushOutput();
+    Sent sent = decodeOutput();
+    CHECK(sent.frameCount == 4);
+    if (sent.frameCount != 4) {
+        return;
+    }
+    CHECK(sent.frames[0].kind == RECORD_DARK && sent.frames[0].bulbMask == 0);
+    CHECK(sameValues(sent.frames[0].channels, dark, AS7265X_CHANNELS));
+    for (int i = 1; i < 4; i++) {
+        CHECK(sent.frames[i].kind == RECORD_DARK_SUBTRACTED);
+        CHECK(sent.frames[i].bulbMask == 1 << (i - 1));
+        CHECK(sent.frames[i].sequence == sent.frames[0].sequence);
+        CHECK(sent.frames[i].channels[0] > 0);
+        CHECK(sameValues(sent.frames[i].channels, sent.frames[1].channels, AS7265X_CHANNELS));
+    }
+    printf("capture at 50 us cycles: dark %.1f, each bulb %.1f on channel 0\n",
+           sent.frames[0].channels[0], sent.frames[1].channels[0]);
+}
+
+static void testBulbOnTime() {
+    /* Each bulb is on for its own frame and the readout around it, not the whole capture */
+    SpectroDesktop spectro;
+    setUp(spectro);
+    spectro.setEnableBulb(1, AS7265X_BULBS);
+    unsigned long long start = simNowUs();
+    CHECK(spectro.captureSequence(1));
+    unsigned long long captureUs = simNowUs() - start;
+    spectro.flushOutput();
+    unsigned long long frameUs = 2ULL * spectro.getIntTime(1) * INTEGRATION_CYCLE_US;
+    for (uint8_t device = 0; device < 3; device++) {
+        unsigned long long onUs = simBulbOnUs(0, 0, 1, device);
+        printf("bulb %u on for %llu us of a %llu us capture\n", device, onUs, captureUs);
+        CHECK(onUs >= frameUs);
+        CHECK(onUs < captureUs / 3);
+    }
+}
+
+static void testDroppedFrames() {
+    /* With the queue full the frames that do not fit are dropped, each uses up a
+    sequence number the way a dropped reading does */
+    SpectroDesktop spectro;
+    setUp(spectro);
+    spectro.setOverflowPolicy(DROP_NEWEST);
+    spectro.setEnableBulb(1, AS7265X_BULBS);
+
+    // 2 readings dropped from a full queue leave a gap of 2
+    for (int i = 0; i < SPECTRAL_RECORD_QUEUE_SIZE + 2; i++) {
+        acquire(spectro, PORT_BIT(0));
+    }
+    spectro.drainRecords(SPECTRAL_RECORD_QUEUE_SIZE);
+    acquire(spectro, PORT_BIT(0));
+    spectro.drainRecords(SPECTRAL_RECORD_QUEUE_SIZE);
+    spectro.flushOutput();
+    Sent sent = decodeOutput();
+    CHECK(sent.readingCount == SPECTRAL_RECORD_QUEUE_SIZE + 1);
+    uint16_t last = sent.readingSequences[sent.readingCount - 1];
+    CHECK(last - sent.readingSequences[sent.readingCount - 2] == 1 + 2);
+
+    // the readings and the dark frame fill the queue, the 3 lit frames are dropped
+    for (int i = 0; i < SPECTRAL_RECORD_QUEUE_SIZE - 1; i++) {
+        acquire(spectro, PORT_BIT(0));
+    }
+    CHECK(spectro.startCapture(1));
+    while (spectro.serviceAcquisition() != 0) {
+        delay(1);
+    }
+    spectro.drainRecords(SPECTRAL_RECORD_QUEUE_SIZE);
+    acquire(spectro, PORT_BIT(0));
+    spectro.drainRecords(SPECTRAL_RECORD_QUEUE_SIZE);
+    spectro.flushOutput();
+    sent = decodeOutput();
+    CHECK(sent.frameCount == 1 && sent.readingCount == SPECTRAL_RECORD_QUEUE_SIZE);
+    if (sent.frameCount != 1 || sent.readingCount != SPECTRAL_RECORD_QUEUE_SIZE) {
+        return;
+    }
+    uint16_t capture = sent.frames[0].sequence;
+    uint16_t next = sent.readingSequences[sent.readingCount - 1];
+    printf("capture %u with 3 frames dropped, the next reading is %u\n", capture, next);
+    CHECK(capture == last + SPECTRAL_RECORD_QUEUE_SIZE);
+    CHECK(next == capture + 1 + 3);
+}
+
+int main() {
+    testFrames();
+    testBulbOnTime();
+    testDroppedFrames();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,27 @@
+/*
+  Checks for the host tests, a failed check is printed and the test exits with 1.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#ifndef _TEST_CHECK_H
+#define _TEST_CHECK_H
+
+#include <stdio.h>
+
+static int checkFailures = 0;
+
+#define CHECK(condition) do { \
+		if (!(condition)) { \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			checkFailures++; \
+		} \
+	} while (0)
+
+// Return value of main()
+#define CHECK_RESULT()	(checkFailures == 0 ? 0 : 1)
+
+#endif
@@ -0,0 +1,111 @@
+/*
+  Tests of the hot plug rescan (setHotPlug() and rescanStep()) on the simulated
+  bus: a sensor plugged in or unplugged is found, a port that keeps changing (a
+  loose connector) writes nothing to EEPROM, and a change that settles is saved
+  once, TOPOLOGY_SAVE_DELAY_MS after the last change.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include "asm_sensors_w_mux_library.h"
+#include "sim_bus.h"
+#include "test_check.h"
+
+const unsigned long POLL_MS = 50;
+const int FLAPS = 50;
+const unsigned long FLAP_MS = 1000;  // a change every second, well inside TOPOLOGY_SAVE_DELAY_MS
+
+static void poll(SpectroDesktop &spectro, unsigned long ms) {
+    /* Call pollButtons() every POLL_MS for ms, like a sketch loop() */
+    for (unsigned long waited = 0; waited < ms; waited += POLL_MS) {
+        spectro.pollButtons();
+        delay(POLL_MS);
+    }
+}
+
+static void testPlugAndUnplug() {
+    simReset();
+    simAddMux(0, 0);
+    simAddSensor(0, 0, 0, SIM_AS7262);
+    Serial.begin(115200);
+    SpectroDesktop spectro;
+    CHECK(spectro.begin());
+    spectro.setHotPlug(true, 2);
+    CHECK(spectro.getPortSensorType(3) == NO_SENSOR);
+
+    simAddSensor(0, 0, 3, SIM_AS7265X);
+    simAddButton(0, 0, 3);
+    poll(spectro, 8 * POLL_MS);  // 1 port a poll
+    CHECK(spectro.getPortSensorType(3) == AS7265X_SENSOR);
+    CHECK(spectro.getButtonPorts() == PORT_BIT(3));
+
+    // unplugged after 2 missed checks in a row
+    simRemoveDevices(0, 0, 3);
+    poll(spectro, 8 * POLL_MS);
+    CHECK(spectro.getPortSensorType(3) == AS7265X_SENSOR);
+    poll(spectro, 8 * POLL_MS);
+    CHECK(spectro.getPortSensorType(3) == NO_SENSOR);
+    CHECK(spectro.getButtonPorts() == 0);
+    spectro.flushOutput();
+}
+
+static void testSaveOnceSettled() {
+    simReset();
+    simAddMux(0, 0);
+    simAddSensor(0, 0, 0, SIM_AS7262);
+    simAddButton(0, 0, 0);
+    Serial.begin(115200);
+    SpectroDesktop *spectro = new SpectroDesktop();
+    CHECK(spectro->begin());
+    spectro->setHotPlug(true, 1);
+    unsigned long writesAtStart = simEepromWrites();
+
+    // a loose connector, plugged and unplugged for longer than the save delay
+    for (int flap = 0; flap < FLAPS; flap++) {
+        if (flap % 2 == 0) {
+            simAddSensor(0, 0, 1, SIM_AS7263);
+        }
+        else {
+            simRemoveDevices(0, 0, 1);
+        }
+        poll(*spectro, FLAP_MS);
+    }
+    CHECK((unsigned long)FLAPS * FLAP_MS > TOPOLOGY_SAVE_DELAY_MS);
+    printf("%d flaps in %lu s: %lu EEPROM writes\n", FLAPS, FLAPS * FLAP_MS / 1000,
+           simEepromWrites() - writesAtStart);
+    CHECK(simEepromWrites() == writesAtStart);
+
+    // plugged in for good, nothing is written until the delay is up
+    simAddSensor(0, 0, 1, SIM_AS7263);
+    poll(*spectro, FLAP_MS);
+    CHECK(spectro->getPortSensorType(1) == AS7263_SENSOR);
+    poll(*spectro, TOPOLOGY_SAVE_DELAY_MS - 2 * FLAP_MS);
+    CHECK(simEepromWrites() == writesAtStart);
+    poll(*spectro, 2 * FLAP_MS);
+    unsigned long writesSaved = simEepromWrites();
+    printf("settled: saved with %lu EEPROM writes\n", writesSaved - writesAtStart);
+    CHECK(writesSaved > writesAtStart);
+
+    // and only the once
+    poll(*spectro, 3 * TOPOLOGY_SAVE_DELAY_MS);
+    CHECK(simEepromWrites() == writesSaved);
+    spectro->flushOutput();
+    delete spectro;
+
+    // what was saved is what begin() uses next time
+    simSerialOutput().clear();
+    spectro = new SpectroDesktop();
+    CHECK(spectro->begin());
+    CHECK(simSerialOutput().find("Using saved port setup") != std::string::npos);
+    CHECK(spectro->getPortSensorType(1) == AS7263_SENSOR);
+    delete spectro;
+}
+
+int main() {
+    testPlugAndUnplug();
+    testSaveOnceSettled();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,90 @@
+/*
+  Tests of the cached mux settings (enableMuxPort() and setMuxVerifyPolicy()) on
+  the simulated bus, counted by the bus traffic of readCalibratedData(): the port
+  that is already open costs nothing to select, another port of the same mux
+  costs 1 write, the read back is only done when the verify policy asks for it,
+  and a failed write is not trusted.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include "asm_sensors_w_mux_library.h"
+#include "sim_bus.h"
+#include "test_check.h"
+
+static void setUp(SpectroDesktop &spectro) {
+    /* AS7262s on mux ports 0 and 1, without buttons so all the traffic is the library's */
+    simReset();
+    simAddMux(0, 0);
+    simAddSensor(0, 0, 0, SIM_AS7262);
+    simAddSensor(0, 0, 1, SIM_AS7262);
+    Serial.begin(115200);
+    CHECK(spectro.begin());
+}
+
+static unsigned long readCost(SpectroDesktop &spectro, byte portNumber) {
+    /* Bus transactions of reading a port's data, the mux selection and the data read */
+    float values[AS726X_CHANNELS];
+    simResetCounters();
+    CHECK(spectro.readCalibratedData(portNumber, values));
+    return simCounters().transactions;
+}
+
+static void testCachedSelects() {
+    SpectroDesktop spectro;
+    setUp(spectro);
+    readCost(spectro, 0);
+    unsigned long dataRead = readCost(spectro, 0);  // the port is open, only the data read
+    unsigned long otherPort = readCost(spectro, 1) - dataRead;
+    unsigned long backAgain = readCost(spectro, 0) - dataRead;
+    printf("selects: same port 0, other port %lu, back %lu transactions\n", otherPort, backAgain);
+    CHECK(otherPort == 1 && backAgain == 1);
+    CHECK(readCost(spectro, 0) == dataRead);
+    spectro.flushOutput();
+}
+
+static void testVerifyPolicies() {
+    SpectroDesktop spectro;
+    setUp(spectro);
+    readCost(spectro, 0);
+    unsigned long dataRead = readCost(spectro, 0);
+
+    // every write is read back
+    spectro.setMuxVerifyPolicy(VERIFY_ALWAYS);
+    CHECK(readCost(spectro, 1) - dataRead == 2);
+    CHECK(readCost(spectro, 1) == dataRead);  // no write, nothing to read back
+
+    // after 4 selects from the cache the next one writes and reads back, even to the open port
+    spectro.setMuxVerifyPolicy(VERIFY_PERIODIC, 4);
+    unsigned long extra = 0;
+    for (int i = 0; i < 10; i++) {
+        extra += readCost(spectro, 1) - dataRead;
+    }
+    printf("10 selects of the open port with a period of 4: %lu extra transactions\n", extra);
+    CHECK(extra == 2 * 2);
+    spectro.flushOutput();
+}
+
+static void testFailedWrite() {
+    /* A mux write that is not acknowledged leaves the cache unknown, the next select writes */
+    SpectroDesktop spectro;
+    setUp(spectro);
+    readCost(spectro, 0);
+    unsigned long dataRead = readCost(spectro, 0);
+    float values[AS726X_CHANNELS];
+    simFailNext(1, I2C_ADDRESS_NACK);
+    CHECK(!spectro.readCalibratedData(1, values));
+    CHECK(readCost(spectro, 1) - dataRead == 1);
+    CHECK(readCost(spectro, 1) == dataRead);
+    spectro.flushOutput();
+}
+
+int main() {
+    testCachedSelects();
+    testVerifyPolicies();
+    testFailedWrite();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,120 @@
+/*
+  Tests of the oversampling statistics (setOversampling() and oversample()) on the
+  simulated bus, against a scene whose light flickers between 2 known levels: the
+  4 statistics frames of a reading have the mean, sample variance, min and max of
+  the 2 levels, and a steady scene has no variance.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include <math.h>
+#include "asm_sensors_w_mux_library.h"
+#include "sim_bus.h"
+#include "test_check.h"
+
+const byte SAMPLES = 8;
+const float AMBIENT = 1.0f;
+const float FLICKER = 0.5f;  // more ambient light on every other measurement
+
+struct Statistics {
+    int count;
+    uint8_t sampleCount;
+    uint16_t sequence;
+    float values[4][AS726X_CHANNELS];  // by RECORD_MEAN - 1 ... RECORD_MAX - 1
+};
+
+static Statistics decodeOutput() {
+    /* Decode the statistics frames written to the serial port since the last call */
+    Statistics statistics = {};
+    SpectroFrameDecoder decoder;
+    std::string &output = simSerialOutput();
+    for (size_t i = 0; i < output.size(); i++) {
+        SpectroFrame frame;
+        if (decoder.feed(output[i]) && decoder.type() == SPECTRO_FRAME_STATS &&
+            decodeStatsFrame(decoder.payload(), decoder.length(), frame) &&
+            frame.kind >= RECORD_MEAN && frame.kind <= RECORD_MAX) {
+            memcpy(statistics.values[frame.kind - RECORD_MEAN], frame.channels,
+                   sizeof(statistics.values[0]));
+            statistics.sampleCount = frame.sampleCount;
+            statistics.sequence = frame.sequence;
+            statistics.count++;
+        }
+    }
+    output.clear();
+    return statistics;
+}
+
+static void setUp(SpectroDesktop &spectro) {
+    /* An AS7262 on mux port 0, its bulb off so the ambient light is all the light */
+    simReset();
+    simAddMux(0, 0);
+    simAddSensor(0, 0, 0, SIM_AS7262);
+    simSetScene(0, 0, 0, 1.0f, AMBIENT);
+    Serial.begin(115200);
+    CHECK(spectro.begin());
+    spectro.setEnableBulb(0, 0);
+    spectro.setOutputMode(BINARY_OUTPUT);
+    spectro.flushOutput();
+    simSerialOutput().clear();
+}
+
+static bool near(float value, float expected) {
+    return fabs(value - expected) <= 1e-4f * fabs(expected) + 1e-3f;
+}
+
+static void testFlicker() {
+    SpectroDesktop spectro;
+    setUp(spectro);
+    // the 2 levels the flicker moves between, read 1 at a time
+    float low[AS726X_CHANNELS];
+    float high[AS726X_CHANNELS];
+    spectro.readSensor(0);
+    CHECK(spectro.readCalibratedData(0, low));
+    simSetScene(0, 0, 0, 1.0f, AMBIENT + FLICKER);
+    spectro.readSensor(0);
+    CHECK(spectro.readCalibratedData(0, high));
+    simSetScene(0, 0, 0, 1.0f, AMBIENT);
+    spectro.flushOutput();
+    simSerialOutput().clear();
+
+    simSetFlicker(0, 0, 0, FLICKER, 2);
+    spectro.setOversampling(0, SAMPLES);
+    spectro.readSensor(0);
+    spectro.flushOutput();
+    Statistics statistics = decodeOutput();
+    CHECK(statistics.count == 4);
+    CHECK(statistics.sampleCount == SAMPLES);
+    // half the samples at each level: the sample variance is n / (n - 1) of half the step squared
+    for (byte i = 0; i < AS726X_CHANNELS; i++) {
+        float halfStep = (high[i] - low[i]) / 2;
+        float mean = (low[i] + high[i]) / 2;
+        float variance = SAMPLES * halfStep * halfStep / (SAMPLES - 1);
+        CHECK(near(statistics.values[0][i], mean));
+        CHECK(near(statistics.values[1][i], variance));
+        CHECK(statistics.values[2][i] == low[i]);
+        CHECK(statistics.values[3][i] == high[i]);
+    }
+    printf("channel 0 between %.2f and %.2f: mean %.4f, variance %.4f\n", low[0], high[0],
+           statistics.values[0][0], statistics.values[1][0]);
+
+    // steady light, no variance and the min and max are the mean
+    simSetFlicker(0, 0, 0, 0, 0);
+    spectro.readSensor(0);
+    spectro.flushOutput();
+    Statistics steady = decodeOutput();
+    CHECK(steady.count == 4);
+    CHECK(steady.sequence == statistics.sequence + 1);  // the 4 frames are 1 reading
+    for (byte i = 0; i < AS726X_CHANNELS; i++) {
+        CHECK(near(steady.values[0][i], low[i]));
+        CHECK(steady.values[1][i] == 0);
+        CHECK(steady.values[2][i] == low[i] && steady.values[3][i] == low[i]);
+    }
+}
+
+int main() {
+    testFlicker();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,79 @@
+/*
+  Tests of the port number checks (checkPort()) on the simulated bus: a port past
+  the last one begin() found is refused without any bus traffic, and with text
+  output the message names the function that was called and the last port.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include "asm_sensors_w_mux_library.h"
+#include "sim_bus.h"
+#include "test_check.h"
+
+static std::string output(SpectroDesktop &spectro) {
+    /* What the library wrote to the serial port since the last call */
+    spectro.flushOutput();
+    std::string text = simSerialOutput();
+    simSerialOutput().clear();
+    return text;
+}
+
+static void testMux() {
+    /* With a mux the ports are 0 to 7 */
+    simReset();
+    simAddMux(0, 0);
+    simAddSensor(0, 0, 0, SIM_AS7262);
+    Serial.begin(115200);
+    SpectroDesktop spectro;
+    CHECK(spectro.begin());
+    output(spectro);
+    simResetCounters();
+
+    spectro.setIntTime(8, 50);
+    CHECK(output(spectro) == "setIntTime: port Number has to be 7 or less\r\n");
+    spectro.setGain(8, 1);
+    CHECK(output(spectro) == "setGain: port Number has to be 7 or less\r\n");
+    spectro.setBulbCurrent(200, 1);
+    CHECK(output(spectro) == "setBulbCurrent: port Number has to be 7 or less\r\n");
+    spectro.setEnableBulb(8, 0);
+    CHECK(output(spectro) == "setEnableBulb: port Number has to be 7 or less\r\n");
+    spectro.turnIndicatorOn(8);
+    CHECK(output(spectro) == "turnIndicatorOn: port Number has to be 7 or less\r\n");
+    spectro.readSensor(8);
+    CHECK(output(spectro) == "readSensor: port Number has to be 7 or less\r\n");
+    CHECK(simCounters().transactions == 0);
+
+    // binary output has no text in it
+    spectro.setOutputMode(BINARY_OUTPUT);
+    spectro.setIntTime(8, 50);
+    spectro.readSensor(8);
+    CHECK(output(spectro).empty());
+    CHECK(simCounters().transactions == 0);
+}
+
+static void testNoMux() {
+    /* The board's own Qwiic connection is port 0 and the only port */
+    simReset();
+    simAddSensor(0, SIM_NO_MUX, 0, SIM_AS7262);
+    Serial.begin(115200);
+    SpectroDesktop spectro;
+    CHECK(spectro.begin());
+    CHECK(spectro.getPortCount() == 1);
+    output(spectro);
+    spectro.setIntTime(1, 50);
+    std::string text = output(spectro);
+    printf("no mux, port 1: %s", text.c_str());
+    CHECK(text == "setIntTime: port Number has to be 0 or less\r\n");
+    spectro.setIntTime(0, 50);
+    CHECK(output(spectro).empty());
+    CHECK(spectro.getIntTime(0) == 50);
+}
+
+int main() {
+    testMux();
+    testNoMux();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,111 @@
+/*
+  Tests of the sampling scheduler (setSamplePeriod() and serviceScheduler()) on the
+  simulated bus: ports whose measurements fit in their periods are read every
+  period without a deadline miss, a period shorter than the measurement misses
+  every deadline and says by how much, and a sensor slower than its integration
+  time says (a slow clock) turns a schedule that fitted into misses.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include "asm_sensors_w_mux_library.h"
+#include "sim_bus.h"
+#include "test_check.h"
+
+const unsigned long RUN_MS = 5000;
+const byte INTEGRATION = 20;  // 2 * 20 * 2.8 ms = 112 ms a measurement
+
+static void setUp(SpectroDesktop &spectro) {
+    /* AS7262s on mux ports 0 and 1, binary output */
+    simReset();
+    simAddMux(0, 0);
+    simAddSensor(0, 0, 0, SIM_AS7262);
+    simAddSensor(0, 0, 1, SIM_AS7262);
+    Serial.begin(115200);
+    CHECK(spectro.begin());
+    spectro.setOutputMode(BINARY_OUTPUT);
+    for (byte i = 0; i < 2; i++) {
+        spectro.setIntTime(i, INTEGRATION);
+    }
+}
+
+static void run(SpectroDesktop &spectro, unsigned long ms) {
+    /* Call serviceScheduler() for ms, like a sketch loop() with a little other work */
+    spectro.resetScheduleStats();
+    spectro.startScheduler();
+    unsigned long start = millis();
+    while (millis() - start < ms) {
+        spectro.serviceScheduler();
+        delay(1);
+    }
+    spectro.stopScheduler();
+    spectro.flushOutput();
+    simSerialOutput().clear();
+}
+
+static void print(const char *name, ScheduleStats stats) {
+    printf("%s: %lu samples, %lu misses, mean jitter %lu ms, max jitter %lu ms, max late %lu ms\n",
+           name, stats.samples, stats.deadlineMisses,
+           (stats.samples > 0) ? stats.totalJitterMs / stats.samples : 0, stats.maxJitterMs,
+           stats.maxLatenessMs);
+}
+
+static void testDeadlinesMet() {
+    SpectroDesktop spectro;
+    setUp(spectro);
+    spectro.setSamplePeriod(0, 250);
+    spectro.setSamplePeriod(1, 500, 1);
+    run(spectro, RUN_MS);
+    ScheduleStats fast = spectro.getScheduleStats(0);
+    ScheduleStats slow = spectro.getScheduleStats(1);
+    print("250 ms period", fast);
+    print("500 ms period", slow);
+    CHECK(fast.samples >= RUN_MS / 250 - 1 && fast.samples <= RUN_MS / 250);
+    CHECK(slow.samples >= RUN_MS / 500 - 1 && slow.samples <= RUN_MS / 500);
+    CHECK(fast.deadlineMisses == 0 && slow.deadlineMisses == 0);
+    CHECK(fast.maxLatenessMs == 0 && slow.maxLatenessMs == 0);
+}
+
+static void testPeriodTooShort() {
+    /* A 100 ms period cannot fit a 112 ms measurement, every sample is late and the
+    releases that pass while it runs are skipped */
+    SpectroDesktop spectro;
+    setUp(spectro);
+    spectro.setSamplePeriod(0, 100);
+    run(spectro, RUN_MS);
+    ScheduleStats stats = spectro.getScheduleStats(0);
+    print("100 ms period", stats);
+    CHECK(stats.samples > 0);
+    CHECK(stats.samples < RUN_MS / 100);
+    CHECK(stats.deadlineMisses >= RUN_MS / 100 - 1);
+    CHECK(stats.maxLatenessMs >= 12);
+}
+
+static void testSlowSensor() {
+    /* The same schedule as testDeadlinesMet() with sensors taking 3 times their
+    integration time, the library waits for the data ready bit and counts the misses */
+    SpectroDesktop spectro;
+    setUp(spectro);
+    spectro.setSamplePeriod(0, 250);
+    spectro.setSamplePeriod(1, 500, 1);
+    simSetCycleUs(3 * SIM_DEFAULT_CYCLE_US);
+    run(spectro, RUN_MS);
+    simSetCycleUs(SIM_DEFAULT_CYCLE_US);
+    ScheduleStats fast = spectro.getScheduleStats(0);
+    ScheduleStats slow = spectro.getScheduleStats(1);
+    print("250 ms period, slow sensor", fast);
+    print("500 ms period, slow sensor", slow);
+    CHECK(fast.samples > 0 && fast.deadlineMisses > 0);
+    CHECK(fast.maxLatenessMs > 0);
+    CHECK(slow.samples > 0);
+}
+
+int main() {
+    testDeadlinesMet();
+    testPeriodTooShort();
+    testSlowSensor();
+    return CHECK_RESULT();
+}
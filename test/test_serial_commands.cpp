@@ -0,0 +1,186 @@
+/*
+  Tests of the serial commands (spectro_command.h and serviceCommands()) sent to
+  the library on the simulated serial port: every command is answered once with
+  its sequence number, good commands change the settings or start a reading,
+  bad ones are refused with the right reason and change nothing, and a command
+  that arrives in pieces is only run once its end has come.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include "asm_sensors_w_mux_library.h"
+#include "sim_bus.h"
+#include "test_check.h"
+
+const int MAX_ACKS = 16;
+
+struct Answers {
+    int ackCount;
+    uint16_t sequences[MAX_ACKS];
+    SpectroCommandStatus statuses[MAX_ACKS];
+    PortMask readings;  // ports of the data frames
+};
+
+static Answers decodeOutput() {
+    /* Decode the frames written to the serial port since the last call */
+    Answers answers = {};
+    SpectroFrameDecoder decoder;
+    std::string &output = simSerialOutput();
+    for (size_t i = 0; i < output.size(); i++) {
+        if (!decoder.feed(output[i])) {
+            continue;
+        }
+        const uint8_t *payload = decoder.payload();
+        SpectroFrame frame;
+        if (decoder.type() == SPECTRO_FRAME_ACK && decoder.length() == SPECTRO_ACK_PAYLOAD_SIZE &&
+            answers.ackCount < MAX_ACKS) {
+            answers.sequences[answers.ackCount] = payload[0] | (payload[1] << 8);
+            answers.statuses[answers.ackCount] = (SpectroCommandStatus)payload[2];
+            answers.ackCount++;
+        }
+        else if (decoder.type() == SPECTRO_FRAME_DATA &&
+                 decodeDataFrame(payload, decoder.length(), frame)) {
+            answers.readings |= PORT_BIT(frame.port);
+        }
+    }
+    output.clear();
+    return answers;
+}
+
+static Answers send(SpectroDesktop &spectro, const char *text) {
+    /* Send text to the library and run serviceCommands() until it is all read and any
+    reading it started is sent */
+    simSerialInput(text);
+    for (int i = 0; i < 5000 && (Serial.available() > 0 || spectro.serviceAcquisition() != 0); i++) {
+        spectro.serviceCommands();
+        delay(1);
+    }
+    spectro.drainRecords(SPECTRAL_RECORD_QUEUE_SIZE);
+    spectro.flushOutput();
+    return decodeOutput();
+}
+
+static void setUp(SpectroDesktop &spectro) {
+    /* An AS7262 on mux port 0 and an AS7265x on port 1, binary output */
+    simReset();
+    simAddMux(0, 0);
+    simAddSensor(0, 0, 0, SIM_AS7262);
+    simAddSensor(0, 0, 1, SIM_AS7265X);
+    Serial.begin(115200);
+    CHECK(spectro.begin());
+    spectro.setOutputMode(BINARY_OUTPUT);
+    spectro.flushOutput();
+    simSerialOutput().clear();
+}
+
+static void testGoodCommands() {
+    SpectroDesktop spectro;
+    setUp(spectro);
+    Answers answers = send(spectro, "1 INT 0 100; 2 led * 2;3 GAIN 1 0x01\n");
+    CHECK(answers.ackCount == 3);
+    for (int i = 0; i < answers.ackCount; i++) {
+        CHECK(answers.sequences[i] == i + 1 && answers.statuses[i] == COMMAND_OK);
+    }
+    CHECK(spectro.getIntTime(0) == 100);
+    CHECK(spectro.getBulbCurrent(0) == 2 && spectro.getBulbCurrent(1) == 2);
+    CHECK(spectro.getGain(1) == 1);
+
+    answers = send(spectro, "4 READ 1\n");
+    CHECK(answers.ackCount == 1 && answers.sequences[0] == 4 && answers.statuses[0] == COMMAND_OK);
+    CHECK(answers.readings == PORT_BIT(1));
+    answers = send(spectro, "SWEEP\n");  // no sequence number is answered as 0
+    CHECK(answers.ackCount == 1 && answers.sequences[0] == 0 && answers.statuses[0] == COMMAND_OK);
+    CHECK(answers.readings == (PORT_BIT(0) | PORT_BIT(1)));
+}
+
+static void testBadCommands() {
+    /* Each is refused with its reason and leaves the settings alone */
+    struct BadCommand {
+        const char *text;
+        uint16_t sequence;
+        SpectroCommandStatus status;
+    };
+    const BadCommand commands[] = {
+        { "10 FOO 1\n", 10, COMMAND_UNKNOWN },
+        { "11 INT 0\n", 11, COMMAND_BAD_ARGUMENTS },  // no value
+        { "12 INT 0 300\n", 12, COMMAND_BAD_ARGUMENTS },  // past 255
+        { "13 INT 0 5 6\n", 13, COMMAND_BAD_ARGUMENTS },  // too many
+        { "14 INT 0 x5\n", 14, COMMAND_BAD_ARGUMENTS },
+        { "15 LED 0 4\n", 15, COMMAND_BAD_ARGUMENTS },
+        { "16 INT 9 5\n", 16, COMMAND_BAD_PORT },  // past the mux's 8 ports
+        { "17 INT zero 5\n", 17, COMMAND_BAD_PORT },
+        { "18 CAPTURE *\n", 18, COMMAND_BAD_PORT },  // 1 capture at a time
+        { "19 READ 5\n", 19, COMMAND_FAILED },  // no sensor there
+        { "70000 STOP\n", 0, COMMAND_BAD_ARGUMENTS },  // sequence past 16 bits
+        { "20 INT 0 5 1234567890123456789012345\n", 20, COMMAND_TOO_LONG },
+    };
+    SpectroDesktop spectro;
+    setUp(spectro);
+    for (const BadCommand &command : commands) {
+        Answers answers = send(spectro, command.text);
+        CHECK(answers.ackCount == 1);
+        CHECK(answers.sequences[0] == command.sequence);
+        CHECK(answers.statuses[0] == command.status);
+        CHECK(answers.readings == 0);
+        if (answers.statuses[0] != command.status) {
+            printf("  %s  answered %s\n", command.text, commandStatusName(answers.statuses[0]));
+        }
+    }
+    CHECK(spectro.getIntTime(0) == AS7262Traits::defaultIntegration);
+    CHECK(spectro.getBulbCurrent(0) == 0);
+
+    // blank commands are not answered, the command after a bad one still runs
+    Answers answers = send(spectro, ";\n\r\n 21 BAR; 22 INT 0 50\n");
+    CHECK(answers.ackCount == 2);
+    CHECK(answers.sequences[0] == 21 && answers.statuses[0] == COMMAND_UNKNOWN);
+    CHECK(answers.sequences[1] == 22 && answers.statuses[1] == COMMAND_OK);
+    CHECK(spectro.getIntTime(0) == 50);
+}
+
+static void testTruncatedCommands() {
+    SpectroDesktop spectro;
+    setUp(spectro);
+    // a command without its end waits, whatever comes in between calls
+    Answers answers = send(spectro, "30 INT 0 1");
+    CHECK(answers.ackCount == 0);
+    CHECK(spectro.getIntTime(0) == AS7262Traits::defaultIntegration);
+    answers = send(spectro, "2");
+    CHECK(answers.ackCount == 0);
+    answers = send(spectro, "0;31 LED 0");
+    CHECK(answers.ackCount == 1 && answers.sequences[0] == 30 && answers.statuses[0] == COMMAND_OK);
+    CHECK(spectro.getIntTime(0) == 120);
+    answers = send(spectro, "\n");  // ended with its value missing
+    CHECK(answers.ackCount == 1 && answers.sequences[0] == 31 && answers.statuses[0] == COMMAND_BAD_ARGUMENTS);
+
+    // a long batch is read COMMAND_BYTES_PER_CALL characters at a time
+    std::string batch;
+    for (int i = 0; i < 10; i++) {
+        batch += "40 GAIN * 2;";
+    }
+    simSerialInput(batch);
+    spectro.serviceCommands();
+    CHECK(Serial.available() == (int)(batch.size() - COMMAND_BYTES_PER_CALL));
+    answers = send(spectro, "");
+    CHECK(answers.ackCount == 10);
+}
+
+static void testTextAnswers() {
+    SpectroDesktop spectro;
+    setUp(spectro);
+    spectro.setOutputMode(TEXT_OUTPUT);
+    simSerialInput("5 INT 1 20; 6 INT 1 0\n");
+    spectro.serviceCommands();
+    spectro.flushOutput();
+    CHECK(simSerialOutput() == "ACK 5\r\nNAK 6 BAD_ARGUMENTS\r\n");
+}
+
+int main() {
+    testGoodCommands();
+    testBadCommands();
+    testTruncatedCommands();
+    testTextAnswers();
+    return CHECK_RESULT();
+}
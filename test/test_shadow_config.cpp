@@ -0,0 +1,117 @@
+/*
+  Tests of the shadow settings (setConfig() and applyConfig()) on the simulated bus,
+  counted by the bus traffic of readSensor(): a setting is only written when it
+  changed, once however many times it was set before the next measurement, the
+  written value is the one the sensor measures with, and after a bus clear the
+  settings are read back before the next measurement.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include <math.h>
+#include "asm_sensors_w_mux_library.h"
+#include "sim_bus.h"
+#include "test_check.h"
+
+static void setUp(SpectroDesktop &spectro, uint8_t code) {
+    /* 1 sensor on mux port 0, without a button so all the traffic is the library's */
+    simReset();
+    simAddMux(0, 0);
+    simAddSensor(0, 0, 0, code);
+    Serial.begin(115200);
+    CHECK(spectro.begin());
+    spectro.readSensor(0);
+    spectro.flushOutput();
+}
+
+static unsigned long readingCost(SpectroDesktop &spectro) {
+    /* Bus transactions of 1 reading of port 0 */
+    simResetCounters();
+    spectro.readSensor(0);
+    spectro.flushOutput();
+    return simCounters().transactions;
+}
+
+static void testWrittenOnChange() {
+    SpectroDesktop spectro;
+    setUp(spectro, SIM_AS7262);
+    unsigned long reading = readingCost(spectro);
+    CHECK(readingCost(spectro) == reading);
+
+    // the same value again is not written
+    spectro.setIntTime(0, spectro.getIntTime(0));
+    spectro.setGain(0, spectro.getGain(0));
+    CHECK(readingCost(spectro) == reading);
+
+    // a new value is written once, with the next measurement
+    spectro.setIntTime(0, 100);
+    unsigned long oneWrite = readingCost(spectro) - reading;
+    CHECK(oneWrite > 0);
+    CHECK(readingCost(spectro) == reading);
+
+    // set 3 times before the measurement, still 1 write
+    spectro.setIntTime(0, 50);
+    spectro.setIntTime(0, 60);
+    spectro.setIntTime(0, 50);
+    CHECK(readingCost(spectro) - reading == oneWrite);
+    printf("AS7262 reading %lu transactions, writing the integration time %lu more\n",
+           reading, oneWrite);
+
+    // what was written is what the sensor measured with, the counts scale with the time
+    float at50[AS726X_CHANNELS];
+    CHECK(spectro.readCalibratedData(0, at50));
+    spectro.setIntTime(0, 100);
+    spectro.readSensor(0);
+    spectro.flushOutput();
+    float at100[AS726X_CHANNELS];
+    CHECK(spectro.readCalibratedData(0, at100));
+    CHECK(fabs(at100[0] - 2 * at50[0]) < 0.01f * at100[0]);
+}
+
+static void testAllDevicesWritten() {
+    /* An AS7265x LED current is written to each of its 3 devices, once */
+    SpectroDesktop spectro;
+    setUp(spectro, SIM_AS7265X);
+    unsigned long reading = readingCost(spectro);
+    spectro.setIntTime(0, 100);
+    unsigned long intTimeWrite = readingCost(spectro) - reading;
+    spectro.setBulbCurrent(0, 2);
+    unsigned long currentWrite = readingCost(spectro) - reading;
+    printf("AS7265x reading %lu transactions, integration time %lu more, LED current %lu more\n",
+           reading, intTimeWrite, currentWrite);
+    CHECK(intTimeWrite > 0);
+    CHECK(currentWrite > intTimeWrite);
+    CHECK(readingCost(spectro) == reading);
+}
+
+static void testReadBackAfterBusClear() {
+    /* A bus clear may have reset the sensor, its settings are read back once and only
+    the ones that do not match are written */
+    SpectroDesktop spectro;
+    setUp(spectro, SIM_AS7262);
+    spectro.setIntTime(0, 80);
+    unsigned long reading = readingCost(spectro);
+    reading = readingCost(spectro);
+
+    simSetStuck(0, true);
+    unsigned long withClear = readingCost(spectro);
+    unsigned long afterClear = readingCost(spectro);
+    printf("reading %lu transactions, with a bus clear %lu, the next %lu\n",
+           reading, withClear, afterClear);
+    CHECK(spectro.getPortErrors(0).busClears == 1);
+    CHECK(afterClear == reading);  // read back during the reading with the clear, not again
+    CHECK(spectro.getIntTime(0) == 80);
+    float values[AS726X_CHANNELS];
+    CHECK(spectro.readCalibratedData(0, values));
+    CHECK(values[0] > 0);
+}
+
+int main() {
+    testWrittenOnChange();
+    testAllDevicesWritten();
+    testReadBackAfterBusClear();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,239 @@
+/*
+  Tests of the delta compression (spectro_delta.h): a stream of keyframes and
+  delta frames from several ports, sent through SpectroFrameDecoder, decodes
+  to exactly the quantized readings, and after a lost frame a port gives no
+  readings until its next keyframe and is exact again from there.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include <math.h>
+#include <string.h>
+#include "spectro_delta.h"
+#include "test_check.h"
+
+const uint8_t PORTS = 8;
+const int FRAMES_PER_PORT = 400;  // past 256 so the port frame count wraps
+const size_t BUFFER_SIZE = SPECTRO_FRAME_MAX_PAYLOAD + SPECTRO_FRAME_OVERHEAD;
+
+static uint32_t randomState = 12345;
+
+static uint32_t nextRandom() {
+    /* Small fixed generator so every run sends the same stream */
+    randomState = randomState * 1103515245UL + 12345UL;
+    return randomState >> 8;
+}
+
+struct Port {
+    SpectroFrame frame;  // last reading, walks a little from frame to frame
+    SpectroDeltaState encoder;
+    SpectroDeltaState decoder;
+};
+
+static void startPort(Port &port, uint8_t number) {
+    memset(&port, 0, sizeof(port));
+    resetDeltaState(port.encoder);
+    resetDeltaState(port.decoder);
+    port.frame.port = number;
+    port.frame.sensorType = number % 3 == 0 ? 3 : 1;
+    port.frame.channelCount = number % 3 == 0 ? 18 : 6;
+    port.frame.timestamp = 1000UL * number;
+    for (uint8_t i = 0; i < port.frame.channelCount; i++) {
+        port.frame.channels[i] = (float)(nextRandom() % 50000) / 7.0f;
+    }
+}
+
+static void stepPort(Port &port, uint16_t sequence) {
+    /* Next reading: mostly small changes, now and then a jump or a negative value */
+    port.frame.sequence = sequence;
+    port.frame.timestamp += 150 + nextRandom() % 100;
+    for (uint8_t i = 0; i < port.frame.channelCount; i++) {
+        uint32_t choice = nextRandom() % 100;
+        if (choice < 2) {
+            port.frame.channels[i] = -(float)(nextRandom() % 100000) / 3.0f;
+        }
+        else if (choice < 5) {
+            port.frame.channels[i] = (float)(nextRandom() % 1000000);
+        }
+        else {
+            port.frame.channels[i] += ((int)(nextRandom() % 2001) - 1000) / 100.0f;
+        }
+    }
+}
+
+static bool sameAsEncoded(const Port &port, const SpectroFrame &decoded, uint8_t decimals) {
+    /* The decoder has to end up with the encoder's integers, and the channels with them / 10^decimals */
+    float scale = 1;
+    for (uint8_t i = 0; i < decimals; i++) {
+        scale *= 10;
+    }
+    if (decoded.port != port.frame.port || decoded.sensorType != port.frame.sensorType ||
+        decoded.timestamp != port.frame.timestamp || decoded.sequence != port.frame.sequence ||
+        decoded.channelCount != port.frame.channelCount || decoded.kind != RECORD_READING) {
+        return false;
+    }
+    for (uint8_t i = 0; i < decoded.channelCount; i++) {
+        float scaled = floor(port.frame.channels[i] * scale + 0.5f);
+        int32_t expected = scaled >= 2147483520.0f ? INT32_MAX :
+                           scaled <= -2147483648.0f ? INT32_MIN : (int32_t)scaled;
+        float expectedChannel = expected / scale;
+        if (port.decoder.values[i] != port.encoder.values[i] || port.decoder.values[i] != expected ||
+            memcmp(&decoded.channels[i], &expectedChannel, sizeof(float)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void testStream(uint8_t keyframeInterval, uint8_t decimals, unsigned dropEvery) {
+    /* Send FRAMES_PER_PORT readings of each port in turn, losing every dropEvery'th
+    frame (0 loses none), and check every frame the decoder accepts */
+    Port ports[PORTS];
+    for (uint8_t i = 0; i < PORTS; i++) {
+        startPort(ports[i], i);
+    }
+    SpectroFrameDecoder stream;
+    bool waitingForKeyframe[PORTS] = {};
+    unsigned long sent = 0;
+    unsigned long decoded = 0;
+    unsigned long mismatches = 0;
+    unsigned long lost = 0;
+    unsigned long skipped = 0;
+    unsigned long resyncs = 0;
+    uint16_t sequence = 0;
+    for (int n = 0; n < FRAMES_PER_PORT; n++) {
+        for (uint8_t p = 0; p < PORTS; p++) {
+            Port &port = ports[p];
+            stepPort(port, sequence++);
+            uint8_t buffer[BUFFER_SIZE];
+            size_t length = encodeDeltaFrame(port.frame, port.encoder, keyframeInterval, decimals,
+                                             buffer, sizeof(buffer));
+            CHECK(length > 0);
+            sent++;
+            if (dropEvery != 0 && sent % dropEvery == 0) {
+                lost++;
+                waitingForKeyframe[p] = true;
+                continue;
+            }
+            int frames = 0;
+            for (size_t i = 0; i < length; i++) {
+                if (stream.feed(buffer[i])) {
+                    frames++;
+                }
+            }
+            CHECK(frames == 1);
+            uint8_t type = stream.type();
+            CHECK(type == SPECTRO_FRAME_KEY || type == SPECTRO_FRAME_DELTA);
+            CHECK(stream.payload()[0] == p);
+            SpectroFrame frame;
+            bool accepted = decodeDeltaFrame(type, stream.payload(), stream.length(), port.decoder, frame);
+            if (waitingForKeyframe[p]) {
+                // after a loss the deltas are refused, the next keyframe is taken again
+                CHECK(accepted == (type == SPECTRO_FRAME_KEY));
+                if (!accepted) {
+                    skipped++;
+                    continue;
+                }
+                waitingForKeyframe[p] = false;
+                resyncs++;
+            }
+            CHECK(accepted);
+            if (!accepted) {
+                continue;
+            }
+            decoded++;
+            if (!sameAsEncoded(port, frame, decimals)) {
+                mismatches++;
+            }
+        }
+    }
+    printf("interval %u, %u decimals, losing 1 in %u: %lu sent, %lu lost, %lu skipped, %lu resyncs, "
+           "%lu decoded, %lu mismatches\n", keyframeInterval, decimals, dropEvery, sent, lost, skipped,
+           resyncs, decoded, mismatches);
+    CHECK(mismatches == 0);
+    CHECK(decoded + lost + skipped == sent);
+    CHECK(stream.crcErrors == 0);
+    if (dropEvery != 0 && keyframeInterval > 1) {
+        CHECK(skipped > 0 && resyncs > 0);
+    }
+}
+
+static void testBadPayloads() {
+    SpectroFrame frame = {};
+    frame.sensorType = 1;
+    frame.channelCount = 6;
+    SpectroDeltaState encoder;
+    SpectroDeltaState decoder;
+    resetDeltaState(encoder);
+    resetDeltaState(decoder);
+    uint8_t key[BUFFER_SIZE];
+    uint8_t delta[BUFFER_SIZE];
+    size_t keyLength = encodeDeltaFrame(frame, encoder, 16, 2, key, sizeof(key));
+    frame.channels[0] = 1.5f;
+    size_t deltaLength = encodeDeltaFrame(frame, encoder, 16, 2, delta, sizeof(delta));
+    CHECK(keyLength > 0 && deltaLength > 0);
+    CHECK(key[2] == SPECTRO_FRAME_KEY && delta[2] == SPECTRO_FRAME_DELTA);
+    SpectroFrame decoded;
+    // a delta before any keyframe is refused
+    CHECK(!decodeDeltaFrame(SPECTRO_FRAME_DELTA, &delta[4], delta[3], decoder, decoded));
+    // a keyframe cut short or with bytes left over is refused
+    CHECK(!decodeDeltaFrame(SPECTRO_FRAME_KEY, &key[4], key[3] - 1, decoder, decoded));
+    CHECK(!decoder.valid);
+    CHECK(!decodeDeltaFrame(SPECTRO_FRAME_KEY, &key[4], key[3] + 1, decoder, decoded));
+    CHECK(!decodeDeltaFrame(SPECTRO_FRAME_DATA, &key[4], key[3], decoder, decoded));
+    CHECK(decodeDeltaFrame(SPECTRO_FRAME_KEY, &key[4], key[3], decoder, decoded));
+    // the same delta twice looks like a gap in the port frame count
+    CHECK(decodeDeltaFrame(SPECTRO_FRAME_DELTA, &delta[4], delta[3], decoder, decoded));
+    CHECK(decoded.channels[0] == 1.5f);
+    CHECK(!decodeDeltaFrame(SPECTRO_FRAME_DELTA, &delta[4], delta[3], decoder, decoded));
+    CHECK(!decoder.valid);
+    // too many decimals, and a buffer too small for the frame
+    CHECK(encodeDeltaFrame(frame, encoder, 16, SPECTRO_MAX_DECIMALS + 1, key, sizeof(key)) == 0);
+    CHECK(encodeDeltaFrame(frame, encoder, 16, 2, key, keyLength - 1) == 0);
+}
+
+static void testExtremes() {
+    /* Values past 32 bits are clamped, NaN goes to the minimum, and a change across the
+    whole range wraps around the same way on both sides */
+    SpectroFrame frame = {};
+    frame.sensorType = 1;
+    frame.channelCount = 4;
+    const float readings[3][4] = {
+        { 1e12f, -1e12f, NAN, 0.0f },
+        { -1e12f, 1e12f, 0.0f, NAN },
+        { 0.01f, -0.01f, 0.004f, -0.006f },
+    };
+    const int32_t expected[3][4] = {
+        { INT32_MAX, INT32_MIN, INT32_MIN, 0 },
+        { INT32_MIN, INT32_MAX, 0, INT32_MIN },
+        { 1, -1, 0, -1 },
+    };
+    SpectroDeltaState encoder;
+    SpectroDeltaState decoder;
+    resetDeltaState(encoder);
+    resetDeltaState(decoder);
+    for (uint8_t n = 0; n < 3; n++) {
+        memcpy(frame.channels, readings[n], sizeof(readings[n]));
+        uint8_t buffer[BUFFER_SIZE];
+        CHECK(encodeDeltaFrame(frame, encoder, 16, 2, buffer, sizeof(buffer)) > 0);
+        SpectroFrame decoded;
+        CHECK(decodeDeltaFrame(buffer[2], &buffer[4], buffer[3], decoder, decoded));
+        for (uint8_t i = 0; i < frame.channelCount; i++) {
+            CHECK(decoder.values[i] == expected[n][i]);
+        }
+    }
+}
+
+int main() {
+    testStream(SPECTRO_DEFAULT_KEYFRAME_INTERVAL, SPECTRO_DEFAULT_DECIMALS, 0);
+    testStream(SPECTRO_DEFAULT_KEYFRAME_INTERVAL, SPECTRO_DEFAULT_DECIMALS, 37);
+    testStream(5, 0, 11);
+    testStream(255, 4, 101);
+    testStream(1, SPECTRO_MAX_DECIMALS, 0);  // only keyframes
+    testBadPayloads();
+    testExtremes();
+    return CHECK_RESULT();
+}
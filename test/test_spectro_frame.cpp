@@ -0,0 +1,231 @@
+/*
+  Tests of the portable frame encoder and decoder (spectro_frame.h and the
+  profile frame of spectro_profile.h): every frame type comes back the same
+  through SpectroFrameDecoder, every single bit error is caught by the CRC and
+  the decoder finds the next frame after garbage or a broken frame.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+*/
+
+#include <string.h>
+#include "spectro_frame.h"
+#include "spectro_profile.h"
+#include "test_check.h"
+
+const size_t BUFFER_SIZE = SPECTRO_FRAME_MAX_PAYLOAD + SPECTRO_FRAME_OVERHEAD;
+
+static SpectroFrame makeFrame(uint8_t channelCount, uint8_t kind) {
+    SpectroFrame frame = {};
+    frame.port = 13;
+    frame.sensorType = channelCount == 18 ? 3 : 1;
+    frame.timestamp = 0x89ABCDEFUL;
+    frame.sequence = 0xBEEF;
+    frame.channelCount = channelCount;
+    for (uint8_t i = 0; i < channelCount; i++) {
+        frame.channels[i] = (i % 2 ? -1.0f : 1.0f) * (i + 0.1234567f) * 1000.0f;
+    }
+    frame.kind = kind;
+    frame.sampleCount = kind == RECORD_READING ? 1 : 32;
+    frame.rejectedCount = kind == RECORD_READING ? 0 : 3;
+    frame.bulbMask = kind >= RECORD_DARK ? 0x05 : 0;
+    return frame;
+}
+
+static int feedAll(SpectroFrameDecoder &decoder, const uint8_t *bytes, size_t length) {
+    /* Feed every byte, returns the number of good frames the decoder reported */
+    int frames = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (decoder.feed(bytes[i])) {
+            frames++;
+        }
+    }
+    return frames;
+}
+
+static bool decodeAny(const SpectroFrameDecoder &decoder, SpectroFrame &frame) {
+    switch (decoder.type()) {
+        case SPECTRO_FRAME_DATA:
+            return decodeDataFrame(decoder.payload(), decoder.length(), frame);
+        case SPECTRO_FRAME_STATS:
+            return decodeStatsFrame(decoder.payload(), decoder.length(), frame);
+        case SPECTRO_FRAME_CAPTURE:
+            return decodeCaptureFrame(decoder.payload(), decoder.length(), frame);
+    }
+    return false;
+}
+
+static bool sameFrame(const SpectroFrame &a, const SpectroFrame &b) {
+    /* Every field that is sent, the channels compared bit for bit */
+    if (a.port != b.port || a.sensorType != b.sensorType || a.timestamp != b.timestamp ||
+        a.sequence != b.sequence || a.channelCount != b.channelCount || a.kind != b.kind) {
+        return false;
+    }
+    if (a.kind != RECORD_READING && a.kind < RECORD_DARK &&
+        (a.sampleCount != b.sampleCount || a.rejectedCount != b.rejectedCount)) {
+        return false;
+    }
+    if (a.kind >= RECORD_DARK && a.bulbMask != b.bulbMask) {
+        return false;
+    }
+    return memcmp(a.channels, b.channels, a.channelCount * sizeof(float)) == 0;
+}
+
+static void testCrc() {
+    const uint8_t check[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+    CHECK(spectroCrc16(check, sizeof(check)) == 0x29B1);  // CRC-16/CCITT-FALSE check value
+    // continuing a calculation gives the same CRC as doing it in 1 go
+    CHECK(spectroCrc16(&check[4], 5, spectroCrc16(check, 4)) == 0x29B1);
+}
+
+static void testRoundTrip() {
+    const uint8_t kinds[] = { RECORD_READING, RECORD_MEAN, RECORD_VARIANCE, RECORD_MIN, RECORD_MAX,
+                              RECORD_DARK, RECORD_LIT, RECORD_DARK_SUBTRACTED };
+    const uint8_t channelCounts[] = { 0, 6, 18 };
+    for (uint8_t kind : kinds) {
+        for (uint8_t channelCount : channelCounts) {
+            SpectroFrame sent = makeFrame(channelCount, kind);
+            uint8_t buffer[BUFFER_SIZE];
+            size_t length = encodeDataFrame(sent, buffer, sizeof(buffer));
+            CHECK(length > 0);
+            uint8_t expectedType = kind == RECORD_READING ? SPECTRO_FRAME_DATA :
+                                   kind >= RECORD_DARK ? SPECTRO_FRAME_CAPTURE : SPECTRO_FRAME_STATS;
+            SpectroFrameDecoder decoder;
+            // the frame is only reported on its last byte
+            CHECK(feedAll(decoder, buffer, length - 1) == 0);
+            CHECK(decoder.feed(buffer[length - 1]));
+            CHECK(decoder.type() == expectedType);
+            SpectroFrame received;
+            memset(&received, 0xA5, sizeof(received));
+            CHECK(decodeAny(decoder, received));
+            CHECK(sameFrame(sent, received));
+        }
+    }
+}
+
+static void testProfileRoundTrip() {
+    PortProfile sent = {};
+    for (uint8_t i = 0; i < PROFILE_EVENTS; i++) {
+        for (uint32_t us = 1; us < 3000000UL; us = us * 3 + i) {
+            addLatency(sent.events[i], us);
+        }
+    }
+    sent.counters[PROFILE_MUX_VERIFY_FAILS] = 7;
+    sent.counters[PROFILE_BUS_RESETS] = 0xFFFFFFFFUL;
+    uint8_t buffer[BUFFER_SIZE];
+    size_t length = encodeProfileFrame(0xFF, sent, buffer, sizeof(buffer));
+    CHECK(length == (size_t)PROFILE_PAYLOAD_SIZE + SPECTRO_FRAME_OVERHEAD);
+    SpectroFrameDecoder decoder;
+    CHECK(feedAll(decoder, buffer, length) == 1);
+    CHECK(decoder.type() == SPECTRO_FRAME_PROFILE);
+    uint8_t port = 0;
+    PortProfile received;
+    CHECK(decodeProfileFrame(decoder.payload(), decoder.length(), port, received));
+    CHECK(port == 0xFF);
+    CHECK(memcmp(&sent, &received, sizeof(sent)) == 0);
+}
+
+static void testSingleBitErrors() {
+    /* Flip each bit of a frame of each type in turn, no broken frame may be reported */
+    const uint8_t kinds[] = { RECORD_READING, RECORD_MEAN, RECORD_DARK_SUBTRACTED };
+    unsigned long flips = 0;
+    unsigned long caught = 0;
+    for (uint8_t kind : kinds) {
+        uint8_t frame[BUFFER_SIZE];
+        size_t length = encodeDataFrame(makeFrame(18, kind), frame, sizeof(frame));
+        for (size_t i = 0; i < length; i++) {
+            for (uint8_t bit = 0; bit < 8; bit++) {
+                uint8_t broken[BUFFER_SIZE];
+                memcpy(broken, frame, length);
+                broken[i] ^= 1 << bit;
+                SpectroFrameDecoder decoder;
+                flips++;
+                if (feedAll(decoder, broken, length) == 0) {
+                    caught++;
+                }
+            }
+        }
+    }
+    printf("single bit errors caught: %lu of %lu\n", caught, flips);
+    CHECK(flips > 0 && caught == flips);
+}
+
+static void testResync() {
+    uint8_t frame[BUFFER_SIZE];
+    size_t length = encodeDataFrame(makeFrame(6, RECORD_READING), frame, sizeof(frame));
+    uint8_t stream[4 * BUFFER_SIZE];
+    size_t streamLength = 0;
+    // garbage with false sync bytes in it, then a good frame
+    const uint8_t garbage[] = { 0x00, SPECTRO_FRAME_SYNC1, 0x11, SPECTRO_FRAME_SYNC1, SPECTRO_FRAME_SYNC1, 0x42 };
+    memcpy(&stream[streamLength], garbage, sizeof(garbage));
+    streamLength += sizeof(garbage);
+    memcpy(&stream[streamLength], frame, length);
+    streamLength += length;
+    SpectroFrameDecoder decoder;
+    CHECK(feedAll(decoder, stream, streamLength) == 1);
+
+    // a frame with a bad CRC is counted, the frame after it still comes through
+    streamLength = 0;
+    memcpy(&stream[streamLength], frame, length);
+    stream[streamLength + length - 1] ^= 0x01;
+    streamLength += length;
+    memcpy(&stream[streamLength], frame, length);
+    streamLength += length;
+    SpectroFrameDecoder second;
+    CHECK(feedAll(second, stream, streamLength) == 1);
+    CHECK(second.crcErrors == 1);
+    CHECK(second.goodFrames == 1);
+
+    // a frame cut short swallows the start of the next one, the frame after that is found
+    streamLength = 0;
+    memcpy(&stream[streamLength], frame, length / 2);
+    streamLength += length / 2;
+    for (int i = 0; i < 2; i++) {
+        memcpy(&stream[streamLength], frame, length);
+        streamLength += length;
+    }
+    SpectroFrameDecoder third;
+    CHECK(feedAll(third, stream, streamLength) >= 1);
+    CHECK(third.goodFrames >= 1);
+    SpectroFrame received;
+    CHECK(decodeDataFrame(third.payload(), third.length(), received));
+}
+
+static void testBadPayloads() {
+    uint8_t buffer[BUFFER_SIZE];
+    SpectroFrame sent = makeFrame(6, RECORD_READING);
+    size_t length = encodeDataFrame(sent, buffer, sizeof(buffer));
+    const uint8_t *payload = &buffer[4];
+    uint8_t payloadLength = buffer[3];
+    SpectroFrame received;
+    // the length has to match the channel count
+    CHECK(!decodeDataFrame(payload, payloadLength - 1, received));
+    CHECK(!decodeDataFrame(payload, 3, received));
+    // a reading is not a statistic or a capture frame
+    CHECK(!decodeStatsFrame(payload, payloadLength, received));
+    CHECK(!decodeCaptureFrame(payload, payloadLength, received));
+    // too many channels
+    uint8_t tooMany[BUFFER_SIZE];
+    memcpy(tooMany, payload, payloadLength);
+    tooMany[8] = SPECTRO_FRAME_MAX_CHANNELS + 1;
+    CHECK(!decodeDataFrame(tooMany, SPECTRO_DATA_HEADER_SIZE + 4 * (SPECTRO_FRAME_MAX_CHANNELS + 1), received));
+    // the encoder does not write past a buffer that is too small
+    CHECK(encodeDataFrame(sent, buffer, length - 1) == 0);
+    CHECK(encodeSpectroFrame(SPECTRO_FRAME_ACK, payload, 3, buffer, 8) == 0);
+    PortProfile profile = {};
+    CHECK(encodeProfileFrame(0, profile, buffer, PROFILE_PAYLOAD_SIZE) == 0);
+    uint8_t port;
+    CHECK(!decodeProfileFrame(payload, PROFILE_PAYLOAD_SIZE - 1, port, profile));
+}
+
+int main() {
+    testCrc();
+    testRoundTrip();
+    testProfileRoundTrip();
+    testSingleBitErrors();
+    testResync();
+    testBadPayloads();
+    return CHECK_RESULT();
+}